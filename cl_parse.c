@@ -106,6 +106,7 @@ const char *svc_strings[128] =
 	"svc_trailparticles", //	60		// [short] entnum [short] effectnum [vector] start [vector] end
 	"svc_pointparticles", //	61		// [short] effectnum [vector] start [vector] velocity [short] count
 	"svc_pointparticles1", //	62		// [short] effectnum [vector] start, same as svc_pointparticles except velocity is zero and count is 1
+	"svc_compressed", //	63		// [byte] codec [long] uncompressed size [compressed data to end of message]
 };
 
 const char *qw_svc_strings[128] =
@@ -188,6 +189,8 @@ cvar_t cl_readpicture_force = {0, "cl_readpicture_force", "0", "when enabled, th
 cvar_t cl_sound_ric_gunshot = {0, "cl_sound_ric_gunshot", "0", "specifies if and when the related cl_sound_ric and cl_sound_tink sounds apply to TE_GUNSHOT/TE_GUNSHOTQUAD, 0 = no sound, 1 = TE_GUNSHOT, 2 = TE_GUNSHOTQUAD, 3 = TE_GUNSHOT and TE_GUNSHOTQUAD"};
 cvar_t cl_sound_r_exp3 = {0, "cl_sound_r_exp3", "weapons/r_exp3.wav", "sound to play during TE_EXPLOSION and related effects (empty cvar disables sound)"};
 cvar_t cl_serverextension_download = {0, "cl_serverextension_download", "0", "indicates whether the server supports the download command"};
+cvar_t cl_serverextension_netcompress = {0, "cl_serverextension_netcompress", "0", "indicates whether the server supports compressed reliable messages (netcompress command)"};
+cvar_t cl_netcompress = {CVAR_SAVE, "cl_netcompress", "deflate", "codecs the server may use to compress large reliable messages, in order of preference (empty = no compression)"};
 cvar_t cl_joinbeforedownloadsfinish = {CVAR_SAVE, "cl_joinbeforedownloadsfinish", "1", "if non-zero the game will begin after the map is loaded before other downloads finish"};
 cvar_t cl_nettimesyncfactor = {CVAR_SAVE, "cl_nettimesyncfactor", "0", "rate at which client time adapts to match server time, 1 = instantly, 0.125 = slowly, 0 = not at all (bounding still applies)"};
 cvar_t cl_nettimesyncboundmode = {CVAR_SAVE, "cl_nettimesyncboundmode", "6", "method of restricting client time to valid values, 0 = no correction, 1 = tight bounding (jerky with packet loss), 2 = loose bounding (corrects it if out of bounds), 3 = leniant bounding (ignores temporary errors due to varying framerate), 4 = slow adjustment method from Quake3, 5 = slighttly nicer version of Quake3 method, 6 = bounding + Quake3"};
@@ -596,6 +599,8 @@ static void QW_CL_RequestNextDownload(void)
 {
 	int i;
 	char vabuf[1024];
+	static const char *const qw_crcmodels[2] = {"progs/player.mdl", "progs/eyes.mdl"};
+	int qw_crcs[2];
 
 	// clear name of file that just finished
 	cls.qw_downloadname[0] = 0;
@@ -699,8 +704,9 @@ static void QW_CL_RequestNextDownload(void)
 		CL_SetupWorldModel();
 
 		// add pmodel/emodel CRCs to userinfo
-		CL_SetInfo("pmodel", va(vabuf, sizeof(vabuf), "%i", FS_CRCFile("progs/player.mdl", NULL)), true, true, true, true);
-		CL_SetInfo("emodel", va(vabuf, sizeof(vabuf), "%i", FS_CRCFile("progs/eyes.mdl", NULL)), true, true, true, true);
+		FS_CRCFiles(2, qw_crcmodels, qw_crcs, NULL);
+		CL_SetInfo("pmodel", va(vabuf, sizeof(vabuf), "%i", qw_crcs[0]), true, true, true, true);
+		CL_SetInfo("emodel", va(vabuf, sizeof(vabuf), "%i", qw_crcs[1]), true, true, true, true);
 
 		// done checking sounds and models, send a prespawn command now
 		MSG_WriteByte(&cls.netcon->message, qw_clc_stringcmd);
@@ -1178,6 +1184,20 @@ static void CL_BeginDownloads(qboolean aborteddownload)
 				)
 			);
 			SCR_BeginLoadingPlaque(false);
+
+			// let the I/O threads read ahead while the models are parsed,
+			// skipping whatever is still loaded from the previous map
+			if (!sv.active)
+			{
+				int i;
+				sfx_t *sfx;
+				for (i = 1;i < cl.loadmodel_total;i++)
+					if (cl.model_name[i][0] != '*' && !Mod_FindName(cl.model_name[i], NULL)->loaded)
+						FS_PrefetchFile(cl.model_name[i]);
+				for (i = 1;i < cl.loadsound_total;i++)
+					if ((sfx = S_FindName(cl.sound_name[i])) && !S_IsSoundPrecached(sfx))
+						FS_PrefetchFile(strncasecmp(cl.sound_name[i], "sound/", 6) ? va(vabuf, sizeof(vabuf), "sound/%s", cl.sound_name[i]) : cl.sound_name[i]);
+			}
 		}
 		for (;cl.loadmodel_current < cl.loadmodel_total;cl.loadmodel_current++)
 		{
@@ -1408,22 +1428,43 @@ static void CL_BeginDownloads_f(void)
 	if(cl.loadbegun)
 		Con_Printf("cl_begindownloads is only valid once per match\n");
 	else
+	{
+		// ask again for compressed reliable messages, for servers that ignored
+		// the netcompress key of the connect request
+		if (cls.netcon && !sv.active && cl_serverextension_netcompress.integer && cl_netcompress.string[0])
+		{
+			char vabuf[1024];
+			Cmd_ForwardStringToServer(va(vabuf, sizeof(vabuf), "netcompress %s", cl_netcompress.string));
+		}
 		CL_BeginDownloads(false);
+	}
 }
 
 static void CL_StopDownload(int size, int crc)
 {
-	if (cls.qw_downloadmemory && cls.qw_downloadmemorycursize == size && CRC_Block(cls.qw_downloadmemory, cls.qw_downloadmemorycursize) == crc)
+	// everything was checksummed as it arrived unless there were gaps
+	qboolean streamed = cls.qw_downloadmemory && cls.dp_downloadstreamedsize == cls.qw_downloadmemorycursize;
+
+	if (cls.qw_downloadmemory && cls.qw_downloadmemorycursize == size && (streamed ? CRC_Value(cls.dp_downloadstreamcrc) : CRC_Block(cls.qw_downloadmemory, cls.qw_downloadmemorycursize)) == crc)
 	{
 		int existingcrc;
 		size_t existingsize;
 		const char *extension;
+		int inflatedcrc = -1;
 
 		if(cls.qw_download_deflate)
 		{
 			unsigned char *out;
 			size_t inflated_size;
-			out = FS_Inflate(cls.qw_downloadmemory, cls.qw_downloadmemorycursize, &inflated_size, tempmempool);
+			if (streamed && cls.dp_downloadinflater)
+				out = FS_InflateStream_End(cls.dp_downloadinflater, &inflated_size, &inflatedcrc);
+			else
+			{
+				if (cls.dp_downloadinflater)
+					FS_InflateStream_Abort(cls.dp_downloadinflater);
+				out = FS_Inflate(cls.qw_downloadmemory, cls.qw_downloadmemorycursize, &inflated_size, tempmempool);
+			}
+			cls.dp_downloadinflater = NULL;
 			Mem_Free(cls.qw_downloadmemory);
 			if(out)
 			{
@@ -1445,7 +1486,10 @@ static void CL_StopDownload(int size, int crc)
 		}
 		else
 		{
-			crc = CRC_Block(cls.qw_downloadmemory, cls.qw_downloadmemorycursize);
+			if (cls.qw_download_deflate && inflatedcrc != -1)
+				crc = inflatedcrc;
+			else
+				crc = CRC_Block(cls.qw_downloadmemory, cls.qw_downloadmemorycursize);
 			size = cls.qw_downloadmemorycursize;
 			// finished file
 			// save to disk only if we don't already have it
@@ -1500,6 +1544,10 @@ static void CL_StopDownload(int size, int crc)
 
 	if (cls.qw_downloadmemory)
 		Mem_Free(cls.qw_downloadmemory);
+	if (cls.dp_downloadinflater)
+		FS_InflateStream_Abort(cls.dp_downloadinflater);
+	cls.dp_downloadinflater = NULL;
+	cls.dp_downloadstreamedsize = 0;
 	cls.qw_downloadmemory = NULL;
 	cls.qw_downloadname[0] = 0;
 	cls.qw_downloadmemorymaxsize = 0;
@@ -1541,6 +1589,17 @@ static void CL_ParseDownload(void)
 	// (gaps are unacceptable)
 	memcpy(cls.qw_downloadmemory + start, data, size);
 	cls.qw_downloadmemorycursize = start + size;
+
+	// checksum and inflate the data now if it continues what came before
+	if (start <= cls.dp_downloadstreamedsize && start + size > cls.dp_downloadstreamedsize)
+	{
+		const unsigned char *newdata = cls.qw_downloadmemory + cls.dp_downloadstreamedsize;
+		int newsize = start + size - cls.dp_downloadstreamedsize;
+		CRC_ProcessBlock(&cls.dp_downloadstreamcrc, newdata, newsize);
+		if (cls.dp_downloadinflater)
+			FS_InflateStream_Feed(cls.dp_downloadinflater, newdata, newsize);
+		cls.dp_downloadstreamedsize = start + size;
+	}
 	cls.qw_downloadpercent = (int)floor((start+size) * 100.0 / cls.qw_downloadmemorymaxsize);
 	cls.qw_downloadpercent = bound(0, cls.qw_downloadpercent, 100);
 	cls.qw_downloadspeedcount += size;
@@ -1576,6 +1635,12 @@ static void CL_DownloadBegin_f(void)
 		// check further encodings here
 	}
 
+	cls.dp_downloadstreamedsize = 0;
+	CRC_Init(&cls.dp_downloadstreamcrc);
+	// the size comes from the server, start small and let the inflater grow
+	if (cls.qw_download_deflate)
+		cls.dp_downloadinflater = FS_InflateStream_Begin(min((size_t)cls.qw_downloadmemorymaxsize * 2, (size_t)1 << 20), true, cls.permanentmempool);
+
 	Cmd_ForwardStringToServer("sv_startdownload");
 }
 
@@ -1734,6 +1799,7 @@ static void CL_ParseServerInfo (void)
 
 	// clear cl_serverextension cvars
 	Cvar_SetValueQuick(&cl_serverextension_download, 0);
+	Cvar_SetValueQuick(&cl_serverextension_netcompress, 0);
 
 //
 // wipe the client_state_t struct
@@ -4342,6 +4408,8 @@ void CL_Parse_Init(void)
 
 	// server extension cvars set by commands issued from the server during connect
 	Cvar_RegisterVariable(&cl_serverextension_download);
+	Cvar_RegisterVariable(&cl_serverextension_netcompress);
+	Cvar_RegisterVariable(&cl_netcompress);
 
 	Cvar_RegisterVariable(&cl_nettimesyncfactor);
 	Cvar_RegisterVariable(&cl_nettimesyncboundmode);
@@ -885,6 +885,11 @@ typedef struct client_static_s
 	int qw_downloadspeedcount;
 	int qw_downloadspeedrate;
 	qboolean qw_download_deflate;
+	// the part of a download received in order so far is checksummed and
+	// inflated as it arrives, so finishing it doesn't have to go over it again
+	int dp_downloadstreamedsize;
+	unsigned short dp_downloadstreamcrc;
+	struct fs_inflatestream_s *dp_downloadinflater;
 
 	// current file upload buffer (for uploading screenshots to server)
 	unsigned char *qw_uploaddata;
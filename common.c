@@ -188,6 +188,25 @@ unsigned short CRC_Block(const unsigned char *data, size_t size)
 	return crc ^ CRC_XOR_VALUE;
 }
 
+// incremental version of CRC_Block for data that arrives in pieces
+void CRC_Init(unsigned short *crcvalue)
+{
+	*crcvalue = CRC_INIT_VALUE;
+}
+
+void CRC_ProcessBlock(unsigned short *crcvalue, const unsigned char *data, size_t size)
+{
+	unsigned short crc = *crcvalue;
+	while (size--)
+		crc = (crc << 8) ^ crctable[(crc >> 8) ^ (*data++)];
+	*crcvalue = crc;
+}
+
+unsigned short CRC_Value(unsigned short crcvalue)
+{
+	return crcvalue ^ CRC_XOR_VALUE;
+}
+
 unsigned short CRC_Block_CaseInsensitive(const unsigned char *data, size_t size)
 {
 	unsigned short crc = CRC_INIT_VALUE;
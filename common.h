@@ -59,6 +59,9 @@ void Com_HexDumpToConsole(const unsigned char *data, int size);
 
 unsigned short CRC_Block(const unsigned char *data, size_t size);
 unsigned short CRC_Block_CaseInsensitive(const unsigned char *data, size_t size); // for hash lookup functions that use strcasecmp for comparison
+void CRC_Init(unsigned short *crcvalue);
+void CRC_ProcessBlock(unsigned short *crcvalue, const unsigned char *data, size_t size);
+unsigned short CRC_Value(unsigned short crcvalue);
 
 unsigned char COM_BlockSequenceCRCByteQW(unsigned char *base, int length, int sequence);
 
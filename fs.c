@@ -41,6 +41,7 @@
 #else
 # include <pwd.h>
 # include <sys/stat.h>
+# include <sys/mman.h>
 # include <unistd.h>
 #endif
 
@@ -54,6 +55,7 @@
 #include "thread.h"
 
 #include "fs.h"
+#include "siphash.h"
 #ifndef CONFIG_SV
 #include "wad.h"
 #endif
@@ -169,15 +171,25 @@ CONSTANTS
 #define QFILE_FLAG_REMOVE (1 << 3)
 /// data will be Mem_Free'ed on close
 #define QFILE_FLAG_MEMFREE (1 << 4)
+/// written to memory and queued for writing to disk on close (FS_OpenRealFileAsync)
+#define QFILE_FLAG_WRITEQUEUE (1 << 5)
+/// queued file is written in text mode
+#define QFILE_FLAG_TEXT (1 << 6)
 
 #define FILE_BUFF_SIZE 2048
+/// compressed data read ahead at once, scaled with the size of the entry
+#define ZIP_READAHEAD_MIN 65536
+#define ZIP_READAHEAD_MAX 1048576
+/// largest compressed entry FS_LoadFile reads in one go to inflate it directly
+#define ZIP_WHOLEREAD_MAX (64 << 20)
 typedef struct
 {
 	z_stream	zstream;
 	size_t		comp_length;			///< length of the compressed file
 	size_t		in_ind, in_len;			///< input buffer current index and length
 	size_t		in_position;			///< position in the compressed file
-	unsigned char		input [FILE_BUFF_SIZE];
+	size_t		in_size;				///< size of the input buffer
+	unsigned char		*input;			///< allocated right after the ztoolkit_t
 } ztoolkit_t;
 
 struct qfile_s
@@ -196,6 +208,8 @@ struct qfile_s
 	ztoolkit_t*		ztk;	///< For zipped files.
 
 	const unsigned char *data;	///< For data files.
+	unsigned char *writedata;	///< For queued writes.
+	fs_offset_t writedatasize;	///< allocated size of writedata
 
 	const char *filename; ///< Kept around for QFILE_FLAG_REMOVE, unused otherwise
 };
@@ -240,6 +254,8 @@ struct packfile_s
 	fs_offset_t offset;
 	fs_offset_t packsize;	///< size in the package
 	fs_offset_t realsize;	///< real file size (uncompressed)
+	unsigned int crc32;	///< from the zip central directory, 0 if unknown
+	unsigned long long contenthash;	///< see FS_FileContentEqual, 0 until computed
 };
 
 struct pack_s
@@ -251,6 +267,9 @@ struct pack_s
 	int numfiles;
 	qboolean vpack;
 	packfile_t *files;
+	char *names;			///< all file names in one block when loaded from the pk3 cache
+	long long filesize;		///< size and modification time for the pk3 cache,
+	long long filemtime;	///< 0 if the pack isn't cached
 };
 //@}
 
@@ -277,6 +296,14 @@ void FS_Ls_f(void);
 void FS_Which_f(void);
 
 static searchpath_t *FS_FindFile (const char *name, int* index, qboolean quiet);
+static void FS_FreeFileIndex (void);
+static void FS_BuildFileIndex (void);
+static void FS_BuildSearchIndex (void);
+static void FS_Async_Wait (void);
+static void FS_WriteQueue_WaitFor (const char *path);
+static void FS_WriteQueue_Add (const char *path, unsigned char *data, fs_offset_t size, qboolean text);
+static void FS_WriteQueue_Shutdown (void);
+static void FS_Content_Free (void);
 
 /*
 =============================================================================
@@ -301,6 +328,69 @@ char fs_basedir[MAX_OSPATH];
 char fs_baseexe[MAX_OSPATH];
 static pack_t *fs_selfpack = NULL;
 
+// hashed index of every file in every pack of the search path, see FS_BuildFileIndex
+typedef struct fs_fileindexentry_s
+{
+	const char *name;
+	searchpath_t *search;
+	int index; ///< index into search->pack->files
+	int order; ///< position of search in fs_searchpaths, lower wins
+	int next; ///< next entry in the same hash chain, -1 ends it
+}
+fs_fileindexentry_t;
+
+static qboolean fs_fileindex_valid = false;
+static int fs_fileindex_hashsize = 0;
+static int *fs_fileindex_hash = NULL;
+static int fs_fileindex_numentries = 0;
+static fs_fileindexentry_t *fs_fileindex_entries = NULL;
+// plain directories (and virtual packs) still have to be checked on disk
+static int fs_fileindex_numdirs = 0;
+static searchpath_t **fs_fileindex_dirs = NULL;
+static int *fs_fileindex_dirorder = NULL;
+
+// every packed file and directory grouped by directory for FS_Search, see FS_BuildSearchIndex
+typedef struct fs_searchname_s
+{
+	const char *name; ///< points into a pack's file name, not terminated for directories
+	int length;
+	int dirlength; ///< length of the directory part, including the separator
+}
+fs_searchname_t;
+
+typedef struct fs_searchdir_s
+{
+	int firstname;
+	int numnames;
+	int next; ///< next directory in the same hash chain, -1 ends it
+}
+fs_searchdir_t;
+
+static int fs_searchindex_numnames = 0;
+static fs_searchname_t *fs_searchindex_names = NULL;
+static int fs_searchindex_numdirs = 0;
+static fs_searchdir_t *fs_searchindex_dirs = NULL;
+static int fs_searchindex_hashsize = 0;
+static int *fs_searchindex_hash = NULL;
+
+// FS_Search results of the current frame, see FS_Search
+#define FS_SEARCHCACHE_SIZE 8
+typedef struct fs_searchcache_s
+{
+	char pattern[MAX_OSPATH];
+	int caseinsensitive;
+	int framecount;
+	int generation;
+	fssearch_t *search;
+	size_t size;
+}
+fs_searchcache_t;
+
+static fs_searchcache_t fs_searchcache[FS_SEARCHCACHE_SIZE];
+static int fs_searchcache_next = 0;
+// changes whenever the result of a search may change
+static int fs_search_generation = 1;
+
 // list of active game directories (empty if not running a mod)
 int fs_numgamedirs = 0;
 char fs_gamedirs[MAX_GAMEDIRS][MAX_QPATH];
@@ -313,6 +403,12 @@ cvar_t scr_screenshot_name = {CVAR_NORESETTODEFAULTS, "scr_screenshot_name","dp"
 cvar_t fs_empty_files_in_pack_mark_deletions = {0, "fs_empty_files_in_pack_mark_deletions", "0", "if enabled, empty files in a pak/pk3 count as not existing but cancel the search in further packs, effectively allowing patch pak/pk3 files to 'delete' files"};
 cvar_t cvar_fs_gamedir = {CVAR_READONLY | CVAR_NORESETTODEFAULTS, "fs_gamedir", "", "the list of currently selected gamedirs (use the 'gamedir' command to change this)"};
 cvar_t kex_compat = {0, "kex_compat", "0", "kex-compatible mode"};
+cvar_t fs_mmap = {0, "fs_mmap", "1", "let FS_MapFile map stored pack entries and plain files into memory instead of copying them"};
+cvar_t fs_pk3cache_enable = {0, "fs_pk3cache", "1", "save the file tables of pk3 archives to pk3cache.dat in the user directory so unchanged archives load without parsing them"};
+cvar_t fs_async_threads = {CVAR_SAVE, "fs_async_threads", "2", "number of threads loading files for FS_LoadFileAsync and FS_PrefetchFile (0 loads them on the main thread)"};
+cvar_t fs_async_write = {0, "fs_async_write", "1", "write configs, savegames and FS_WriteFile results on a background thread (0 writes them when they are closed)"};
+cvar_t fs_deflate_threads = {CVAR_SAVE, "fs_deflate_threads", "4", "number of threads FS_Deflate splits big buffers across (1 deflates them in one piece)"};
+cvar_t fs_mmap_minsize = {0, "fs_mmap_minsize", "65536", "files smaller than this many bytes are copied by FS_MapFile, as mapping them costs more than reading them"};
 
 
 /*
@@ -529,6 +625,7 @@ static int PK3_BuildFileList (pack_t *pack, const pk3_endOfCentralDir_t *eocd)
 				char filename [MAX_QPATH];
 				fs_offset_t offset, packsize, realsize;
 				int flags;
+				packfile_t *pfile;
 
 				// Extract the name (strip it if necessary)
 				namesize = min(namesize, (int)sizeof (filename) - 1);
@@ -554,7 +651,8 @@ static int PK3_BuildFileList (pack_t *pack, const pk3_endOfCentralDir_t *eocd)
 						break;
 				}
 
-				FS_AddFileToPack (filename, pack, offset, packsize, realsize, flags);
+				pfile = FS_AddFileToPack (filename, pack, offset, packsize, realsize, flags);
+				pfile->crc32 = (unsigned int)BuffLittleLong (&ptr[16]);
 			}
 		}
 
@@ -634,15 +732,6 @@ static pack_t *FS_LoadPackPK3FromFD (const char *packfile, filedesc_t packhandle
 	return pack;
 }
 
-static filedesc_t FS_SysOpenFiledesc(const char *filepath, const char *mode, qboolean nonblocking);
-static pack_t *FS_LoadPackPK3 (const char *packfile)
-{
-	filedesc_t packhandle;
-	packhandle = FS_SysOpenFiledesc (packfile, "rb", false);
-	if (!FILEDESC_ISVALID(packhandle))
-		return NULL;
-	return FS_LoadPackPK3FromFD(packfile, packhandle, false);
-}
 
 /*
 ====================
@@ -681,6 +770,432 @@ static qboolean PK3_GetTrueFileOffset (packfile_t *pfile, pack_t *pack)
 }
 
 
+/*
+=============================================================================
+
+PK3 DIRECTORY CACHE
+
+The parsed file tables of all loaded pk3 files (with their true offsets
+resolved) are saved to pk3cache.dat in the user directory, keyed by the
+pack's path, size and modification time.  The next startup loads the whole
+cache with one read and sets up unchanged packs from it without touching
+their central directory.
+=============================================================================
+*/
+
+#define FS_PK3CACHE_MAGIC "DPPK3C02"
+#define FS_PK3CACHE_ALIGN(n) (((n) + 7) & ~7)
+
+typedef struct fs_pk3cacheheader_s
+{
+	char magic[8];
+	int bigendian;
+	int numpacks;
+}
+fs_pk3cacheheader_t;
+
+// followed by the path (pathsize bytes, padded to 8), numfiles
+// fs_pk3cachefile_t and namessize bytes of names (padded to 8)
+typedef struct fs_pk3cachepack_s
+{
+	long long filesize;
+	long long filemtime;
+	int numfiles;
+	int pathsize;
+	int namessize;
+	int padding;
+}
+fs_pk3cachepack_t;
+
+typedef struct fs_pk3cachefile_s
+{
+	long long offset;
+	long long packsize;
+	long long realsize;
+	unsigned long long contenthash;
+	int flags;
+	int nameofs;
+	unsigned int crc32;
+	int padding;
+}
+fs_pk3cachefile_t;
+
+static struct fs_pk3cache_s
+{
+	qboolean loaded;
+	qboolean dirty;
+	unsigned char *data;
+	int numpacks;
+	fs_pk3cachepack_t **packs;
+	int hashsize;
+	int *hash;
+	int *hashnext;
+}
+fs_pk3cache;
+
+static unsigned int FS_FileIndexHash (const char *name);
+
+static void FS_PK3Cache_GetFileName (char *path, size_t pathsize)
+{
+	dpsnprintf(path, pathsize, "%spk3cache.dat", *fs_userdir ? fs_userdir : fs_basedir);
+}
+
+static const char *FS_PK3Cache_PackPath (const fs_pk3cachepack_t *cpack)
+{
+	return (const char *)(cpack + 1);
+}
+
+static const fs_pk3cachefile_t *FS_PK3Cache_PackFiles (const fs_pk3cachepack_t *cpack)
+{
+	return (const fs_pk3cachefile_t *)((const unsigned char *)(cpack + 1) + FS_PK3CACHE_ALIGN(cpack->pathsize));
+}
+
+static size_t FS_PK3Cache_PackSize (const fs_pk3cachepack_t *cpack)
+{
+	return sizeof(*cpack) + FS_PK3CACHE_ALIGN(cpack->pathsize) + cpack->numfiles * sizeof(fs_pk3cachefile_t) + FS_PK3CACHE_ALIGN(cpack->namessize);
+}
+
+static qboolean FS_SysFileStat (filedesc_t handle, long long *filesize, long long *filemtime)
+{
+#if USE_RWOPS
+	return false;
+#else
+#ifdef WIN32
+	struct _stat64 st;
+	if (_fstat64(handle, &st) == -1)
+		return false;
+#else
+	struct stat st;
+	if (fstat(handle, &st) == -1)
+		return false;
+#endif
+	*filesize = st.st_size;
+	*filemtime = st.st_mtime;
+	return true;
+#endif
+}
+
+/*
+====================
+FS_SysReplaceFile
+
+Renames temppath over path in one step, so path always holds either its old
+or its new contents
+====================
+*/
+static qboolean FS_SysReplaceFile (const char *temppath, const char *path)
+{
+#ifdef WIN32
+	int temppathlen = strlen(temppath) + 1, pathlen = strlen(path) + 1;
+	wchar_t temppath16[temppathlen], path16[pathlen];
+	fs_mbstowcs(temppath16, temppath, temppathlen);
+	fs_mbstowcs(path16, path, pathlen);
+	return MoveFileExW(temppath16, path16, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(temppath, path) == 0;
+#endif
+}
+
+static void FS_PK3Cache_Free (void)
+{
+	if (fs_pk3cache.data)
+		Mem_Free(fs_pk3cache.data);
+	if (fs_pk3cache.packs)
+		Mem_Free(fs_pk3cache.packs);
+	if (fs_pk3cache.hash)
+		Mem_Free(fs_pk3cache.hash);
+	if (fs_pk3cache.hashnext)
+		Mem_Free(fs_pk3cache.hashnext);
+	memset(&fs_pk3cache, 0, sizeof(fs_pk3cache));
+}
+
+/*
+====================
+FS_PK3Cache_Load
+
+Reads the cache file and checks all of its records, a damaged or outdated
+cache is ignored (and replaced on the next save)
+====================
+*/
+static void FS_PK3Cache_Load (void)
+{
+	char path[MAX_OSPATH];
+	fs_offset_t filesize, pos;
+	fs_pk3cacheheader_t *header;
+	int i, j;
+	qboolean dirty;
+
+	if (fs_pk3cache.loaded)
+		return;
+	fs_pk3cache.loaded = true;
+
+	FS_PK3Cache_GetFileName(path, sizeof(path));
+	fs_pk3cache.data = FS_SysLoadFile(path, fs_mempool, true, &filesize);
+	if (!fs_pk3cache.data)
+		return;
+	header = (fs_pk3cacheheader_t *)fs_pk3cache.data;
+	if (filesize < (fs_offset_t)sizeof(*header) || memcmp(header->magic, FS_PK3CACHE_MAGIC, sizeof(header->magic)) || header->bigendian != (int)mem_bigendian || header->numpacks < 0)
+	{
+		Con_DPrintf("FS_PK3Cache_Load: ignoring outdated %s\n", path);
+		goto discard;
+	}
+
+	fs_pk3cache.packs = (fs_pk3cachepack_t **)Mem_Alloc(fs_mempool, max(header->numpacks, 1) * sizeof(fs_pk3cachepack_t *));
+	for (pos = sizeof(*header), i = 0;i < header->numpacks;i++)
+	{
+		fs_pk3cachepack_t *cpack = (fs_pk3cachepack_t *)(fs_pk3cache.data + pos);
+		const fs_pk3cachefile_t *cfiles;
+		if (pos + (fs_offset_t)sizeof(*cpack) > filesize
+		 || cpack->numfiles < 0 || cpack->numfiles > MAX_FILES_IN_PACK
+		 || cpack->pathsize < 1 || cpack->pathsize > MAX_OSPATH
+		 || cpack->namessize < 0
+		 || pos + (fs_offset_t)FS_PK3Cache_PackSize(cpack) > filesize
+		 || FS_PK3Cache_PackPath(cpack)[cpack->pathsize - 1]
+		 || (cpack->namessize && ((const char *)(FS_PK3Cache_PackFiles(cpack) + cpack->numfiles))[cpack->namessize - 1]))
+			break;
+		cfiles = FS_PK3Cache_PackFiles(cpack);
+		for (j = 0;j < cpack->numfiles;j++)
+			if (cfiles[j].nameofs < 0 || cfiles[j].nameofs >= cpack->namessize)
+				break;
+		if (j < cpack->numfiles)
+			break;
+		fs_pk3cache.packs[i] = cpack;
+		pos += FS_PK3Cache_PackSize(cpack);
+	}
+	if (i < header->numpacks)
+	{
+		Con_Printf("FS_PK3Cache_Load: %s is damaged, ignoring it\n", path);
+		goto discard;
+	}
+	fs_pk3cache.numpacks = header->numpacks;
+
+	for (fs_pk3cache.hashsize = 64;fs_pk3cache.hashsize < fs_pk3cache.numpacks * 2;fs_pk3cache.hashsize *= 2)
+		;
+	fs_pk3cache.hash = (int *)Mem_Alloc(fs_mempool, fs_pk3cache.hashsize * sizeof(int));
+	fs_pk3cache.hashnext = (int *)Mem_Alloc(fs_mempool, max(fs_pk3cache.numpacks, 1) * sizeof(int));
+	for (i = 0;i < fs_pk3cache.hashsize;i++)
+		fs_pk3cache.hash[i] = -1;
+	for (i = 0;i < fs_pk3cache.numpacks;i++)
+	{
+		int *bucket = &fs_pk3cache.hash[FS_FileIndexHash(FS_PK3Cache_PackPath(fs_pk3cache.packs[i])) & (fs_pk3cache.hashsize - 1)];
+		fs_pk3cache.hashnext[i] = *bucket;
+		*bucket = i;
+	}
+	Con_DPrintf("FS_PK3Cache_Load: %i packs in %s\n", fs_pk3cache.numpacks, path);
+	return;
+
+discard:
+	// content hashes computed before the load still need saving
+	dirty = fs_pk3cache.dirty;
+	FS_PK3Cache_Free();
+	fs_pk3cache.loaded = true;
+	fs_pk3cache.dirty = dirty;
+}
+
+static fs_pk3cachepack_t *FS_PK3Cache_Find (const char *packfile)
+{
+	int i;
+	FS_PK3Cache_Load();
+	if (!fs_pk3cache.hash)
+		return NULL;
+	for (i = fs_pk3cache.hash[FS_FileIndexHash(packfile) & (fs_pk3cache.hashsize - 1)];i >= 0;i = fs_pk3cache.hashnext[i])
+		if (!strcmp(FS_PK3Cache_PackPath(fs_pk3cache.packs[i]), packfile))
+			return fs_pk3cache.packs[i];
+	return NULL;
+}
+
+/*
+====================
+FS_PK3Cache_Save
+
+Writes all cacheable packs of the search path, plus the records of packs
+that are not loaded right now but still exist
+====================
+*/
+static void FS_PK3Cache_Save (void)
+{
+	char path[MAX_OSPATH], temppath[MAX_OSPATH];
+	static const unsigned char zeros[8] = {0};
+	fs_pk3cacheheader_t header;
+	searchpath_t *search;
+	qfile_t *file;
+	int i, j;
+
+	FS_PK3Cache_GetFileName(path, sizeof(path));
+	dpsnprintf(temppath, sizeof(temppath), "%s.tmp", path);
+	FS_CreatePath(temppath);
+	file = FS_SysOpen(temppath, "wb", false);
+	if (!file)
+	{
+		Con_DPrintf("FS_PK3Cache_Save: can't write %s\n", temppath);
+		return;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FS_PK3CACHE_MAGIC, sizeof(header.magic));
+	header.bigendian = mem_bigendian;
+	FS_Write(file, &header, sizeof(header));
+
+	for (search = fs_searchpaths;search;search = search->next)
+	{
+		pack_t *pak = search->pack;
+		fs_pk3cachepack_t cpack;
+		fs_pk3cachefile_t cfile;
+		memset(&cfile, 0, sizeof(cfile));
+		if (!pak || pak->vpack || !pak->filemtime)
+			continue;
+		memset(&cpack, 0, sizeof(cpack));
+		cpack.filesize = pak->filesize;
+		cpack.filemtime = pak->filemtime;
+		cpack.numfiles = pak->numfiles;
+		cpack.pathsize = (int)strlen(pak->filename) + 1;
+		for (j = 0;j < pak->numfiles;j++)
+		{
+			// resolve the offsets once now, so later runs never have to
+			if (!PK3_GetTrueFileOffset(&pak->files[j], pak))
+				break;
+			cpack.namessize += (int)strlen(pak->files[j].name) + 1;
+		}
+		if (j < pak->numfiles)
+			continue;
+		FS_Write(file, &cpack, sizeof(cpack));
+		FS_Write(file, pak->filename, cpack.pathsize);
+		FS_Write(file, zeros, FS_PK3CACHE_ALIGN(cpack.pathsize) - cpack.pathsize);
+		for (cfile.nameofs = 0, j = 0;j < pak->numfiles;j++)
+		{
+			cfile.offset = pak->files[j].offset;
+			cfile.packsize = pak->files[j].packsize;
+			cfile.realsize = pak->files[j].realsize;
+			cfile.flags = pak->files[j].flags;
+			cfile.crc32 = pak->files[j].crc32;
+			cfile.contenthash = pak->files[j].contenthash;
+			FS_Write(file, &cfile, sizeof(cfile));
+			cfile.nameofs += (int)strlen(pak->files[j].name) + 1;
+		}
+		for (j = 0;j < pak->numfiles;j++)
+			FS_Write(file, pak->files[j].name, strlen(pak->files[j].name) + 1);
+		FS_Write(file, zeros, FS_PK3CACHE_ALIGN(cpack.namessize) - cpack.namessize);
+		header.numpacks++;
+	}
+
+	// keep the records of other gamedirs
+	for (i = 0;i < fs_pk3cache.numpacks;i++)
+	{
+		fs_pk3cachepack_t *cpack = fs_pk3cache.packs[i];
+		const char *packpath = FS_PK3Cache_PackPath(cpack);
+		for (search = fs_searchpaths;search;search = search->next)
+			if (search->pack && search->pack->filemtime && !strcmp(search->pack->filename, packpath))
+				break;
+		if (search || !FS_SysFileExists(packpath))
+			continue;
+		FS_Write(file, cpack, FS_PK3Cache_PackSize(cpack));
+		header.numpacks++;
+	}
+
+	FS_Seek(file, 0, SEEK_SET);
+	FS_Write(file, &header, sizeof(header));
+	FS_Close(file);
+	if (!FS_SysReplaceFile(temppath, path))
+		Con_DPrintf("FS_PK3Cache_Save: can't rename %s to %s\n", temppath, path);
+	else
+		Con_DPrintf("FS_PK3Cache_Save: %i packs in %s\n", header.numpacks, path);
+}
+
+/*
+====================
+FS_PK3Cache_Release
+
+Saves the cache if new or changed packs were loaded since it was read, and
+frees it
+====================
+*/
+static void FS_PK3Cache_Release (void)
+{
+	if (fs_pk3cache.dirty)
+		FS_PK3Cache_Save();
+	FS_PK3Cache_Free();
+}
+
+/*
+====================
+FS_PK3Cache_Flush
+
+Writes the content hashes computed since the cache was last saved, see
+FS_FileContentEqual
+====================
+*/
+static void FS_PK3Cache_Flush (void)
+{
+	if (!fs_pk3cache.dirty)
+		return;
+	FS_PK3Cache_Load();
+	FS_PK3Cache_Release();
+}
+
+/*
+====================
+FS_LoadPackPK3
+
+Create a package entry associated with a PK3 file, from the pk3 cache if
+the file didn't change
+====================
+*/
+static filedesc_t FS_SysOpenFiledesc(const char *filepath, const char *mode, qboolean nonblocking);
+static pack_t *FS_LoadPackPK3 (const char *packfile)
+{
+	filedesc_t packhandle;
+	long long filesize, filemtime;
+	fs_pk3cachepack_t *cpack;
+	pack_t *pack;
+	int i;
+
+	packhandle = FS_SysOpenFiledesc (packfile, "rb", false);
+	if (!FILEDESC_ISVALID(packhandle))
+		return NULL;
+
+	if (!fs_pk3cache_enable.integer || !FS_SysFileStat(packhandle, &filesize, &filemtime))
+		return FS_LoadPackPK3FromFD(packfile, packhandle, false);
+
+	cpack = FS_PK3Cache_Find(packfile);
+	if (!cpack || cpack->filesize != filesize || cpack->filemtime != filemtime)
+	{
+		pack = FS_LoadPackPK3FromFD(packfile, packhandle, false);
+		if (pack)
+		{
+			pack->filesize = filesize;
+			pack->filemtime = filemtime;
+			fs_pk3cache.dirty = true;
+		}
+		return pack;
+	}
+
+	pack = (pack_t *)Mem_Alloc(fs_mempool, sizeof (pack_t));
+	pack->ignorecase = true; // PK3 ignores case
+	strlcpy (pack->filename, packfile, sizeof (pack->filename));
+	pack->handle = packhandle;
+	pack->numfiles = cpack->numfiles;
+	pack->files = (packfile_t *)Mem_Alloc(fs_mempool, max(cpack->numfiles, 1) * sizeof(packfile_t));
+	pack->names = (char *)Mem_Alloc(fs_mempool, max(cpack->namessize, 1));
+	pack->filesize = filesize;
+	pack->filemtime = filemtime;
+	memcpy(pack->names, FS_PK3Cache_PackFiles(cpack) + cpack->numfiles, cpack->namessize);
+	for (i = 0;i < cpack->numfiles;i++)
+	{
+		const fs_pk3cachefile_t *cfile = FS_PK3Cache_PackFiles(cpack) + i;
+		pack->files[i].name = pack->names + cfile->nameofs;
+		pack->files[i].offset = cfile->offset;
+		pack->files[i].packsize = cfile->packsize;
+		pack->files[i].realsize = cfile->realsize;
+		pack->files[i].flags = cfile->flags;
+		pack->files[i].crc32 = cfile->crc32;
+		pack->files[i].contenthash = cfile->contenthash;
+	}
+
+	Con_DPrintf("Added packfile %s (%i files, cached)\n", packfile, pack->numfiles);
+	return pack;
+}
+
+
 /*
 =============================================================================
 
@@ -740,6 +1255,8 @@ packfile_t* FS_AddFileToPack (const char* name, pack_t* pack,
 	pfile->packsize = packsize;
 	pfile->realsize = realsize;
 	pfile->flags = flags;
+	pfile->crc32 = 0;
+	pfile->contenthash = 0;
 
 	return pfile;
 }
@@ -971,6 +1488,8 @@ static qboolean FS_AddPack_Fullpath(const char *pakfile, const char *shortname,
 	if(already_loaded)
 		*already_loaded = false;
 
+	FS_Async_Wait();
+
 	if(!strcasecmp(ext, "pk3dir"))
 		pak = FS_LoadPackVirtual (pakfile);
 	else if(!strcasecmp(ext, "pak"))
@@ -1047,6 +1566,7 @@ static qboolean FS_AddPack_Fullpath(const char *pakfile, const char *shortname,
 			}
 		}
 		search->pack = pak;
+		fs_fileindex_valid = false;
 		if(pak->vpack)
 		{
 			dpsnprintf(search->filename, sizeof(search->filename), "%s/", pakfile);
@@ -1104,7 +1624,17 @@ qboolean FS_AddPack(const char *pakfile, qboolean *already_loaded, qboolean keep
 
 	dpsnprintf(fullpath, sizeof(fullpath), "%s%s", search->filename, pakfile);
 
-	return FS_AddPack_Fullpath(fullpath, pakfile, already_loaded, keep_plain_dirs);
+	if (!FS_AddPack_Fullpath(fullpath, pakfile, already_loaded, keep_plain_dirs))
+	{
+		FS_PK3Cache_Release();
+		return false;
+	}
+	FS_PK3Cache_Release();
+	// rebuild the index now, rather than in the middle of a lookup that
+	// may be running on an I/O thread
+	if (!fs_fileindex_valid)
+		FS_BuildFileIndex();
+	return true;
 }
 
 
@@ -1154,6 +1684,7 @@ static void FS_AddGameDirectory (const char *dir)
 	strlcpy (search->filename, dir, sizeof (search->filename));
 	search->next = fs_searchpaths;
 	fs_searchpaths = search;
+	fs_fileindex_valid = false;
 }
 
 static void FS_AddBaseDirectory (const char *dir)
@@ -1186,6 +1717,7 @@ static void FS_AddBaseDirectory (const char *dir)
 	strlcpy (search->filename, dir, sizeof (search->filename));
 	search->next = fs_searchpaths;
 	fs_searchpaths = search;
+	fs_fileindex_valid = false;
 }
 
 
@@ -1276,7 +1808,11 @@ static void FS_ClearSearchPath (void)
 	// (if a qfile is still reading a pack it won't be harmed because it used
 	//  dup() to get its own handle already)
 	int i;
+	// the I/O threads must not be looking files up while the list changes
+	FS_Async_Wait();
+	FS_PK3Cache_Flush();
 	fs_basesearchpath = NULL;
+	FS_FreeFileIndex();
 	while (fs_searchpaths)
 	{
 		searchpath_t *search = fs_searchpaths;
@@ -1288,13 +1824,16 @@ static void FS_ClearSearchPath (void)
 				// close the file
 				FILEDESC_CLOSE(search->pack->handle);
 				// free any memory associated with it
-				if (search->pack->files)
+				if (search->pack->names)
+					Mem_Free(search->pack->names);
+				else if (search->pack->files)
 				{
 					for (i = 0; i < search->pack->numfiles; i++)
 						if (search->pack->files[i].name)
 							Mem_Free(search->pack->files[i].name);
-					Mem_Free(search->pack->files);
 				}
+				if (search->pack->files)
+					Mem_Free(search->pack->files);
 			}
 			Mem_Free(search->pack);
 		}
@@ -1311,6 +1850,7 @@ static void FS_AddSelfPack(void)
 		search->next = fs_searchpaths;
 		search->pack = fs_selfpack;
 		fs_searchpaths = search;
+		fs_fileindex_valid = false;
 	}
 }
 
@@ -1328,6 +1868,9 @@ void FS_Rescan (void)
 	char gamedirbuf[MAX_INPUTLINE];
 	char vabuf[1024];
 
+	// the new files have to be on disk before the directories are listed
+	FS_WriteQueue_Flush();
+
 	if (fs_searchpaths)
 		reset = true;
 	FS_ClearSearchPath();
@@ -1374,6 +1917,10 @@ void FS_Rescan (void)
 	// add back the selfpack as new first item
 	FS_AddSelfPack();
 
+	// index all packed files so lookups don't have to visit every pack
+	FS_BuildFileIndex();
+	FS_PK3Cache_Release();
+
 	// set the default screenshot name to either the mod name or the
 	// gamemode screenshot name
 	if (strcmp(com_modname, gamedirname1))
@@ -2125,6 +2672,12 @@ void FS_Init_Commands(void)
 	Cvar_RegisterVariable (&fs_empty_files_in_pack_mark_deletions);
 	Cvar_RegisterVariable (&cvar_fs_gamedir);
 	Cvar_RegisterVariable (&kex_compat);
+	Cvar_RegisterVariable (&fs_mmap);
+	Cvar_RegisterVariable (&fs_mmap_minsize);
+	Cvar_RegisterVariable (&fs_async_threads);
+	Cvar_RegisterVariable (&fs_async_write);
+	Cvar_RegisterVariable (&fs_deflate_threads);
+	Cvar_RegisterVariable (&fs_pk3cache_enable);
 
 	Cmd_AddCommand ("gamedir", FS_GameDir_f, "changes active gamedir list (can take multiple arguments), not including base directory (example usage: gamedir ctf)");
 	Cmd_AddCommand ("fs_rescan", FS_Rescan_f, "rescans filesystem for new pack archives and any other changes");
@@ -2173,6 +2726,9 @@ static filedesc_t FS_SysOpenFiledesc(const char *filepath, const char *mode, qbo
 	fs_mbstowcs(filepath16, filepath, pathlen);
 #endif
 
+	// a queued write to this file has to land first
+	FS_WriteQueue_WaitFor(filepath);
+
 	// Parse the mode string
 	switch (mode[0])
 	{
@@ -2282,6 +2838,10 @@ qfile_t* FS_SysOpen (const char* filepath, const char* mode, qboolean nonblockin
 
 	file->filename = Mem_strdup(fs_mempool, filepath);
 
+	// the file may be new, don't answer searches from the cache
+	if (mode[0] != 'r' || strchr(mode, '+'))
+		fs_search_generation++;
+
 	file->real_length = FILEDESC_SEEK (file->handle, 0, SEEK_END);
 
 	// For files opened in append mode, we start at the end of the file
@@ -2342,13 +2902,18 @@ static qfile_t *FS_OpenPackedFile (pack_t* pack, int pack_ind)
 	if (pfile->flags & PACKFILE_FLAG_DEFLATED)
 	{
 		ztoolkit_t *ztk;
+		fs_offset_t in_size;
 
 		file->flags |= QFILE_FLAG_DEFLATED;
 
 		// We need some more variables
-		ztk = (ztoolkit_t *)Mem_Alloc (fs_mempool, sizeof (*ztk));
+		in_size = bound(ZIP_READAHEAD_MIN, pfile->packsize / 8, ZIP_READAHEAD_MAX);
+		in_size = bound(1, pfile->packsize, in_size);
+		ztk = (ztoolkit_t *)Mem_Alloc (fs_mempool, sizeof (*ztk) + in_size);
 
 		ztk->comp_length = pfile->packsize;
+		ztk->in_size = (size_t)in_size;
+		ztk->input = (unsigned char *)(ztk + 1);
 
 		// Initialize zlib stream
 		ztk->zstream.next_in = ztk->input;
@@ -2440,99 +3005,443 @@ int FS_CheckNastyPath (const char *path, qboolean isgamedir)
 
 /*
 ====================
-FS_FindFile
+FS_FileIndexHash
 
-Look for a file in the packages and in the filesystem
-
-Return the searchpath where the file was found (or NULL)
-and the file index in the package if relevant
+Case insensitive hash, so names from case insensitive packs (PK3) and case
+sensitive packs (PAK) land in the same chain
 ====================
 */
-static searchpath_t *FS_FindFile (const char *name, int* index, qboolean quiet)
+static unsigned int FS_FileIndexHash (const char *name)
 {
-	searchpath_t *search;
-	pack_t *pak;
-
-	if (!strncmp(name, "dlcache/", 8)) {
-		char netpath[MAX_OSPATH];
-		dpsnprintf(netpath, sizeof(netpath), "%s%s", fs_basesearchpath->filename, name);
-		if (FS_SysFileExists (netpath))
-		{
-			if (!quiet && developer_extra.integer)
-				Con_DPrintf("FS_FindFile: %s\n", netpath);
+	unsigned int h = 2166136261u;
+	for (;*name;name++)
+		h = (h ^ (unsigned char)tolower((unsigned char)*name)) * 16777619u;
+	return h;
+}
 
-			if (index != NULL)
-				*index = -1;
+static qboolean FS_FileIndexMatch (const fs_fileindexentry_t *entry, const char *name)
+{
+	return !(entry->search->pack->ignorecase ? strcasecmp(entry->name, name) : strcmp(entry->name, name));
+}
 
-			return fs_basesearchpath;
-		}
-	}
-	// search through the path, one element at a time
-	for (search = fs_searchpaths;search;search = search->next)
-	{
-		// is the element a pak file?
-		if (search->pack && !search->pack->vpack)
-		{
-			int (*strcmp_funct) (const char* str1, const char* str2);
-			int left, right, middle;
+/*
+====================
+FS_FreeFileIndex
+====================
+*/
+static void FS_FreeFileIndex (void)
+{
+	if (fs_fileindex_hash)
+		Mem_Free(fs_fileindex_hash);
+	if (fs_fileindex_entries)
+		Mem_Free(fs_fileindex_entries);
+	if (fs_fileindex_dirs)
+		Mem_Free(fs_fileindex_dirs);
+	if (fs_fileindex_dirorder)
+		Mem_Free(fs_fileindex_dirorder);
+	if (fs_searchindex_names)
+		Mem_Free(fs_searchindex_names);
+	if (fs_searchindex_dirs)
+		Mem_Free(fs_searchindex_dirs);
+	if (fs_searchindex_hash)
+		Mem_Free(fs_searchindex_hash);
+	fs_fileindex_hash = NULL;
+	fs_fileindex_entries = NULL;
+	fs_fileindex_dirs = NULL;
+	fs_fileindex_dirorder = NULL;
+	fs_searchindex_names = NULL;
+	fs_searchindex_dirs = NULL;
+	fs_searchindex_hash = NULL;
+	fs_fileindex_hashsize = 0;
+	fs_fileindex_numentries = 0;
+	fs_fileindex_numdirs = 0;
+	fs_searchindex_numnames = 0;
+	fs_searchindex_numdirs = 0;
+	fs_searchindex_hashsize = 0;
+	fs_fileindex_valid = false;
+	fs_search_generation++;
+	FS_Content_Free();
+}
 
-			pak = search->pack;
-			strcmp_funct = pak->ignorecase ? strcasecmp : strcmp;
+static int FS_SearchIndexSeparator (char c)
+{
+	return c == '/' || c == '\\' || c == ':';
+}
 
-			// Look for the file (binary search)
-			left = 0;
-			right = pak->numfiles - 1;
-			while (left <= right)
+static int FS_SearchIndexDirHash (const char *dir, int length)
+{
+	unsigned int h = 2166136261u;
+	int i;
+	for (i = 0;i < length;i++)
+		h = (h ^ (unsigned char)tolower((unsigned char)dir[i])) * 16777619u;
+	return (int)(h & (fs_searchindex_hashsize - 1));
+}
+
+static int FS_SearchIndexCompare (const void *a, const void *b)
+{
+	const fs_searchname_t *na = (const fs_searchname_t *)a;
+	const fs_searchname_t *nb = (const fs_searchname_t *)b;
+	int diff;
+	// directories are grouped case insensitively, like matchpattern compares
+	if (na->dirlength != nb->dirlength)
+		return na->dirlength - nb->dirlength;
+	diff = strncasecmp(na->name, nb->name, na->dirlength);
+	if (diff)
+		return diff;
+	diff = strncmp(na->name, nb->name, min(na->length, nb->length));
+	if (diff)
+		return diff;
+	return na->length - nb->length;
+}
+
+/*
+====================
+FS_BuildSearchIndex
+
+Lists every file in the packs of the search path, and every directory
+leading to one, grouped by directory.  A search pattern can only match names
+in directories matching its own directory part, as wildcards don't match
+separators, so FS_Search only has to look at those.
+====================
+*/
+static void FS_BuildSearchIndex (void)
+{
+	searchpath_t *search;
+	fs_searchname_t *names;
+	int i, j, k, maxnames, numnames;
+
+	maxnames = 0;
+	for (search = fs_searchpaths;search;search = search->next)
+		if (search->pack && !search->pack->vpack)
+			for (i = 0;i < search->pack->numfiles;i++)
+				for (k = 0;search->pack->files[i].name[k];k++)
+					maxnames += FS_SearchIndexSeparator(search->pack->files[i].name[k]);
+	for (search = fs_searchpaths;search;search = search->next)
+		if (search->pack && !search->pack->vpack)
+			maxnames += search->pack->numfiles;
+
+	names = (fs_searchname_t *)Mem_Alloc(fs_mempool, max(maxnames, 1) * sizeof(*names));
+	numnames = 0;
+	for (search = fs_searchpaths;search;search = search->next)
+	{
+		pack_t *pak = search->pack;
+		const char *previous = "";
+		if (!pak || pak->vpack)
+			continue;
+		for (i = 0;i < pak->numfiles;i++)
+		{
+			const char *name = pak->files[i].name;
+			int length = (int)strlen(name), dirlength = 0;
+			for (k = length - 1;k >= 0;k--)
+				if (FS_SearchIndexSeparator(name[k]))
+					break;
+			dirlength = k + 1;
+			names[numnames].name = name;
+			names[numnames].length = length;
+			names[numnames].dirlength = dirlength;
+			numnames++;
+			// add the directories leading to it, the files are sorted so
+			// only the ones differing from the previous file are new
+			for (k = dirlength - 1;k > 0;k--)
 			{
-				int diff;
+				if (!FS_SearchIndexSeparator(name[k]))
+					continue;
+				if (!strncmp(previous, name, k + 1))
+					break;
+				for (j = k - 1;j >= 0 && !FS_SearchIndexSeparator(name[j]);j--)
+					;
+				names[numnames].name = name;
+				names[numnames].length = k;
+				names[numnames].dirlength = j + 1;
+				numnames++;
+			}
+			previous = name;
+		}
+	}
 
-				middle = (left + right) / 2;
-				diff = strcmp_funct (pak->files[middle].name, name);
+	// group by directory and drop the duplicates
+	qsort(names, numnames, sizeof(*names), FS_SearchIndexCompare);
+	for (i = 0, j = 0;i < numnames;i++)
+		if (!j || names[i].length != names[j - 1].length || names[i].dirlength != names[j - 1].dirlength || strncmp(names[i].name, names[j - 1].name, names[i].length))
+			names[j++] = names[i];
+	fs_searchindex_names = names;
+	fs_searchindex_numnames = numnames = j;
 
-				// Found it
-				if (!diff)
-				{
-					if (fs_empty_files_in_pack_mark_deletions.integer && pak->files[middle].realsize == 0)
-					{
-						// yes, but the first one is empty so we treat it as not being there
-						if (!quiet && developer_extra.integer)
-							Con_DPrintf("FS_FindFile: %s is marked as deleted\n", name);
+	fs_searchindex_dirs = (fs_searchdir_t *)Mem_Alloc(fs_mempool, max(numnames, 1) * sizeof(fs_searchdir_t));
+	for (i = 0;i < numnames;i++)
+	{
+		if (i && names[i].dirlength == names[i - 1].dirlength && !strncasecmp(names[i].name, names[i - 1].name, names[i].dirlength))
+		{
+			fs_searchindex_dirs[fs_searchindex_numdirs - 1].numnames++;
+			continue;
+		}
+		fs_searchindex_dirs[fs_searchindex_numdirs].firstname = i;
+		fs_searchindex_dirs[fs_searchindex_numdirs].numnames = 1;
+		fs_searchindex_numdirs++;
+	}
 
-						if (index != NULL)
-							*index = -1;
-						return NULL;
-					}
+	for (fs_searchindex_hashsize = 64;fs_searchindex_hashsize < fs_searchindex_numdirs * 2;fs_searchindex_hashsize *= 2)
+		;
+	fs_searchindex_hash = (int *)Mem_Alloc(fs_mempool, fs_searchindex_hashsize * sizeof(int));
+	for (i = 0;i < fs_searchindex_hashsize;i++)
+		fs_searchindex_hash[i] = -1;
+	for (i = 0;i < fs_searchindex_numdirs;i++)
+	{
+		fs_searchname_t *first = &names[fs_searchindex_dirs[i].firstname];
+		int *bucket = &fs_searchindex_hash[FS_SearchIndexDirHash(first->name, first->dirlength)];
+		fs_searchindex_dirs[i].next = *bucket;
+		*bucket = i;
+	}
+}
 
-					if (!quiet && developer_extra.integer)
-						Con_DPrintf("FS_FindFile: %s in %s\n",
-									pak->files[middle].name, pak->filename);
+/*
+====================
+FS_SearchIndex
 
-					if (index != NULL)
-						*index = middle;
-					return search;
-				}
+Adds the packed files and directories matching pattern to resultlist
+====================
+*/
+static void FS_SearchIndex (stringlist_t *resultlist, const char *pattern, int basepathlength, qboolean quiet)
+{
+	int d, i;
+	char temp[MAX_OSPATH];
+	const char *wildcard;
 
-				// If we're too far in the list
-				if (diff > 0)
-					right = middle - 1;
-				else
-					left = middle + 1;
-			}
+	if (!fs_fileindex_valid)
+		FS_BuildFileIndex();
+
+	wildcard = strpbrk(pattern, "*?");
+	if (!wildcard || wildcard - pattern >= basepathlength)
+	{
+		// only one directory can match
+		for (d = fs_searchindex_hash[FS_SearchIndexDirHash(pattern, basepathlength)];d >= 0;d = fs_searchindex_dirs[d].next)
+		{
+			fs_searchname_t *first = &fs_searchindex_names[fs_searchindex_dirs[d].firstname];
+			if (first->dirlength == basepathlength && !strncasecmp(first->name, pattern, basepathlength))
+				break;
 		}
-		else
+		if (d < 0)
+			return;
+	}
+	else
+		d = 0;
+
+	for (;d < fs_searchindex_numdirs;d++)
+	{
+		fs_searchdir_t *dir = &fs_searchindex_dirs[d];
+		fs_searchname_t *first = &fs_searchindex_names[dir->firstname];
+		if (wildcard && wildcard - pattern < basepathlength)
+		{
+			// the directory itself has to match the directory part of the pattern
+			char dirpattern[MAX_OSPATH];
+			if (first->dirlength == 0 || first->dirlength >= (int)sizeof(temp) || basepathlength >= (int)sizeof(dirpattern))
+				continue;
+			memcpy(temp, first->name, first->dirlength);
+			temp[first->dirlength] = 0;
+			memcpy(dirpattern, pattern, basepathlength);
+			dirpattern[basepathlength] = 0;
+			if (!matchpattern(temp, dirpattern, true))
+				continue;
+		}
+		for (i = 0;i < dir->numnames;i++)
 		{
-			char netpath[MAX_OSPATH];
-			dpsnprintf(netpath, sizeof(netpath), "%s%s", search->filename, name);
-			if (FS_SysFileExists (netpath))
+			fs_searchname_t *n = &first[i];
+			if (n->length >= (int)sizeof(temp))
+				continue;
+			memcpy(temp, n->name, n->length);
+			temp[n->length] = 0;
+			if (matchpattern(temp, pattern, true))
 			{
-				if (!quiet && developer_extra.integer)
-					Con_DPrintf("FS_FindFile: %s\n", netpath);
+				stringlistappend(resultlist, temp);
+				if (!quiet && developer_loading.integer)
+					Con_Printf("SearchPackFile: %s\n", temp);
+			}
+		}
+		if (!wildcard || wildcard - pattern >= basepathlength)
+			break;
+	}
+}
+
+/*
+====================
+FS_BuildFileIndex
+
+Builds one hash table over the files of all packs in the search path, so
+finding a file costs the same no matter how many packs are loaded.
+
+Each name keeps the entry from the pack that comes first in the search path
+(including empty entries, which FS_FindFile treats as deletions).  Plain
+directories and virtual packs are collected in search path order, since
+they have to be checked on disk anyway.
+====================
+*/
+static void FS_BuildFileIndex (void)
+{
+	searchpath_t *search;
+	int i, numsearchpaths, numfiles, order;
+	searchpath_t **searchpaths;
+
+	FS_FreeFileIndex();
+
+	numsearchpaths = 0;
+	numfiles = 0;
+	for (search = fs_searchpaths;search;search = search->next)
+	{
+		numsearchpaths++;
+		if (search->pack && !search->pack->vpack)
+			numfiles += search->pack->numfiles;
+	}
+
+	for (fs_fileindex_hashsize = 256;fs_fileindex_hashsize < numfiles * 2;fs_fileindex_hashsize *= 2)
+		;
+	fs_fileindex_hash = (int *)Mem_Alloc(fs_mempool, fs_fileindex_hashsize * sizeof(int));
+	for (i = 0;i < fs_fileindex_hashsize;i++)
+		fs_fileindex_hash[i] = -1;
+	fs_fileindex_entries = (fs_fileindexentry_t *)Mem_Alloc(fs_mempool, max(numfiles, 1) * sizeof(fs_fileindexentry_t));
+	fs_fileindex_dirs = (searchpath_t **)Mem_Alloc(fs_mempool, max(numsearchpaths, 1) * sizeof(searchpath_t *));
+	fs_fileindex_dirorder = (int *)Mem_Alloc(fs_mempool, max(numsearchpaths, 1) * sizeof(int));
+
+	searchpaths = (searchpath_t **)Mem_Alloc(tempmempool, max(numsearchpaths, 1) * sizeof(searchpath_t *));
+	for (order = 0, search = fs_searchpaths;search;search = search->next, order++)
+	{
+		searchpaths[order] = search;
+		if (!search->pack || search->pack->vpack)
+		{
+			fs_fileindex_dirs[fs_fileindex_numdirs] = search;
+			fs_fileindex_dirorder[fs_fileindex_numdirs] = order;
+			fs_fileindex_numdirs++;
+		}
+	}
+
+	// insert from the lowest priority pack up, so an entry in an earlier
+	// pack replaces the one it overrides
+	for (order = numsearchpaths - 1;order >= 0;order--)
+	{
+		pack_t *pak;
+		search = searchpaths[order];
+		if (!search->pack || search->pack->vpack)
+			continue;
+		pak = search->pack;
+		for (i = 0;i < pak->numfiles;i++)
+		{
+			fs_fileindexentry_t *entry;
+			int *bucket = &fs_fileindex_hash[FS_FileIndexHash(pak->files[i].name) & (fs_fileindex_hashsize - 1)];
+			int e;
 
-				if (index != NULL)
-					*index = -1;
-				return search;
+			// a case insensitive name matches everything the overridden
+			// name did, a case sensitive one only does if that was too
+			for (e = *bucket;e >= 0;e = fs_fileindex_entries[e].next)
+			{
+				entry = &fs_fileindex_entries[e];
+				if (!strcmp(entry->name, pak->files[i].name) && (pak->ignorecase || !entry->search->pack->ignorecase))
+					break;
+			}
+			if (e < 0)
+			{
+				e = fs_fileindex_numentries++;
+				entry = &fs_fileindex_entries[e];
+				entry->next = *bucket;
+				*bucket = e;
 			}
+			else
+				entry = &fs_fileindex_entries[e];
+			entry->name = pak->files[i].name;
+			entry->search = search;
+			entry->index = i;
+			entry->order = order;
+		}
+	}
+	Mem_Free(searchpaths);
+
+	FS_BuildSearchIndex();
+
+	fs_fileindex_valid = true;
+	if (developer_extra.integer)
+		Con_DPrintf("FS_BuildFileIndex: %i unique packed files, %i directories in %i search paths\n", fs_fileindex_numentries, fs_fileindex_numdirs, numsearchpaths);
+}
+
+
+/*
+====================
+FS_FindFile
+
+Look for a file in the packages and in the filesystem
+
+Return the searchpath where the file was found (or NULL)
+and the file index in the package if relevant
+====================
+*/
+static searchpath_t *FS_FindFile (const char *name, int* index, qboolean quiet)
+{
+	searchpath_t *search;
+	fs_fileindexentry_t *entry;
+	int e, i, order;
+
+	if (!strncmp(name, "dlcache/", 8)) {
+		char netpath[MAX_OSPATH];
+		dpsnprintf(netpath, sizeof(netpath), "%s%s", fs_basesearchpath->filename, name);
+		if (FS_SysFileExists (netpath))
+		{
+			if (!quiet && developer_extra.integer)
+				Con_DPrintf("FS_FindFile: %s\n", netpath);
+
+			if (index != NULL)
+				*index = -1;
+
+			return fs_basesearchpath;
+		}
+	}
+
+	if (!fs_fileindex_valid)
+		FS_BuildFileIndex();
+
+	// find the highest priority pack containing the file
+	entry = NULL;
+	for (e = fs_fileindex_hash[FS_FileIndexHash(name) & (fs_fileindex_hashsize - 1)];e >= 0;e = fs_fileindex_entries[e].next)
+	{
+		if (FS_FileIndexMatch(&fs_fileindex_entries[e], name) && (!entry || entry->order > fs_fileindex_entries[e].order))
+			entry = &fs_fileindex_entries[e];
+	}
+	order = entry ? entry->order : INT_MAX;
+
+	// directories before that pack in the search path still take precedence
+	for (i = 0;i < fs_fileindex_numdirs && fs_fileindex_dirorder[i] < order;i++)
+	{
+		char netpath[MAX_OSPATH];
+		search = fs_fileindex_dirs[i];
+		dpsnprintf(netpath, sizeof(netpath), "%s%s", search->filename, name);
+		if (FS_SysFileExists (netpath))
+		{
+			if (!quiet && developer_extra.integer)
+				Con_DPrintf("FS_FindFile: %s\n", netpath);
+
+			if (index != NULL)
+				*index = -1;
+			return search;
+		}
+	}
+
+	if (entry)
+	{
+		search = entry->search;
+		if (fs_empty_files_in_pack_mark_deletions.integer && search->pack->files[entry->index].realsize == 0)
+		{
+			// yes, but the first one is empty so we treat it as not being there
+			if (!quiet && developer_extra.integer)
+				Con_DPrintf("FS_FindFile: %s is marked as deleted\n", name);
+
+			if (index != NULL)
+				*index = -1;
+			return NULL;
 		}
+
+		if (!quiet && developer_extra.integer)
+			Con_DPrintf("FS_FindFile: %s in %s\n",
+						search->pack->files[entry->index].name, search->pack->filename);
+
+		if (index != NULL)
+			*index = entry->index;
+		return search;
 	}
 
 	if (!quiet && developer_extra.integer)
@@ -2689,6 +3598,45 @@ qfile_t* FS_OpenRealFile (const char* filepath, const char* mode, qboolean quiet
 }
 
 
+/*
+====================
+FS_OpenRealFileAsync
+
+Same as FS_OpenRealFile with mode "w" or "wb", but the file is built in
+memory and handed to the write queue when it is closed, so slow disks don't
+hold up the caller.  The file can't be read back while it is open.
+====================
+*/
+qfile_t* FS_OpenRealFileAsync (const char* filepath, const char* mode, qboolean quiet)
+{
+	char real_path [MAX_OSPATH];
+	qfile_t* file;
+
+	if (FS_CheckNastyPath(filepath, false))
+	{
+		Con_Printf("FS_OpenRealFileAsync(\"%s\", %s): nasty filename rejected\n", filepath, quiet ? "true" : "false");
+		return NULL;
+	}
+	if (COM_CheckParm("-readonly"))
+		return NULL;
+
+	if (fs_gamedir[strlen(fs_gamedir) - 1] == '/')
+		dpsnprintf (real_path, sizeof (real_path), "%s%s", fs_gamedir, filepath); // this is never a vpack
+	else
+		dpsnprintf (real_path, sizeof (real_path), "%s/%s", fs_gamedir, filepath); // this is never a vpack
+	FS_CreatePath (real_path);
+
+	file = (qfile_t *)Mem_Alloc (fs_mempool, sizeof (*file));
+	file->flags = QFILE_FLAG_WRITEQUEUE;
+	if (!strchr(mode, 'b'))
+		file->flags |= QFILE_FLAG_TEXT;
+	file->ungetc = EOF;
+	file->handle = FILEDESC_INVALID;
+	file->filename = Mem_strdup (fs_mempool, real_path);
+	return file;
+}
+
+
 /*
 ====================
 FS_OpenVirtualFile
@@ -2747,6 +3695,21 @@ int FS_Close (qfile_t* file)
 		return 0;
 	}
 
+	if (file->flags & QFILE_FLAG_WRITEQUEUE)
+	{
+		// the write queue takes over the data
+		if (file->flags & QFILE_FLAG_REMOVE)
+		{
+			if (file->writedata)
+				Mem_Free(file->writedata);
+		}
+		else
+			FS_WriteQueue_Add(file->filename, file->writedata, file->real_length, (file->flags & QFILE_FLAG_TEXT) != 0);
+		Mem_Free((void *) file->filename);
+		Mem_Free(file);
+		return 0;
+	}
+
 	if (FILEDESC_CLOSE (file->handle))
 		Con_Printf("FS_Close: File descriptor %i cannot be close properly\n", (int)file->handle);
 
@@ -2754,6 +3717,7 @@ int FS_Close (qfile_t* file)
 	{
 		if (file->flags & QFILE_FLAG_REMOVE)
 		{
+			fs_search_generation++;
 			if (remove(file->filename) == -1)
 			{
 				// No need to report this. If removing a just
@@ -2792,6 +3756,21 @@ fs_offset_t FS_Write (qfile_t* file, const void* data, size_t datasize)
 {
 	fs_offset_t written = 0;
 
+	if (file->flags & QFILE_FLAG_WRITEQUEUE)
+	{
+		fs_offset_t end = file->position + datasize;
+		if (end > file->writedatasize)
+		{
+			file->writedatasize = max(end, max(file->writedatasize * 2, 4096));
+			file->writedata = (unsigned char *)Mem_Realloc(fs_mempool, file->writedata, file->writedatasize);
+		}
+		memcpy(file->writedata + file->position, data, datasize);
+		file->position = end;
+		if (file->real_length < file->position)
+			file->real_length = file->position;
+		return datasize;
+	}
+
 	// If necessary, seek to the exact file position we're supposed to be
 	if (file->buff_ind != file->buff_len)
 	{
@@ -2828,6 +3807,45 @@ fs_offset_t FS_Write (qfile_t* file, const void* data, size_t datasize)
 }
 
 
+/*
+====================
+FS_ReadAt
+
+Reads from an absolute offset of the underlying file
+====================
+*/
+static fs_offset_t FS_ReadAt (qfile_t* file, void* buffer, fs_offset_t count, fs_offset_t offset)
+{
+#if !USE_RWOPS && !defined(WIN32)
+	// pack handles are dup()ed and share their file position, and nothing
+	// ever writes to them, so don't bother seeking them
+	if (file->flags & QFILE_FLAG_PACKED)
+		return pread (file->handle, buffer, count, offset);
+#elif !USE_RWOPS
+	// same for _dup()ed handles, reading at an explicit offset keeps the
+	// I/O threads from moving the shared position under the main thread
+	if (file->flags & QFILE_FLAG_PACKED)
+	{
+		OVERLAPPED overlapped;
+		DWORD nb;
+		memset (&overlapped, 0, sizeof (overlapped));
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)((unsigned long long)offset >> 32);
+		if (!ReadFile ((HANDLE)_get_osfhandle (file->handle), buffer, (DWORD)count, &nb, &overlapped))
+			return GetLastError () == ERROR_HANDLE_EOF ? 0 : -1;
+		return nb;
+	}
+#endif
+	if (FILEDESC_SEEK (file->handle, offset, SEEK_SET) == -1)
+	{
+		// Seek failed. When reading from a pipe, and
+		// the caller never called FS_Seek, this still
+		// works fine.  So no reporting this error.
+	}
+	return FILEDESC_READ (file->handle, buffer, count);
+}
+
+
 /*
 ====================
 FS_Read
@@ -2853,6 +3871,10 @@ fs_offset_t FS_Read (qfile_t* file, void* buffer, size_t buffersize)
 	else
 		done = 0;
 
+	// queued writes can't be read back
+	if (file->flags & QFILE_FLAG_WRITEQUEUE)
+		return done;
+
 	if(file->flags & QFILE_FLAG_DATA)
 	{
 		size_t left = file->real_length - file->position;
@@ -2892,13 +3914,7 @@ fs_offset_t FS_Read (qfile_t* file, void* buffer, size_t buffersize)
 		{
 			if (count > (fs_offset_t)buffersize)
 				count = (fs_offset_t)buffersize;
-			if (FILEDESC_SEEK (file->handle, file->offset + file->position, SEEK_SET) == -1)
-			{
-				// Seek failed. When reading from a pipe, and
-				// the caller never called FS_Seek, this still
-				// works fine.  So no reporting this error.
-			}
-			nb = FILEDESC_READ (file->handle, &((unsigned char*)buffer)[done], count);
+			nb = FS_ReadAt (file, &((unsigned char*)buffer)[done], count, file->offset + file->position);
 			if (nb > 0)
 			{
 				done += nb;
@@ -2912,13 +3928,7 @@ fs_offset_t FS_Read (qfile_t* file, void* buffer, size_t buffersize)
 		{
 			if (count > (fs_offset_t)sizeof (file->buff))
 				count = (fs_offset_t)sizeof (file->buff);
-			if (FILEDESC_SEEK (file->handle, file->offset + file->position, SEEK_SET) == -1)
-			{
-				// Seek failed. When reading from a pipe, and
-				// the caller never called FS_Seek, this still
-				// works fine.  So no reporting this error.
-			}
-			nb = FILEDESC_READ (file->handle, file->buff, count);
+			nb = FS_ReadAt (file, file->buff, count, file->offset + file->position);
 			if (nb > 0)
 			{
 				file->buff_len = nb;
@@ -2952,10 +3962,9 @@ fs_offset_t FS_Read (qfile_t* file, void* buffer, size_t buffersize)
 				return done;
 
 			count = (fs_offset_t)(ztk->comp_length - ztk->in_position);
-			if (count > (fs_offset_t)sizeof (ztk->input))
-				count = (fs_offset_t)sizeof (ztk->input);
-			FILEDESC_SEEK (file->handle, file->offset + (fs_offset_t)ztk->in_position, SEEK_SET);
-			if (FILEDESC_READ (file->handle, ztk->input, count) != count)
+			if (count > (fs_offset_t)ztk->in_size)
+				count = (fs_offset_t)ztk->in_size;
+			if (FS_ReadAt (file, ztk->input, count, file->offset + (fs_offset_t)ztk->in_position) != count)
 			{
 				Con_Printf ("FS_Read: unexpected end of file\n");
 				break;
@@ -3078,7 +4087,10 @@ int FS_VPrintf (qfile_t* file, const char* format, va_list ap)
 		buff_size *= 2;
 	}
 
-	len = FILEDESC_WRITE (file->handle, tempbuff, len);
+	if (file->flags & QFILE_FLAG_WRITEQUEUE)
+		len = (int)FS_Write (file, tempbuff, len);
+	else
+		len = FILEDESC_WRITE (file->handle, tempbuff, len);
 	Mem_Free (tempbuff);
 
 	return len;
@@ -3176,7 +4188,7 @@ int FS_Seek (qfile_t* file, fs_offset_t offset, int whence)
 		}
 	}
 
-	if(file->flags & QFILE_FLAG_DATA)
+	if(file->flags & (QFILE_FLAG_DATA | QFILE_FLAG_WRITEQUEUE))
 	{
 		file->position = offset;
 		return 0;
@@ -3286,6 +4298,54 @@ void FS_Purge (qfile_t* file)
 }
 
 
+/*
+============
+FS_InflateWholeFile
+
+Inflates a whole deflated entry straight into buffer, reading all of the
+compressed data at once.  Returns false if FS_Read has to do it instead.
+============
+*/
+static qboolean FS_InflateWholeFile (qfile_t *file, unsigned char *buffer)
+{
+	ztoolkit_t *ztk = file->ztk;
+	unsigned char *input = ztk->input;
+	int error;
+
+	if (file->position != 0 || ztk->in_position != 0 || file->buff_len != 0 || file->ungetc != EOF)
+		return false;
+	if (ztk->comp_length > ZIP_WHOLEREAD_MAX || (unsigned long long)file->real_length > UINT_MAX)
+		return false;
+
+	if (ztk->comp_length > ztk->in_size)
+		input = (unsigned char *)Mem_Alloc (tempmempool, ztk->comp_length);
+	if (FS_ReadAt (file, input, (fs_offset_t)ztk->comp_length, file->offset) != (fs_offset_t)ztk->comp_length)
+	{
+		if (input != ztk->input)
+			Mem_Free (input);
+		return false;
+	}
+
+	ztk->zstream.next_in = input;
+	ztk->zstream.avail_in = (unsigned int)ztk->comp_length;
+	ztk->zstream.next_out = buffer;
+	ztk->zstream.avail_out = (unsigned int)file->real_length;
+	error = inflate (&ztk->zstream, Z_SYNC_FLUSH);
+	if ((error != Z_OK && error != Z_STREAM_END) || ztk->zstream.avail_out)
+		Con_Printf ("FS_Read: Can't inflate file\n");
+
+	// leave the stream at the end of the file
+	ztk->zstream.next_in = ztk->input;
+	ztk->zstream.avail_in = 0;
+	ztk->in_ind = ztk->in_len = 0;
+	ztk->in_position = ztk->comp_length;
+	file->position = file->real_length;
+	if (input != ztk->input)
+		Mem_Free (input);
+	return true;
+}
+
+
 /*
 ============
 FS_LoadAndCloseQFile
@@ -3311,7 +4371,8 @@ static unsigned char *FS_LoadAndCloseQFile (qfile_t *file, const char *path, mem
 
 		buf = (unsigned char *)Mem_Alloc (pool, filesize + 1);
 		buf[filesize] = '\0';
-		FS_Read (file, buf, filesize);
+		if (!(file->flags & QFILE_FLAG_DEFLATED) || !FS_InflateWholeFile (file, buf))
+			FS_Read (file, buf, filesize);
 		FS_Close (file);
 		if (developer_loadfile.integer)
 			Con_Printf("loaded file \"%s\" (%u bytes)\n", path, (unsigned int)filesize);
@@ -3354,11 +4415,775 @@ unsigned char *FS_SysLoadFile (const char *path, mempool_t *pool, qboolean quiet
 
 
 /*
-============
-FS_WriteFile
+=============================================================================
 
-The filename will be prefixed by the current game directory
-============
+ASYNCHRONOUS LOADING
+
+FS_LoadFileAsync hands loads to a few I/O threads so reading and inflating
+overlaps with whatever the main thread is doing.  Completed loads with a
+callback are delivered on the main thread by FS_Async_Frame, loads without
+one are collected with FS_Async_Finish.
+=============================================================================
+*/
+
+#define FS_ASYNC_MAXTHREADS 8
+#define FS_ASYNC_PREFETCHCHUNK 65536
+
+typedef struct fs_asyncfile_s
+{
+	char path[MAX_OSPATH];
+	mempool_t *pool;
+	qboolean quiet;
+	qboolean prefetch;
+	qboolean checksum;
+	int crc;
+	fs_asynccallback_t callback;
+	void *userdata;
+	qboolean done;
+	unsigned char *data;
+	fs_offset_t filesize;
+	struct fs_asyncfile_s *next;
+}
+fs_asyncfile_t;
+
+static struct fs_async_s
+{
+	void *mutex;
+	void *wakecond;
+	void *donecond;
+	int numthreads;
+	void *threads[FS_ASYNC_MAXTHREADS];
+	qboolean quit;
+	int busy;
+	// jobs waiting for a thread, oldest first
+	fs_asyncfile_t *queue, *queuetail;
+	// finished jobs waiting for their callback, oldest first
+	fs_asyncfile_t *finished, *finishedtail;
+}
+fs_async;
+
+/*
+============
+FS_Async_Prefetch
+
+Reads the raw contents of a file and throws them away, so the following
+load finds them in the system's cache
+============
+*/
+static void FS_Async_Prefetch (const char *path)
+{
+	qfile_t *file;
+	unsigned char *buffer;
+	fs_offset_t offset, length;
+
+	file = FS_OpenVirtualFile(path, true);
+	if (!file)
+		return;
+	length = file->ztk ? (fs_offset_t)file->ztk->comp_length : file->real_length;
+	buffer = (unsigned char *)Mem_Alloc(tempmempool, FS_ASYNC_PREFETCHCHUNK);
+	for (offset = 0;offset < length;offset += FS_ASYNC_PREFETCHCHUNK)
+		if (FS_ReadAt(file, buffer, min(length - offset, FS_ASYNC_PREFETCHCHUNK), file->offset + offset) <= 0)
+			break;
+	Mem_Free(buffer);
+	FS_Close(file);
+}
+
+static void FS_Async_RunJob (fs_asyncfile_t *job)
+{
+	size_t filesize;
+	if (job->prefetch)
+		FS_Async_Prefetch(job->path);
+	else if (job->checksum)
+	{
+		job->crc = FS_CRCFile(job->path, &filesize);
+		job->filesize = filesize;
+	}
+	else
+		job->data = FS_LoadFile(job->path, job->pool, job->quiet, &job->filesize);
+}
+
+static int FS_Async_Thread (void *unused)
+{
+	fs_asyncfile_t *job;
+	Thread_LockMutex(fs_async.mutex);
+	for (;;)
+	{
+		// finish the queue before quitting, FS_Async_Finish may wait on it
+		while (!fs_async.quit && !fs_async.queue)
+			Thread_CondWait(fs_async.wakecond, fs_async.mutex);
+		if (!fs_async.queue)
+			break;
+		job = fs_async.queue;
+		fs_async.queue = job->next;
+		if (!fs_async.queue)
+			fs_async.queuetail = NULL;
+		job->next = NULL;
+		fs_async.busy++;
+		Thread_UnlockMutex(fs_async.mutex);
+
+		FS_Async_RunJob(job);
+
+		Thread_LockMutex(fs_async.mutex);
+		fs_async.busy--;
+		job->done = true;
+		if (job->prefetch)
+			Mem_Free(job);
+		else if (job->callback)
+		{
+			if (fs_async.finishedtail)
+				fs_async.finishedtail->next = job;
+			else
+				fs_async.finished = job;
+			fs_async.finishedtail = job;
+		}
+		Thread_CondBroadcast(fs_async.donecond);
+	}
+	Thread_UnlockMutex(fs_async.mutex);
+	return 0;
+}
+
+static void FS_Async_StartThreads (void)
+{
+	int numthreads = bound(0, fs_async_threads.integer, FS_ASYNC_MAXTHREADS);
+	if (fs_async.numthreads || !numthreads || !Thread_HasThreads())
+		return;
+	fs_async.mutex = Thread_CreateMutex();
+	fs_async.wakecond = Thread_CreateCond();
+	fs_async.donecond = Thread_CreateCond();
+	fs_async.quit = false;
+	for (fs_async.numthreads = 0;fs_async.numthreads < numthreads;fs_async.numthreads++)
+		fs_async.threads[fs_async.numthreads] = Thread_CreateThread(FS_Async_Thread, NULL);
+}
+
+/*
+============
+FS_Async_Shutdown
+
+Stops the I/O threads after they finished the queued loads and writes,
+results that were not delivered yet are dropped
+============
+*/
+void FS_Async_Shutdown (void)
+{
+	int i;
+	fs_asyncfile_t *job;
+	FS_WriteQueue_Shutdown();
+	if (fs_mutex) Thread_LockMutex(fs_mutex);
+	FS_PK3Cache_Flush();
+	if (fs_mutex) Thread_UnlockMutex(fs_mutex);
+	if (fs_async.numthreads)
+	{
+		Thread_LockMutex(fs_async.mutex);
+		fs_async.quit = true;
+		Thread_CondBroadcast(fs_async.wakecond);
+		Thread_UnlockMutex(fs_async.mutex);
+		for (i = 0;i < fs_async.numthreads;i++)
+			Thread_WaitThread(fs_async.threads[i], 0);
+		Thread_DestroyCond(fs_async.donecond);
+		Thread_DestroyCond(fs_async.wakecond);
+		Thread_DestroyMutex(fs_async.mutex);
+		fs_async.numthreads = 0;
+		fs_async.quit = false;
+	}
+	while ((job = fs_async.finished))
+	{
+		fs_async.finished = job->next;
+		Mem_Free(job);
+	}
+	fs_async.finishedtail = NULL;
+}
+
+/*
+============
+FS_Async_Wait
+
+Waits until the I/O threads are idle, without delivering anything
+============
+*/
+static void FS_Async_Wait (void)
+{
+	if (!fs_async.numthreads)
+		return;
+	Thread_LockMutex(fs_async.mutex);
+	while (fs_async.queue || fs_async.busy)
+		Thread_CondWait(fs_async.donecond, fs_async.mutex);
+	Thread_UnlockMutex(fs_async.mutex);
+}
+
+static void FS_Async_Enqueue (fs_asyncfile_t *job)
+{
+	FS_Async_StartThreads();
+	if (!fs_async.numthreads)
+	{
+		// no threads, load it right away but still deliver it from
+		// FS_Async_Frame so callbacks never run inside the caller
+		FS_Async_RunJob(job);
+		job->done = true;
+		if (job->prefetch)
+			Mem_Free(job);
+		else if (job->callback)
+		{
+			if (fs_async.finishedtail)
+				fs_async.finishedtail->next = job;
+			else
+				fs_async.finished = job;
+			fs_async.finishedtail = job;
+		}
+		return;
+	}
+	Thread_LockMutex(fs_async.mutex);
+	if (fs_async.queuetail)
+		fs_async.queuetail->next = job;
+	else
+		fs_async.queue = job;
+	fs_async.queuetail = job;
+	Thread_CondSignal(fs_async.wakecond);
+	Thread_UnlockMutex(fs_async.mutex);
+}
+
+/*
+============
+FS_LoadFileAsync
+
+Queues FS_LoadFile(path, pool, quiet) on an I/O thread.  With a callback the
+result is passed to it from FS_Async_Frame on the main thread (data is NULL
+if the file could not be loaded) and NULL is returned, otherwise the
+returned handle must be passed to FS_Async_Finish.
+
+pool must stay valid until the load is delivered.
+============
+*/
+fs_asyncfile_t *FS_LoadFileAsync (const char *path, mempool_t *pool, qboolean quiet, fs_asynccallback_t callback, void *userdata)
+{
+	fs_asyncfile_t *job;
+	job = (fs_asyncfile_t *)Mem_Alloc(fs_mempool, sizeof(*job));
+	strlcpy(job->path, path, sizeof(job->path));
+	job->pool = pool;
+	job->quiet = quiet;
+	job->callback = callback;
+	job->userdata = userdata;
+	FS_Async_Enqueue(job);
+	return callback ? NULL : job;
+}
+
+/*
+============
+FS_Async_Finish
+
+Waits for a load queued without a callback and returns what FS_LoadFile
+would have returned, the handle is freed
+============
+*/
+static void FS_Async_WaitJob (fs_asyncfile_t *job)
+{
+	if (!fs_async.numthreads)
+		return;
+	Thread_LockMutex(fs_async.mutex);
+	while (!job->done)
+		Thread_CondWait(fs_async.donecond, fs_async.mutex);
+	Thread_UnlockMutex(fs_async.mutex);
+}
+
+unsigned char *FS_Async_Finish (fs_asyncfile_t *handle, fs_offset_t *filesizepointer)
+{
+	unsigned char *data;
+	FS_Async_WaitJob(handle);
+	data = handle->data;
+	if (filesizepointer)
+		*filesizepointer = handle->filesize;
+	Mem_Free(handle);
+	return data;
+}
+
+/*
+============
+FS_CRCFiles
+
+FS_CRCFile for several files at once, the files are checksummed in parallel
+by the I/O threads.  filesizes may be NULL.
+============
+*/
+void FS_CRCFiles (int count, const char *const *filenames, int *crcs, size_t *filesizes)
+{
+	int i;
+	fs_asyncfile_t **jobs;
+
+	jobs = (fs_asyncfile_t **)Mem_Alloc(tempmempool, max(count, 1) * sizeof(*jobs));
+	for (i = 0;i < count;i++)
+	{
+		jobs[i] = (fs_asyncfile_t *)Mem_Alloc(fs_mempool, sizeof(*jobs[i]));
+		strlcpy(jobs[i]->path, filenames[i], sizeof(jobs[i]->path));
+		jobs[i]->checksum = true;
+		FS_Async_Enqueue(jobs[i]);
+	}
+	for (i = 0;i < count;i++)
+	{
+		FS_Async_WaitJob(jobs[i]);
+		crcs[i] = jobs[i]->crc;
+		if (filesizes)
+			filesizes[i] = (size_t)jobs[i]->filesize;
+		Mem_Free(jobs[i]);
+	}
+	Mem_Free(jobs);
+}
+
+/*
+============
+FS_PrefetchFile
+
+Hint that path will be loaded soon, an I/O thread reads it ahead of time
+============
+*/
+void FS_PrefetchFile (const char *path)
+{
+	fs_asyncfile_t *job;
+	FS_Async_StartThreads();
+	if (!fs_async.numthreads)
+		return;
+	job = (fs_asyncfile_t *)Mem_Alloc(fs_mempool, sizeof(*job));
+	strlcpy(job->path, path, sizeof(job->path));
+	job->prefetch = true;
+	FS_Async_Enqueue(job);
+}
+
+/*
+============
+FS_Async_Frame
+
+Delivers the finished loads to their callbacks, called every frame
+============
+*/
+void FS_Async_Frame (void)
+{
+	fs_asyncfile_t *job, *finished;
+
+	if (!fs_async.finished)
+		return;
+	if (fs_async.numthreads)
+		Thread_LockMutex(fs_async.mutex);
+	finished = fs_async.finished;
+	fs_async.finished = fs_async.finishedtail = NULL;
+	if (fs_async.numthreads)
+		Thread_UnlockMutex(fs_async.mutex);
+
+	while ((job = finished))
+	{
+		finished = job->next;
+		job->callback(job->path, job->data, job->filesize, job->userdata);
+		Mem_Free(job);
+	}
+}
+
+/*
+============
+FS_Async_Flush
+
+Waits for all queued loads and delivers them
+============
+*/
+void FS_Async_Flush (void)
+{
+	FS_Async_Wait();
+	FS_Async_Frame();
+}
+
+
+/*
+=============================================================================
+
+WRITE QUEUE
+
+Files from FS_OpenRealFileAsync and FS_WriteFile are written by a single
+background thread, in the order they were closed.  Each one goes to a
+temporary file that is synced and renamed over the old file, so a crash
+never leaves half a config or savegame behind.  A file closed again before
+its previous version got written only gets written once, and anything
+looking at a file with a pending write waits for it.
+=============================================================================
+*/
+
+typedef struct fs_writejob_s
+{
+	char path[MAX_OSPATH];
+	unsigned char *data;
+	fs_offset_t size;
+	qboolean text;	///< write in text mode (line endings on Windows)
+	struct fs_writejob_s *next;
+}
+fs_writejob_t;
+
+static struct fs_writequeue_s
+{
+	void *mutex;
+	void *wakecond;
+	void *donecond;
+	void *thread;
+	qboolean quit;
+	// queued or being written, read without the lock to skip the common case
+	int numpending;
+	fs_writejob_t *current;
+	fs_writejob_t *queue, *queuetail;
+}
+fs_writequeue;
+
+static void FS_SysSync (filedesc_t handle)
+{
+#if USE_RWOPS
+#elif defined(WIN32)
+	_commit(handle);
+#else
+	fsync(handle);
+#endif
+}
+
+/*
+============
+FS_WriteQueue_Write
+
+Writes data to path through a temporary file
+============
+*/
+static void FS_WriteQueue_Write (const char *path, const unsigned char *data, fs_offset_t size, qboolean text)
+{
+	char temppath[MAX_OSPATH];
+	filedesc_t handle;
+	fs_offset_t written = 0;
+
+	dpsnprintf(temppath, sizeof(temppath), "%s.tmp", path);
+	handle = FS_SysOpenFiledesc(temppath, text ? "w" : "wb", false);
+	if (!FILEDESC_ISVALID(handle))
+	{
+		Con_Printf("FS_WriteFile: failed on %s\n", path);
+		return;
+	}
+	while (written < size)
+	{
+		int chunk = (int)min(size - written, 1<<30);
+		int result = (int)FILEDESC_WRITE(handle, data + written, chunk);
+		if (result <= 0)
+			break;
+		written += result;
+	}
+	FS_SysSync(handle);
+	FILEDESC_CLOSE(handle);
+	if (written < size)
+	{
+		Con_Printf("FS_WriteFile: failed on %s\n", path);
+		remove(temppath);
+		return;
+	}
+	if (!FS_SysReplaceFile(temppath, path))
+		Con_Printf("FS_WriteFile: can't rename %s to %s\n", temppath, path);
+}
+
+static int FS_WriteQueue_Thread (void *unused)
+{
+	fs_writejob_t *job;
+	Thread_LockMutex(fs_writequeue.mutex);
+	for (;;)
+	{
+		// write everything before quitting
+		while (!fs_writequeue.quit && !fs_writequeue.queue)
+			Thread_CondWait(fs_writequeue.wakecond, fs_writequeue.mutex);
+		if (!fs_writequeue.queue)
+			break;
+		job = fs_writequeue.queue;
+		fs_writequeue.queue = job->next;
+		if (!fs_writequeue.queue)
+			fs_writequeue.queuetail = NULL;
+		fs_writequeue.current = job;
+		Thread_UnlockMutex(fs_writequeue.mutex);
+
+		FS_WriteQueue_Write(job->path, job->data, job->size, job->text);
+		if (job->data)
+			Mem_Free(job->data);
+
+		Thread_LockMutex(fs_writequeue.mutex);
+		fs_writequeue.current = NULL;
+		fs_writequeue.numpending--;
+		fs_search_generation++;
+		Mem_Free(job);
+		Thread_CondBroadcast(fs_writequeue.donecond);
+	}
+	Thread_UnlockMutex(fs_writequeue.mutex);
+	return 0;
+}
+
+/*
+============
+FS_WriteQueue_Add
+
+Queues data to be written to the real file path, data is freed once it is
+written
+============
+*/
+static void FS_WriteQueue_Add (const char *path, unsigned char *data, fs_offset_t size, qboolean text)
+{
+	fs_writejob_t *job;
+
+	if (fs_async_write.integer && !fs_writequeue.thread && Thread_HasThreads())
+	{
+		fs_writequeue.mutex = Thread_CreateMutex();
+		fs_writequeue.wakecond = Thread_CreateCond();
+		fs_writequeue.donecond = Thread_CreateCond();
+		fs_writequeue.quit = false;
+		fs_writequeue.thread = Thread_CreateThread(FS_WriteQueue_Thread, NULL);
+	}
+	if (!fs_async_write.integer || !fs_writequeue.thread)
+	{
+		// still wait for earlier writes so they can't overwrite this one
+		FS_WriteQueue_Flush();
+		FS_WriteQueue_Write(path, data, size, text);
+		fs_search_generation++;
+		if (data)
+			Mem_Free(data);
+		return;
+	}
+
+	Thread_LockMutex(fs_writequeue.mutex);
+	// replace the contents of a queued write to the same file
+	for (job = fs_writequeue.queue;job;job = job->next)
+	{
+		if (!strcmp(job->path, path))
+		{
+			if (job->data)
+				Mem_Free(job->data);
+			job->data = data;
+			job->size = size;
+			job->text = text;
+			Thread_UnlockMutex(fs_writequeue.mutex);
+			return;
+		}
+	}
+	job = (fs_writejob_t *)Mem_Alloc(fs_mempool, sizeof(*job));
+	strlcpy(job->path, path, sizeof(job->path));
+	job->data = data;
+	job->size = size;
+	job->text = text;
+	if (fs_writequeue.queuetail)
+		fs_writequeue.queuetail->next = job;
+	else
+		fs_writequeue.queue = job;
+	fs_writequeue.queuetail = job;
+	fs_writequeue.numpending++;
+	Thread_CondSignal(fs_writequeue.wakecond);
+	Thread_UnlockMutex(fs_writequeue.mutex);
+}
+
+static qboolean FS_WriteQueue_IsPending (const char *path)
+{
+	fs_writejob_t *job;
+	if (fs_writequeue.current && !strcmp(fs_writequeue.current->path, path))
+		return true;
+	for (job = fs_writequeue.queue;job;job = job->next)
+		if (!strcmp(job->path, path))
+			return true;
+	return false;
+}
+
+/*
+============
+FS_WriteQueue_WaitFor
+
+Waits until the queued writes to the real file path are on disk
+============
+*/
+static void FS_WriteQueue_WaitFor (const char *path)
+{
+	if (!fs_writequeue.numpending)
+		return;
+	Thread_LockMutex(fs_writequeue.mutex);
+	while (FS_WriteQueue_IsPending(path))
+		Thread_CondWait(fs_writequeue.donecond, fs_writequeue.mutex);
+	Thread_UnlockMutex(fs_writequeue.mutex);
+}
+
+/*
+============
+FS_WriteQueue_Flush
+
+Waits until all queued writes are on disk, unless it is called on the
+writer thread itself (a Sys_Error while writing) which would wait forever
+============
+*/
+void FS_WriteQueue_Flush (void)
+{
+	if (!fs_writequeue.numpending || (fs_writequeue.thread && Thread_IsCurrent(fs_writequeue.thread)))
+		return;
+	Thread_LockMutex(fs_writequeue.mutex);
+	while (fs_writequeue.numpending)
+		Thread_CondWait(fs_writequeue.donecond, fs_writequeue.mutex);
+	Thread_UnlockMutex(fs_writequeue.mutex);
+}
+
+static void FS_WriteQueue_Shutdown (void)
+{
+	if (!fs_writequeue.thread)
+		return;
+	Thread_LockMutex(fs_writequeue.mutex);
+	fs_writequeue.quit = true;
+	Thread_CondBroadcast(fs_writequeue.wakecond);
+	Thread_UnlockMutex(fs_writequeue.mutex);
+	Thread_WaitThread(fs_writequeue.thread, 0);
+	Thread_DestroyCond(fs_writequeue.donecond);
+	Thread_DestroyCond(fs_writequeue.wakecond);
+	Thread_DestroyMutex(fs_writequeue.mutex);
+	fs_writequeue.thread = NULL;
+	fs_writequeue.quit = false;
+}
+
+
+/*
+=============================================================================
+
+MAPPED FILES
+
+=============================================================================
+*/
+
+struct fs_mappedfile_s
+{
+	void *base;			///< start of the mapping (page aligned), or the loaded copy
+	size_t size;		///< size of the mapping
+	qboolean copied;	///< base was Mem_Alloc'ed because the file could not be mapped
+#ifdef WIN32
+	HANDLE maphandle;
+#endif
+};
+
+/*
+============
+FS_SysMapRegion
+
+Maps length bytes of an open file starting at offset, returns a pointer to
+the first byte or NULL if the system can't map it
+============
+*/
+static const unsigned char *FS_SysMapRegion (fs_mappedfile_t *mapping, filedesc_t handle, fs_offset_t offset, fs_offset_t length)
+{
+#if USE_RWOPS
+	return NULL;
+#elif defined(WIN32)
+	SYSTEM_INFO sysinfo;
+	fs_offset_t start;
+
+	GetSystemInfo(&sysinfo);
+	start = offset - offset % sysinfo.dwAllocationGranularity;
+	mapping->maphandle = CreateFileMappingA((HANDLE)_get_osfhandle(handle), NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping->maphandle)
+		return NULL;
+	mapping->size = (size_t)(offset + length - start);
+	mapping->base = MapViewOfFile(mapping->maphandle, FILE_MAP_READ, (DWORD)((unsigned long long)start >> 32), (DWORD)start, mapping->size);
+	if (!mapping->base)
+	{
+		CloseHandle(mapping->maphandle);
+		return NULL;
+	}
+	return (const unsigned char *)mapping->base + (offset - start);
+#else
+	fs_offset_t start;
+	long pagesize = sysconf(_SC_PAGESIZE);
+
+	if (pagesize <= 0)
+		return NULL;
+	start = offset - offset % pagesize;
+	mapping->size = (size_t)(offset + length - start);
+	mapping->base = mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE, handle, start);
+	if (mapping->base == MAP_FAILED)
+		return NULL;
+	return (const unsigned char *)mapping->base + (offset - start);
+#endif
+}
+
+/*
+============
+FS_MapFile
+
+Returns a read-only view of a file's contents for loaders that parse in
+place.  Stored pack entries and plain files are mapped straight from the
+file, anything else (deflated entries, small files, systems without mmap)
+is loaded into a copy.  Unlike FS_LoadFile no 0 byte is appended.
+
+The view stays valid until FS_UnmapFile(*mapping) is called.
+============
+*/
+const unsigned char *FS_MapFile (const char *path, qboolean quiet, fs_offset_t *filesizepointer, fs_mappedfile_t **mapping)
+{
+	qfile_t *file;
+	fs_mappedfile_t *map;
+	const unsigned char *data = NULL;
+	fs_offset_t filesize;
+
+	*mapping = NULL;
+	if (filesizepointer)
+		*filesizepointer = 0;
+
+	file = FS_OpenVirtualFile(path, quiet);
+	if (!file)
+		return NULL;
+
+	map = (fs_mappedfile_t *)Mem_Alloc(fs_mempool, sizeof(*map));
+	if (fs_mmap.integer && file->real_length > 0 && file->real_length >= fs_mmap_minsize.integer && !(file->flags & (QFILE_FLAG_DEFLATED | QFILE_FLAG_DATA)))
+		data = FS_SysMapRegion(map, file->handle, file->offset, file->real_length);
+	if (data)
+	{
+		filesize = file->real_length;
+		FS_Close(file);
+		if (developer_loadfile.integer)
+			Con_Printf("mapped file \"%s\" (%u bytes)\n", path, (unsigned int)filesize);
+	}
+	else
+	{
+		map->copied = true;
+		map->base = FS_LoadAndCloseQFile(file, path, fs_mempool, quiet, &filesize);
+		if (!map->base)
+		{
+			Mem_Free(map);
+			return NULL;
+		}
+		data = (const unsigned char *)map->base;
+	}
+
+	*mapping = map;
+	if (filesizepointer)
+		*filesizepointer = filesize;
+	return data;
+}
+
+
+/*
+============
+FS_UnmapFile
+============
+*/
+void FS_UnmapFile (fs_mappedfile_t *mapping)
+{
+	if (!mapping)
+		return;
+	if (mapping->copied)
+		Mem_Free(mapping->base);
+#if !USE_RWOPS
+	else
+	{
+#ifdef WIN32
+		UnmapViewOfFile(mapping->base);
+		CloseHandle(mapping->maphandle);
+#else
+		munmap(mapping->base, mapping->size);
+#endif
+	}
+#endif
+	Mem_Free(mapping);
+}
+
+
+/*
+============
+FS_WriteFile
+
+The filename will be prefixed by the current game directory, the file is
+written by the write queue
+============
 */
 qboolean FS_WriteFileInBlocks (const char *filename, const void *const *data, const fs_offset_t *len, size_t count)
 {
@@ -3366,7 +5191,7 @@ qboolean FS_WriteFileInBlocks (const char *filename, const void *const *data, co
 	size_t i;
 	fs_offset_t lentotal;
 
-	file = FS_OpenRealFile(filename, "wb", false);
+	file = FS_OpenRealFileAsync(filename, "wb", false);
 	if (!file)
 	{
 		Con_Printf("FS_WriteFile: failed on %s\n", filename);
@@ -3507,6 +5332,7 @@ int FS_SysFileType (const char *path)
 	int pathlen = strlen(path) + 1;
 	wchar_t path16[pathlen];
 	fs_mbstowcs(path16, path, pathlen);
+	FS_WriteQueue_WaitFor(path);
 	result = GetFileAttributesW(path16);
 
 	if(result == INVALID_FILE_ATTRIBUTES)
@@ -3518,6 +5344,7 @@ int FS_SysFileType (const char *path)
 	return FS_FILETYPE_FILE;
 #else
 	struct stat buf;
+	FS_WriteQueue_WaitFor(path);
 #ifdef __ANDROID__
 	if (path[0] != '/') {
 		filedesc_t h;
@@ -3549,20 +5376,20 @@ qboolean FS_SysFileExists (const char *path)
 
 /*
 ===========
-FS_Search
+FS_DoSearch
 
 Allocate and fill a search structure with information on matching filenames.
 ===========
 */
-fssearch_t *FS_Search(const char *pattern, int caseinsensitive, int quiet)
+static fssearch_t *FS_DoSearch(const char *pattern, int caseinsensitive, int quiet, size_t *searchsize)
 {
 	fssearch_t *search;
 	searchpath_t *searchpath;
-	pack_t *pak;
 	int i, basepathlength, numfiles, numchars, resultlistindex, dirlistindex;
 	stringlist_t resultlist;
 	const char *slash, *backslash, *colon, *separator;
 	char *basepath;
+	qboolean searchedpacks = false;
 
 	for (i = 0;pattern[i] == '.' || pattern[i] == ':' || pattern[i] == '/' || pattern[i] == '\\';i++)
 		;
@@ -3589,44 +5416,13 @@ fssearch_t *FS_Search(const char *pattern, int caseinsensitive, int quiet)
 	// search through the path, one element at a time
 	for (searchpath = fs_searchpaths;searchpath;searchpath = searchpath->next)
 	{
-		// is the element a pak file?
+		// all packs are handled at once by FS_SearchIndex
 		if (searchpath->pack && !searchpath->pack->vpack)
 		{
-			// look through all the pak file elements
-			pak = searchpath->pack;
-			for (i = 0;i < pak->numfiles;i++)
-			{
-				char temp[MAX_OSPATH];
-				strlcpy(temp, pak->files[i].name, sizeof(temp));
-				while (temp[0])
-				{
-					if (matchpattern(temp, (char *)pattern, true))
-					{
-						for (resultlistindex = 0;resultlistindex < resultlist.numstrings;resultlistindex++)
-							if (!strcmp(resultlist.strings[resultlistindex], temp))
-								break;
-						if (resultlistindex == resultlist.numstrings)
-						{
-							stringlistappend(&resultlist, temp);
-							if (!quiet && developer_loading.integer)
-								Con_Printf("SearchPackFile: %s : %s\n", pak->filename, temp);
-						}
-					}
-					// strip off one path element at a time until empty
-					// this way directories are added to the listing if they match the pattern
-					slash = strrchr(temp, '/');
-					backslash = strrchr(temp, '\\');
-					colon = strrchr(temp, ':');
-					separator = temp;
-					if (separator < slash)
-						separator = slash;
-					if (separator < backslash)
-						separator = backslash;
-					if (separator < colon)
-						separator = colon;
-					*((char *)separator) = 0;
-				}
-			}
+			if (!searchedpacks)
+				FS_SearchIndex(&resultlist, pattern, basepathlength, quiet);
+			searchedpacks = true;
+			continue;
 		}
 		else
 		{
@@ -3707,15 +5503,10 @@ fssearch_t *FS_Search(const char *pattern, int caseinsensitive, int quiet)
 				const char *matchtemp = matchedSet.strings[dirlistindex];
 				if (matchpattern(matchtemp, (char *)pattern, true))
 				{
-					for (resultlistindex = 0;resultlistindex < resultlist.numstrings;resultlistindex++)
-						if (!strcmp(resultlist.strings[resultlistindex], matchtemp))
-							break;
-					if (resultlistindex == resultlist.numstrings)
-					{
-						stringlistappend(&resultlist, matchtemp);
-						if (!quiet && developer_loading.integer)
-							Con_Printf("SearchDirFile: %s\n", matchtemp);
-					}
+					// duplicates are removed by the sort below
+					stringlistappend(&resultlist, matchtemp);
+					if (!quiet && developer_loading.integer)
+						Con_Printf("SearchDirFile: %s\n", matchtemp);
 				}
 			}
 			stringlistfreecontents( &matchedSet );
@@ -3724,30 +5515,92 @@ fssearch_t *FS_Search(const char *pattern, int caseinsensitive, int quiet)
 
 	if (resultlist.numstrings)
 	{
-		stringlistsort(&resultlist, true);
-		numfiles = resultlist.numstrings;
-		numchars = 0;
-		for (resultlistindex = 0;resultlistindex < resultlist.numstrings;resultlistindex++)
-			numchars += (int)strlen(resultlist.strings[resultlistindex]) + 1;
-		search = (fssearch_t *)Z_Malloc(sizeof(fssearch_t) + numchars + numfiles * sizeof(char *));
-		search->filenames = (char **)((char *)search + sizeof(fssearch_t));
-		search->filenamesbuffer = (char *)((char *)search + sizeof(fssearch_t) + numfiles * sizeof(char *));
-		search->numfilenames = (int)numfiles;
-		numfiles = 0;
-		numchars = 0;
-		for (resultlistindex = 0;resultlistindex < resultlist.numstrings;resultlistindex++)
+		stringlistsort(&resultlist, true);
+		numfiles = resultlist.numstrings;
+		numchars = 0;
+		for (resultlistindex = 0;resultlistindex < resultlist.numstrings;resultlistindex++)
+			numchars += (int)strlen(resultlist.strings[resultlistindex]) + 1;
+		*searchsize = sizeof(fssearch_t) + numchars + numfiles * sizeof(char *);
+		search = (fssearch_t *)Z_Malloc(*searchsize);
+		search->filenames = (char **)((char *)search + sizeof(fssearch_t));
+		search->filenamesbuffer = (char *)((char *)search + sizeof(fssearch_t) + numfiles * sizeof(char *));
+		search->numfilenames = (int)numfiles;
+		numfiles = 0;
+		numchars = 0;
+		for (resultlistindex = 0;resultlistindex < resultlist.numstrings;resultlistindex++)
+		{
+			size_t textlen;
+			search->filenames[numfiles] = search->filenamesbuffer + numchars;
+			textlen = strlen(resultlist.strings[resultlistindex]) + 1;
+			memcpy(search->filenames[numfiles], resultlist.strings[resultlistindex], textlen);
+			numfiles++;
+			numchars += (int)textlen;
+		}
+	}
+	stringlistfreecontents(&resultlist);
+
+	Mem_Free(basepath);
+	return search;
+}
+
+static fssearch_t *FS_CopySearch(const fssearch_t *search, size_t size)
+{
+	fssearch_t *copy;
+	int i;
+	if (!search)
+		return NULL;
+	copy = (fssearch_t *)Z_Malloc(size);
+	memcpy(copy, search, size);
+	copy->filenames = (char **)((char *)copy + sizeof(fssearch_t));
+	copy->filenamesbuffer = (char *)copy + (search->filenamesbuffer - (char *)search);
+	for (i = 0;i < copy->numfilenames;i++)
+		copy->filenames[i] = copy->filenamesbuffer + (search->filenames[i] - search->filenamesbuffer);
+	return copy;
+}
+
+/*
+===========
+FS_Search
+
+Like FS_DoSearch, but the same search repeated within a frame (and without
+any file being written in between) is answered from a cache
+===========
+*/
+fssearch_t *FS_Search(const char *pattern, int caseinsensitive, int quiet)
+{
+	fs_searchcache_t *cache;
+	fssearch_t *search;
+	size_t size = 0;
+	int i;
+
+	FS_WriteQueue_Flush();
+	if (fs_mutex) Thread_LockMutex(fs_mutex);
+	for (i = 0, cache = fs_searchcache;i < FS_SEARCHCACHE_SIZE;i++, cache++)
+	{
+		if (cache->framecount == host_framecount && cache->generation == fs_search_generation && cache->caseinsensitive == caseinsensitive && !strcmp(cache->pattern, pattern))
 		{
-			size_t textlen;
-			search->filenames[numfiles] = search->filenamesbuffer + numchars;
-			textlen = strlen(resultlist.strings[resultlistindex]) + 1;
-			memcpy(search->filenames[numfiles], resultlist.strings[resultlistindex], textlen);
-			numfiles++;
-			numchars += (int)textlen;
+			search = FS_CopySearch(cache->search, cache->size);
+			if (fs_mutex) Thread_UnlockMutex(fs_mutex);
+			return search;
 		}
 	}
-	stringlistfreecontents(&resultlist);
 
-	Mem_Free(basepath);
+	search = FS_DoSearch(pattern, caseinsensitive, quiet, &size);
+
+	if (strlen(pattern) < sizeof(cache->pattern))
+	{
+		cache = &fs_searchcache[fs_searchcache_next];
+		fs_searchcache_next = (fs_searchcache_next + 1) % FS_SEARCHCACHE_SIZE;
+		if (cache->search)
+			Z_Free(cache->search);
+		strlcpy(cache->pattern, pattern, sizeof(cache->pattern));
+		cache->caseinsensitive = caseinsensitive;
+		cache->framecount = host_framecount;
+		cache->generation = fs_search_generation;
+		cache->search = FS_CopySearch(search, size);
+		cache->size = size;
+	}
+	if (fs_mutex) Thread_UnlockMutex(fs_mutex);
 	return search;
 }
 
@@ -3833,137 +5686,651 @@ static void FS_ListDirectoryCmd (const char* cmdname, int oneperline)
 		Con_Printf("usage:\n%s [path/pattern]\n", cmdname);
 		return;
 	}
-	if (Cmd_Argc() == 2)
-		pattern = Cmd_Argv(1);
-	else
-		pattern = "*";
-	if (!FS_ListDirectory(pattern, oneperline))
-		Con_Print("No files found.\n");
+	if (Cmd_Argc() == 2)
+		pattern = Cmd_Argv(1);
+	else
+		pattern = "*";
+	if (!FS_ListDirectory(pattern, oneperline))
+		Con_Print("No files found.\n");
+}
+
+void FS_Dir_f(void)
+{
+	FS_ListDirectoryCmd("dir", true);
+}
+
+void FS_Ls_f(void)
+{
+	FS_ListDirectoryCmd("ls", false);
+}
+
+void FS_Which_f(void)
+{
+	const char *filename;
+	int index;
+	searchpath_t *sp;
+	if (Cmd_Argc() != 2)
+	{
+		Con_Printf("usage:\n%s <file>\n", Cmd_Argv(0));
+		return;
+	}  
+	filename = Cmd_Argv(1);
+	sp = FS_FindFile(filename, &index, true);
+	if (!sp) {
+		Con_Printf("%s isn't anywhere\n", filename);
+		return;
+	}
+	if (sp->pack)
+	{
+		if(sp->pack->vpack)
+			Con_Printf("%s is in virtual package %sdir\n", filename, sp->pack->shortname);
+		else
+			Con_Printf("%s is in package %s\n", filename, sp->pack->shortname);
+	}
+	else
+		Con_Printf("%s is file %s%s\n", filename, sp->filename, filename);
+}
+
+
+const char *FS_WhichPack(const char *filename)
+{
+	int index;
+	searchpath_t *sp = FS_FindFile(filename, &index, true);
+	if(sp && sp->pack)
+		return sp->pack->shortname;
+	else if(sp)
+		return "";
+	else
+		return 0;
+}
+
+/*
+====================
+FS_IsRegisteredQuakePack
+
+Look for a proof of purchase file file in the requested package
+
+If it is found, this file should NOT be downloaded.
+====================
+*/
+qboolean FS_IsRegisteredQuakePack(const char *name)
+{
+	searchpath_t *search;
+	pack_t *pak;
+
+	// search through the path, one element at a time
+	for (search = fs_searchpaths;search;search = search->next)
+	{
+		if (search->pack && !search->pack->vpack && !strcasecmp(FS_FileWithoutPath(search->filename), name))
+			// TODO do we want to support vpacks in here too?
+		{
+			int (*strcmp_funct) (const char* str1, const char* str2);
+			int left, right, middle;
+
+			pak = search->pack;
+			strcmp_funct = pak->ignorecase ? strcasecmp : strcmp;
+
+			// Look for the file (binary search)
+			left = 0;
+			right = pak->numfiles - 1;
+			while (left <= right)
+			{
+				int diff;
+
+				middle = (left + right) / 2;
+				diff = strcmp_funct (pak->files[middle].name, "gfx/pop.lmp");
+
+				// Found it
+				if (!diff)
+					return true;
+
+				// If we're too far in the list
+				if (diff > 0)
+					right = middle - 1;
+				else
+					left = middle + 1;
+			}
+
+			// we found the requested pack but it is not registered quake
+			return false;
+		}
+	}
+
+	return false;
+}
+
+/*
+=============================================================================
+
+CHECKSUMS
+
+Files are checksummed in FS_CRC_CHUNKSIZE pieces so big files never have to
+fit in memory, and the results are remembered by the real location of the
+file along with the size and modification time of the file or the pack
+containing it, so an unchanged file is only read once.
+=============================================================================
+*/
+
+#define FS_CRC_CHUNKSIZE 65536
+#define FS_CRCCACHE_HASHSIZE 256
+
+typedef struct fs_crccacheentry_s
+{
+	char key[MAX_OSPATH];
+	long long filesize;
+	long long filemtime;
+	size_t realsize;
+	int crc;
+	struct fs_crccacheentry_s *next;
+}
+fs_crccacheentry_t;
+
+static fs_crccacheentry_t *fs_crccache[FS_CRCCACHE_HASHSIZE];
+
+/*
+============
+FS_CRCOpenedFile
+
+Checksums a whole opened file from the start, reading it in chunks
+============
+*/
+int FS_CRCOpenedFile (qfile_t *file, size_t *filesizepointer)
+{
+	unsigned char *buffer;
+	unsigned short crc;
+	fs_offset_t count;
+	size_t total = 0;
+
+	if (FS_Seek(file, 0, SEEK_SET))
+		return -1;
+	buffer = (unsigned char *)Mem_Alloc(tempmempool, FS_CRC_CHUNKSIZE);
+	CRC_Init(&crc);
+	while ((count = FS_Read(file, buffer, FS_CRC_CHUNKSIZE)) > 0)
+	{
+		CRC_ProcessBlock(&crc, buffer, count);
+		total += count;
+	}
+	Mem_Free(buffer);
+	if (filesizepointer)
+		*filesizepointer = total;
+	return CRC_Value(crc);
+}
+
+/*
+============
+FS_CRCCache_Key
+
+Finds where filename comes from and fills in the cache key for it, a file
+from a directory is opened to get its size and time, the caller has to
+close it.  Returns false if the result can't be cached.
+============
+*/
+static qboolean FS_CRCCache_Key (const char *filename, char *key, size_t keysize, long long *filesize, long long *filemtime, qfile_t **file)
+{
+	searchpath_t *search;
+	int pack_ind;
+	qboolean ok = false;
+
+	*file = NULL;
+	if (fs_mutex) Thread_LockMutex(fs_mutex);
+	search = FS_FindFile(filename, &pack_ind, true);
+	if (search && pack_ind >= 0)
+	{
+		// symlinks are resolved by FS_OpenVirtualFile, don't bother
+		if (!(search->pack->files[pack_ind].flags & PACKFILE_FLAG_SYMLINK))
+		{
+			dpsnprintf(key, keysize, "%s/%s", search->pack->filename, search->pack->files[pack_ind].name);
+			ok = FS_SysFileStat(search->pack->handle, filesize, filemtime);
+		}
+	}
+	else if (search)
+	{
+		dpsnprintf(key, keysize, "%s%s", search->filename, filename);
+		*file = FS_SysOpen(key, "rb", false);
+		ok = *file && FS_SysFileStat((*file)->handle, filesize, filemtime);
+	}
+	if (fs_mutex) Thread_UnlockMutex(fs_mutex);
+	return ok;
+}
+
+/*
+============
+FS_CRCFile
+
+Checksum of a file from the search path, -1 if it doesn't exist
+============
+*/
+int FS_CRCFile(const char *filename, size_t *filesizepointer)
+{
+	int crc = -1;
+	char key[MAX_OSPATH];
+	long long filesize = 0, filemtime = 0;
+	size_t realsize = 0;
+	unsigned int hashindex = 0;
+	qboolean cacheable;
+	qfile_t *file;
+	fs_crccacheentry_t *entry;
+
+	if (filesizepointer)
+		*filesizepointer = 0;
+	if (!filename || !*filename || FS_CheckNastyPath(filename, false))
+		return crc;
+
+	cacheable = FS_CRCCache_Key(filename, key, sizeof(key), &filesize, &filemtime, &file);
+	if (cacheable)
+	{
+		hashindex = CRC_Block((const unsigned char *)key, strlen(key)) % FS_CRCCACHE_HASHSIZE;
+		if (fs_mutex) Thread_LockMutex(fs_mutex);
+		for (entry = fs_crccache[hashindex];entry;entry = entry->next)
+		{
+			if (!strcmp(entry->key, key) && entry->filesize == filesize && entry->filemtime == filemtime)
+			{
+				crc = entry->crc;
+				realsize = entry->realsize;
+				break;
+			}
+		}
+		if (fs_mutex) Thread_UnlockMutex(fs_mutex);
+		if (entry)
+		{
+			if (file)
+				FS_Close(file);
+			if (filesizepointer)
+				*filesizepointer = realsize;
+			return crc;
+		}
+	}
+
+	if (!file)
+		file = FS_OpenVirtualFile(filename, true);
+	if (!file)
+		return crc;
+	crc = FS_CRCOpenedFile(file, &realsize);
+	FS_Close(file);
+	if (filesizepointer)
+		*filesizepointer = realsize;
+
+	if (cacheable && crc != -1)
+	{
+		if (fs_mutex) Thread_LockMutex(fs_mutex);
+		for (entry = fs_crccache[hashindex];entry;entry = entry->next)
+			if (!strcmp(entry->key, key))
+				break;
+		if (!entry)
+		{
+			entry = (fs_crccacheentry_t *)Mem_Alloc(fs_mempool, sizeof(*entry));
+			strlcpy(entry->key, key, sizeof(entry->key));
+			entry->next = fs_crccache[hashindex];
+			fs_crccache[hashindex] = entry;
+		}
+		entry->filesize = filesize;
+		entry->filemtime = filemtime;
+		entry->realsize = realsize;
+		entry->crc = crc;
+		if (fs_mutex) Thread_UnlockMutex(fs_mutex);
+	}
+	return crc;
+}
+
+/*
+=============================================================================
+
+CONTENT KEYS
+
+Packs often carry the same file under several names, or several versions of
+a pack are installed at once.  FS_FileContentKey gives such files the same
+key so resource caches can load them once.  Pack entries are grouped by the
+CRC32 and size from the zip central directory, only when a cache finds two
+loaded files in the same group are their contents hashed to confirm the
+match, and that hash is kept in the pk3 cache.
+=============================================================================
+*/
+
+typedef struct fs_contententry_s
+{
+	unsigned int crc32;
+	int count;
+	fs_offset_t realsize;
+	int next;
+}
+fs_contententry_t;
+
+static fs_contententry_t *fs_content_entries = NULL;
+static int *fs_content_hash = NULL;
+static int fs_content_hashsize = 0;
+static int fs_content_numentries = 0;
+static qboolean fs_content_valid = false;
+
+static const uint8_t fs_content_hashkey[16] = {'D', 'P', 'c', 'o', 'n', 't', 'e', 'n', 't', 'h', 'a', 's', 'h', 0, 0, 1};
+
+static void FS_Content_Free (void)
+{
+	if (fs_content_entries)
+		Mem_Free(fs_content_entries);
+	if (fs_content_hash)
+		Mem_Free(fs_content_hash);
+	fs_content_entries = NULL;
+	fs_content_hash = NULL;
+	fs_content_hashsize = 0;
+	fs_content_numentries = 0;
+	fs_content_valid = false;
+}
+
+static int FS_Content_Find (unsigned int crc32, fs_offset_t realsize)
+{
+	int i;
+	for (i = fs_content_hash[(crc32 ^ (unsigned int)realsize) & (fs_content_hashsize - 1)];i >= 0;i = fs_content_entries[i].next)
+		if (fs_content_entries[i].crc32 == crc32 && fs_content_entries[i].realsize == realsize)
+			return i;
+	return -1;
+}
+
+/*
+============
+FS_Content_Build
+
+Counts how many pack entries there are for each CRC32 and size
+============
+*/
+static void FS_Content_Build (void)
+{
+	searchpath_t *search;
+	int i, j, total = 0;
+
+	for (search = fs_searchpaths;search;search = search->next)
+		if (search->pack)
+			total += search->pack->numfiles;
+	for (fs_content_hashsize = 64;fs_content_hashsize < total * 2;fs_content_hashsize *= 2)
+		;
+	fs_content_hash = (int *)Mem_Alloc(fs_mempool, fs_content_hashsize * sizeof(int));
+	fs_content_entries = (fs_contententry_t *)Mem_Alloc(fs_mempool, max(total, 1) * sizeof(fs_contententry_t));
+	for (i = 0;i < fs_content_hashsize;i++)
+		fs_content_hash[i] = -1;
+
+	for (search = fs_searchpaths;search;search = search->next)
+	{
+		if (!search->pack)
+			continue;
+		for (j = 0;j < search->pack->numfiles;j++)
+		{
+			packfile_t *pfile = &search->pack->files[j];
+			if (!pfile->crc32 || pfile->realsize <= 0 || (pfile->flags & PACKFILE_FLAG_SYMLINK))
+				continue;
+			i = FS_Content_Find(pfile->crc32, pfile->realsize);
+			if (i < 0)
+			{
+				int *bucket = &fs_content_hash[(pfile->crc32 ^ (unsigned int)pfile->realsize) & (fs_content_hashsize - 1)];
+				i = fs_content_numentries++;
+				fs_content_entries[i].crc32 = pfile->crc32;
+				fs_content_entries[i].realsize = pfile->realsize;
+				fs_content_entries[i].count = 0;
+				fs_content_entries[i].next = *bucket;
+				*bucket = i;
+			}
+			fs_content_entries[i].count++;
+		}
+	}
+	fs_content_valid = true;
 }
 
-void FS_Dir_f(void)
+static unsigned long long FS_Content_HashFile (qfile_t *file)
 {
-	FS_ListDirectoryCmd("dir", true);
-}
+	unsigned char *buffer;
+	unsigned long long h = 0;
+	uint64_t piece;
+	fs_offset_t count, total = 0;
 
-void FS_Ls_f(void)
-{
-	FS_ListDirectoryCmd("ls", false);
+	buffer = (unsigned char *)Mem_Alloc(tempmempool, FS_CRC_CHUNKSIZE);
+	while ((count = FS_Read(file, buffer, FS_CRC_CHUNKSIZE)) > 0)
+	{
+		siphash(&piece, buffer, count, fs_content_hashkey);
+		h = (h ^ piece) * 0x100000001b3ULL;
+		total += count;
+	}
+	Mem_Free(buffer);
+	if (total != file->real_length)
+		return 0;
+	// 0 means not computed yet
+	return h ? h : 1;
 }
 
-void FS_Which_f(void)
+/*
+============
+FS_Content_GetHash
+
+Returns the content hash of a pack entry, hashing it if that was not done
+yet, or 0 if the file is not in a pack or can't be read
+============
+*/
+static unsigned long long FS_Content_GetHash (const char *filename)
 {
-	const char *filename;
-	int index;
-	searchpath_t *sp;
-	if (Cmd_Argc() != 2)
+	searchpath_t *search;
+	pack_t *pack = NULL;
+	qfile_t *file = NULL;
+	int pack_ind, i;
+	unsigned long long h = 0;
+
+	if (fs_mutex) Thread_LockMutex(fs_mutex);
+	search = FS_FindFile(filename, &pack_ind, true);
+	if (search && pack_ind >= 0)
 	{
-		Con_Printf("usage:\n%s <file>\n", Cmd_Argv(0));
-		return;
-	}  
-	filename = Cmd_Argv(1);
-	sp = FS_FindFile(filename, &index, true);
-	if (!sp) {
-		Con_Printf("%s isn't anywhere\n", filename);
-		return;
+		pack = search->pack;
+		h = pack->files[pack_ind].contenthash;
+		if (!h)
+			file = FS_OpenPackedFile(pack, pack_ind);
 	}
-	if (sp->pack)
+	if (fs_mutex) Thread_UnlockMutex(fs_mutex);
+	if (!file)
+		return h;
+
+	// the file has its own handle, so read it without blocking the I/O threads
+	h = FS_Content_HashFile(file);
+	FS_Close(file);
+	if (!h)
+		return 0;
+
+	if (fs_mutex) Thread_LockMutex(fs_mutex);
+	// the search path may have changed meanwhile
+	search = FS_FindFile(filename, &i, true);
+	if (search && search->pack == pack && i == pack_ind && !pack->files[pack_ind].contenthash)
 	{
-		if(sp->pack->vpack)
-			Con_Printf("%s is in virtual package %sdir\n", filename, sp->pack->shortname);
-		else
-			Con_Printf("%s is in package %s\n", filename, sp->pack->shortname);
+		pack->files[pack_ind].contenthash = h;
+		if (pack->filemtime)
+			fs_pk3cache.dirty = true;
 	}
-	else
-		Con_Printf("%s is file %s%s\n", filename, sp->filename, filename);
+	if (fs_mutex) Thread_UnlockMutex(fs_mutex);
+	return h;
 }
 
+/*
+============
+FS_FileContentKey
 
-const char *FS_WhichPack(const char *filename)
+Fills in a key that is the same for all pack entries that may have the same
+contents, returns false if the file has no possible copy in another place
+(or is not in a pack) so there is nothing to share.  Nothing is read, use
+FS_FileContentEqual to confirm two files with the same key match.
+============
+*/
+qboolean FS_FileContentKey (const char *filename, char *key, size_t keysize)
 {
-	int index;
-	searchpath_t *sp = FS_FindFile(filename, &index, true);
-	if(sp && sp->pack)
-		return sp->pack->shortname;
-	else if(sp)
-		return "";
-	else
-		return 0;
+	searchpath_t *search;
+	packfile_t *pfile;
+	int pack_ind, i;
+	qboolean ok = false;
+
+	if (!filename || !*filename || FS_CheckNastyPath(filename, false))
+		return false;
+	if (fs_mutex) Thread_LockMutex(fs_mutex);
+	search = FS_FindFile(filename, &pack_ind, true);
+	if (search && pack_ind >= 0)
+	{
+		pfile = &search->pack->files[pack_ind];
+		if (!fs_content_valid)
+			FS_Content_Build();
+		if (pfile->crc32 && pfile->realsize > 0 && !(pfile->flags & PACKFILE_FLAG_SYMLINK)
+		 && (i = FS_Content_Find(pfile->crc32, pfile->realsize)) >= 0 && fs_content_entries[i].count > 1)
+		{
+			dpsnprintf(key, keysize, "%08x-%llx", pfile->crc32, (unsigned long long)pfile->realsize);
+			ok = true;
+		}
+	}
+	if (fs_mutex) Thread_UnlockMutex(fs_mutex);
+	return ok;
 }
 
 /*
-====================
-FS_IsRegisteredQuakePack
-
-Look for a proof of purchase file file in the requested package
+============
+FS_FileContentEqual
 
-If it is found, this file should NOT be downloaded.
-====================
+Compares the content hashes of two files with the same FS_FileContentKey,
+the hashes are computed on first use and kept in the pk3 cache
+============
 */
-qboolean FS_IsRegisteredQuakePack(const char *name)
+qboolean FS_FileContentEqual (const char *filename1, const char *filename2)
 {
-	searchpath_t *search;
-	pack_t *pak;
+	unsigned long long h;
 
-	// search through the path, one element at a time
-	for (search = fs_searchpaths;search;search = search->next)
-	{
-		if (search->pack && !search->pack->vpack && !strcasecmp(FS_FileWithoutPath(search->filename), name))
-			// TODO do we want to support vpacks in here too?
-		{
-			int (*strcmp_funct) (const char* str1, const char* str2);
-			int left, right, middle;
+	if (FS_CheckNastyPath(filename1, false) || FS_CheckNastyPath(filename2, false))
+		return false;
+	h = FS_Content_GetHash(filename1);
+	return h && h == FS_Content_GetHash(filename2);
+}
 
-			pak = search->pack;
-			strcmp_funct = pak->ignorecase ? strcasecmp : strcmp;
+/*
+=============================================================================
 
-			// Look for the file (binary search)
-			left = 0;
-			right = pak->numfiles - 1;
-			while (left <= right)
-			{
-				int diff;
+DEFLATE AND INFLATE
 
-				middle = (left + right) / 2;
-				diff = strcmp_funct (pak->files[middle].name, "gfx/pop.lmp");
+Big buffers are deflated in FS_DEFLATE_CHUNKSIZE pieces on several threads
+the way pigz does it: every piece is primed with the 32KB before it and
+ends on a sync flush, so the pieces simply concatenate into one raw
+deflate stream any inflater can read.  Inflating is done as a stream so
+data can be inflated while it is still arriving.
+=============================================================================
+*/
 
-				// Found it
-				if (!diff)
-					return true;
+#define FS_DEFLATE_CHUNKSIZE (256 * 1024)
+#define FS_DEFLATE_DICTSIZE 32768
+#define FS_DEFLATE_MAXTHREADS 8
 
-				// If we're too far in the list
-				if (diff > 0)
-					right = middle - 1;
-				else
-					left = middle + 1;
-			}
+typedef struct fs_deflatejob_s
+{
+	const unsigned char *data;
+	size_t size;
+	int level;
+	int numchunks;
+	int nextchunk;
+	void *mutex;
+	unsigned char **chunkdata;
+	size_t *chunksize;	///< 0 if the chunk failed
+}
+fs_deflatejob_t;
 
-			// we found the requested pack but it is not registered quake
-			return false;
-		}
+static void FS_Deflate_Chunk (fs_deflatejob_t *job, int chunk)
+{
+	z_stream strm;
+	size_t start = (size_t)chunk * FS_DEFLATE_CHUNKSIZE;
+	size_t length = min(job->size - start, FS_DEFLATE_CHUNKSIZE);
+	qboolean last = chunk == job->numchunks - 1;
+	size_t outsize;
+
+	job->chunkdata[chunk] = NULL;
+	job->chunksize[chunk] = 0;
+	memset(&strm, 0, sizeof(strm));
+	if (deflateInit2(&strm, job->level, Z_DEFLATED, -MAX_WBITS, Z_MEMLEVEL_DEFAULT, Z_BINARY) != Z_OK)
+		return;
+	if (start)
+	{
+		size_t dictsize = min(start, FS_DEFLATE_DICTSIZE);
+		deflateSetDictionary(&strm, job->data + start - dictsize, (unsigned int)dictsize);
 	}
+	// room for the sync flush marker too
+	outsize = deflateBound(&strm, (uLong)length) + 16;
+	job->chunkdata[chunk] = (unsigned char *)Mem_Alloc(tempmempool, outsize);
+	strm.next_in = (unsigned char *)job->data + start;
+	strm.avail_in = (unsigned int)length;
+	strm.next_out = job->chunkdata[chunk];
+	strm.avail_out = (unsigned int)outsize;
+	if (deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH) == (last ? Z_STREAM_END : Z_OK) && !strm.avail_in)
+		job->chunksize[chunk] = strm.total_out;
+	deflateEnd(&strm);
+}
 
-	return false;
+static int FS_Deflate_Thread (void *data)
+{
+	fs_deflatejob_t *job = (fs_deflatejob_t *)data;
+	int chunk;
+	for (;;)
+	{
+		Thread_LockMutex(job->mutex);
+		chunk = job->nextchunk++;
+		Thread_UnlockMutex(job->mutex);
+		if (chunk >= job->numchunks)
+			break;
+		FS_Deflate_Chunk(job, chunk);
+	}
+	return 0;
 }
 
-int FS_CRCFile(const char *filename, size_t *filesizepointer)
+/*
+============
+FS_DeflateParallel
+
+Deflates data in chunks on up to numthreads threads (the calling thread
+included), returns NULL if any chunk failed
+============
+*/
+static unsigned char *FS_DeflateParallel(const unsigned char *data, size_t size, size_t *deflated_size, int level, int numthreads, mempool_t *mempool)
 {
-	int crc = -1;
-	unsigned char *filedata;
-	fs_offset_t filesize;
-	if (filesizepointer)
-		*filesizepointer = 0;
-	if (!filename || !*filename)
-		return crc;
-	filedata = FS_LoadFile(filename, tempmempool, true, &filesize);
-	if (filedata)
+	fs_deflatejob_t job;
+	void *threads[FS_DEFLATE_MAXTHREADS];
+	unsigned char *out = NULL;
+	size_t total = 0;
+	int i;
+
+	memset(&job, 0, sizeof(job));
+	job.data = data;
+	job.size = size;
+	job.level = level;
+	job.numchunks = (int)((size + FS_DEFLATE_CHUNKSIZE - 1) / FS_DEFLATE_CHUNKSIZE);
+	job.chunkdata = (unsigned char **)Mem_Alloc(tempmempool, job.numchunks * sizeof(*job.chunkdata));
+	job.chunksize = (size_t *)Mem_Alloc(tempmempool, job.numchunks * sizeof(*job.chunksize));
+	job.mutex = Thread_CreateMutex();
+	numthreads = min(numthreads, job.numchunks);
+	for (i = 1;i < numthreads;i++)
+		threads[i] = Thread_CreateThread(FS_Deflate_Thread, &job);
+	FS_Deflate_Thread(&job);
+	for (i = 1;i < numthreads;i++)
+		Thread_WaitThread(threads[i], 0);
+	Thread_DestroyMutex(job.mutex);
+
+	for (i = 0;i < job.numchunks;i++)
 	{
-		if (filesizepointer)
-			*filesizepointer = filesize;
-		crc = CRC_Block(filedata, filesize);
-		Mem_Free(filedata);
+		if (!job.chunksize[i])
+			break;
+		total += job.chunksize[i];
 	}
-	return crc;
+	if (i == job.numchunks && total < size)
+	{
+		out = (unsigned char *)Mem_Alloc(mempool, total);
+		for (total = 0, i = 0;i < job.numchunks;i++)
+		{
+			memcpy(out + total, job.chunkdata[i], job.chunksize[i]);
+			total += job.chunksize[i];
+		}
+		*deflated_size = total;
+	}
+	else if (i == job.numchunks)
+		Con_DPrintf("FS_Deflate: deflate is useless on this data!\n");
+	else
+		Con_Printf("FS_Deflate: deflate failed!\n");
+	for (i = 0;i < job.numchunks;i++)
+		if (job.chunkdata[i])
+			Mem_Free(job.chunkdata[i]);
+	Mem_Free(job.chunkdata);
+	Mem_Free(job.chunksize);
+	return out;
 }
 
 unsigned char *FS_Deflate(const unsigned char *data, size_t size, size_t *deflated_size, int level, mempool_t *mempool)
@@ -3971,16 +6338,22 @@ unsigned char *FS_Deflate(const unsigned char *data, size_t size, size_t *deflat
 	z_stream strm;
 	unsigned char *out = NULL;
 	unsigned char *tmp;
+	int numthreads;
 
 	*deflated_size = 0;
+
+	if(level < 0)
+		level = Z_DEFAULT_COMPRESSION;
+
+	numthreads = Thread_HasThreads() ? bound(1, fs_deflate_threads.integer, FS_DEFLATE_MAXTHREADS) : 1;
+	if (numthreads > 1 && size > FS_DEFLATE_CHUNKSIZE * 2)
+		return FS_DeflateParallel(data, size, deflated_size, level, numthreads, mempool);
+
 	memset(&strm, 0, sizeof(strm));
 	strm.zalloc = Z_NULL;
 	strm.zfree = Z_NULL;
 	strm.opaque = Z_NULL;
 
-	if(level < 0)
-		level = Z_DEFAULT_COMPRESSION;
-
 	if(deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, Z_MEMLEVEL_DEFAULT, Z_BINARY) != Z_OK)
 	{
 		Con_Printf("FS_Deflate: deflate init error!\n");
@@ -4018,7 +6391,7 @@ unsigned char *FS_Deflate(const unsigned char *data, size_t size, size_t *deflat
 
 	if(strm.total_out >= size)
 	{
-		Con_Printf("FS_Deflate: deflate is useless on this data!\n");
+		Con_DPrintf("FS_Deflate: deflate is useless on this data!\n");
 		Mem_Free(tmp);
 		return NULL;
 	}
@@ -4039,110 +6412,200 @@ unsigned char *FS_Deflate(const unsigned char *data, size_t size, size_t *deflat
 	return out;
 }
 
-static void AssertBufsize(sizebuf_t *buf, int length)
-{
-	if(buf->cursize + length > buf->maxsize)
-	{
-		int oldsize = buf->maxsize;
-		unsigned char *olddata;
-		olddata = buf->data;
-		buf->maxsize += length;
-		buf->data = (unsigned char *) Mem_Alloc(tempmempool, buf->maxsize);
-		if(olddata)
-		{
-			memcpy(buf->data, olddata, oldsize);
-			Mem_Free(olddata);
-		}
-	}
-}
-
-unsigned char *FS_Inflate(const unsigned char *data, size_t size, size_t *inflated_size, mempool_t *mempool)
+struct fs_inflatestream_s
 {
-	int ret;
 	z_stream strm;
-	unsigned char *out = NULL;
-	unsigned char tmp[2048];
-	unsigned int have;
-	sizebuf_t outbuf;
+	mempool_t *mempool;
+	unsigned char *out;
+	size_t outsize;		///< allocated size of out
+	size_t outlen;		///< inflated so far
+	qboolean checksum;
+	unsigned short crc;	///< of the inflated data, if checksum is set
+	size_t maxsize;		///< inflating more than this fails, 0 for no limit
+	qboolean finished;	///< the end of the deflate stream was reached
+	qboolean failed;
+};
 
-	*inflated_size = 0;
-	memset(&outbuf, 0, sizeof(outbuf));
-	outbuf.data = (unsigned char *) Mem_Alloc(tempmempool, sizeof(tmp));
-	outbuf.maxsize = sizeof(tmp);
+/*
+============
+FS_InflateStream_Begin
 
-	memset(&strm, 0, sizeof(strm));
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
+Starts inflating a raw deflate stream that is passed in pieces to
+FS_InflateStream_Feed, sizehint is the expected inflated size if known
+============
+*/
+fs_inflatestream_t *FS_InflateStream_Begin(size_t sizehint, qboolean checksum, mempool_t *mempool)
+{
+	fs_inflatestream_t *stream;
 
-	if(inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+	stream = (fs_inflatestream_t *)Mem_Alloc(fs_mempool, sizeof(*stream));
+	if(inflateInit2(&stream->strm, -MAX_WBITS) != Z_OK)
 	{
 		Con_Printf("FS_Inflate: inflate init error!\n");
-		Mem_Free(outbuf.data);
+		Mem_Free(stream);
 		return NULL;
 	}
+	stream->mempool = mempool;
+	stream->outsize = max(sizehint, 16384);
+	stream->out = (unsigned char *)Mem_Alloc(mempool, stream->outsize);
+	stream->checksum = checksum;
+	CRC_Init(&stream->crc);
+	return stream;
+}
 
-	strm.next_in = (unsigned char*)data;
-	strm.avail_in = (unsigned int)size;
+/*
+============
+FS_InflateStream_Feed
+
+Inflates the next piece of the stream, returns false once the data turned
+out to be corrupt
+============
+*/
+qboolean FS_InflateStream_Feed(fs_inflatestream_t *stream, const unsigned char *data, size_t size)
+{
+	int ret;
+	size_t start = stream->outlen, limit;
+	unsigned char extra;
 
-	do
+	if (stream->failed)
+		return false;
+	stream->strm.next_in = (unsigned char *)data;
+	stream->strm.avail_in = (unsigned int)size;
+	while (!stream->finished)
 	{
-		strm.next_out = tmp;
-		strm.avail_out = sizeof(tmp);
-		ret = inflate(&strm, Z_NO_FLUSH);
-		// it either returns Z_OK on progress, Z_STREAM_END on end
-		// or an error code
-		switch(ret)
+		limit = stream->maxsize ? min(stream->outsize, stream->maxsize) : stream->outsize;
+		if (stream->outlen == limit && limit == stream->maxsize)
 		{
-			case Z_STREAM_END:
-			case Z_OK:
-				break;
-				
-			case Z_STREAM_ERROR:
-				Con_Print("FS_Inflate: stream error!\n");
-				break;
-			case Z_DATA_ERROR:
-				Con_Print("FS_Inflate: data error!\n");
-				break;
-			case Z_MEM_ERROR:
-				Con_Print("FS_Inflate: mem error!\n");
-				break;
-			case Z_BUF_ERROR:
-				Con_Print("FS_Inflate: buf error!\n");
-				break;
-			default:
-				Con_Print("FS_Inflate: unknown error!\n");
+			// full, only the end of the stream may follow
+			stream->strm.next_out = &extra;
+			stream->strm.avail_out = 1;
+			ret = inflate(&stream->strm, Z_NO_FLUSH);
+			if (stream->strm.avail_out && ret == Z_STREAM_END)
+				stream->finished = true;
+			else if (stream->strm.avail_out && ret == Z_BUF_ERROR && !stream->strm.avail_in)
+				break; // needs more input
+			else if (!stream->strm.avail_out || ret != Z_OK)
+			{
+				Con_Printf("FS_Inflate: inflated data exceeds %lu bytes\n", (unsigned long)stream->maxsize);
+				stream->failed = true;
+				return false;
+			}
+			else if (!stream->strm.avail_in)
 				break;
-				
+			continue;
 		}
-		if(ret != Z_OK && ret != Z_STREAM_END)
+		if (stream->outlen == limit)
 		{
-			Con_Printf("Error after inflating %u bytes\n", (unsigned)strm.total_in);
-			Mem_Free(outbuf.data);
-			inflateEnd(&strm);
-			return NULL;
+			stream->outsize *= 2;
+			if (stream->maxsize)
+				stream->outsize = min(stream->outsize, stream->maxsize);
+			stream->out = (unsigned char *)Mem_Realloc(stream->mempool, stream->out, stream->outsize);
+			limit = stream->outsize;
+		}
+		stream->strm.next_out = stream->out + stream->outlen;
+		stream->strm.avail_out = (unsigned int)(limit - stream->outlen);
+		ret = inflate(&stream->strm, Z_NO_FLUSH);
+		stream->outlen = limit - stream->strm.avail_out;
+		if (ret == Z_STREAM_END)
+			stream->finished = true;
+		else if (ret == Z_BUF_ERROR && !stream->strm.avail_in && stream->strm.avail_out)
+			break; // needs more input
+		else if (ret != Z_OK)
+		{
+			switch(ret)
+			{
+				case Z_STREAM_ERROR:
+					Con_Print("FS_Inflate: stream error!\n");
+					break;
+				case Z_DATA_ERROR:
+					Con_Print("FS_Inflate: data error!\n");
+					break;
+				case Z_MEM_ERROR:
+					Con_Print("FS_Inflate: mem error!\n");
+					break;
+				case Z_BUF_ERROR:
+					Con_Print("FS_Inflate: buf error!\n");
+					break;
+				default:
+					Con_Print("FS_Inflate: unknown error!\n");
+					break;
+			}
+			Con_Printf("Error after inflating %u bytes\n", (unsigned)stream->strm.total_in);
+			stream->failed = true;
+			return false;
 		}
-		have = sizeof(tmp) - strm.avail_out;
-		AssertBufsize(&outbuf, max(have, sizeof(tmp)));
-		SZ_Write(&outbuf, tmp, have);
-	} while(ret != Z_STREAM_END);
+		else if (!stream->strm.avail_in && stream->strm.avail_out)
+			break;
+	}
+	if (stream->checksum)
+		CRC_ProcessBlock(&stream->crc, stream->out + start, stream->outlen - start);
+	return true;
+}
 
-	inflateEnd(&strm);
+/*
+============
+FS_InflateStream_SetLimit
 
-	out = (unsigned char *) Mem_Alloc(mempool, outbuf.cursize);
-	if(!out)
+Makes the stream fail as soon as it would inflate more than maxsize bytes,
+for data from an untrusted source
+============
+*/
+void FS_InflateStream_SetLimit(fs_inflatestream_t *stream, size_t maxsize)
+{
+	stream->maxsize = maxsize;
+}
+
+/*
+============
+FS_InflateStream_End
+
+Returns the inflated data or NULL if the stream was corrupt or incomplete,
+the stream is freed
+============
+*/
+unsigned char *FS_InflateStream_End(fs_inflatestream_t *stream, size_t *inflated_size, int *crcpointer)
+{
+	unsigned char *out = NULL;
+
+	*inflated_size = 0;
+	if (!stream->failed && !stream->finished)
 	{
-		Con_Printf("FS_Inflate: not enough memory in target mempool!\n");
-		Mem_Free(outbuf.data);
-		return NULL;
+		Con_Print("FS_Inflate: buf error!\n");
+		Con_Printf("Error after inflating %u bytes\n", (unsigned)stream->strm.total_in);
+	}
+	else if (stream->finished)
+	{
+		// give back the unused part of the buffer
+		out = stream->outlen == stream->outsize ? stream->out : (unsigned char *)Mem_Realloc(stream->mempool, stream->out, max(stream->outlen, 1));
+		stream->out = NULL;
+		*inflated_size = stream->outlen;
+		if (crcpointer)
+			*crcpointer = CRC_Value(stream->crc);
 	}
+	inflateEnd(&stream->strm);
+	if (stream->out)
+		Mem_Free(stream->out);
+	Mem_Free(stream);
+	return out;
+}
+
+void FS_InflateStream_Abort(fs_inflatestream_t *stream)
+{
+	inflateEnd(&stream->strm);
+	Mem_Free(stream->out);
+	Mem_Free(stream);
+}
 
-	memcpy(out, outbuf.data, outbuf.cursize);
-	Mem_Free(outbuf.data);
+unsigned char *FS_Inflate(const unsigned char *data, size_t size, size_t *inflated_size, mempool_t *mempool)
+{
+	fs_inflatestream_t *stream;
 
-	*inflated_size = (size_t)outbuf.cursize;
-	
-	return out;
+	*inflated_size = 0;
+	stream = FS_InflateStream_Begin(size * 4, false, mempool);
+	if (!stream)
+		return NULL;
+	FS_InflateStream_Feed(stream, data, size);
+	return FS_InflateStream_End(stream, inflated_size, NULL);
 }
 
 #ifdef _WIN32
@@ -67,7 +67,7 @@ extern char fs_gamedirs[MAX_GAMEDIRS][MAX_QPATH];
 // ------ Main functions ------ //
 
 // IMPORTANT: the file path is automatically prefixed by the current game directory for
-// each file created by FS_WriteFile, or opened in "write" or "append" mode by FS_OpenRealFile
+// each file created by FS_WriteFile or FS_OpenRealFileAsync, or opened in "write" or "append" mode by FS_OpenRealFile
 
 qboolean FS_AddPack(const char *pakfile, qboolean *already_loaded, qboolean keep_plain_dirs); // already_loaded may be NULL if caller does not care
 const char *FS_WhichPack(const char *filename);
@@ -75,6 +75,7 @@ void FS_CreatePath (char *path);
 int FS_SysOpenFD(const char *filepath, const char *mode, qboolean nonblocking); // uses absolute path
 qfile_t* FS_SysOpen (const char* filepath, const char* mode, qboolean nonblocking); // uses absolute path
 qfile_t* FS_OpenRealFile (const char* filepath, const char* mode, qboolean quiet);
+qfile_t* FS_OpenRealFileAsync (const char* filepath, const char* mode, qboolean quiet); // mode "w" or "wb", written in the background on close
 qfile_t* FS_OpenVirtualFile (const char* filepath, qboolean quiet);
 qfile_t* FS_FileFromData (const unsigned char *data, const size_t size, qboolean quiet);
 int FS_Close (qfile_t* file);
@@ -110,6 +111,11 @@ extern int fs_all_gamedirs_count;
 qboolean FS_ChangeGameDirs(int numgamedirs, char gamedirs[][MAX_QPATH], qboolean complain, qboolean failmissing);
 qboolean FS_IsRegisteredQuakePack(const char *name);
 int FS_CRCFile(const char *filename, size_t *filesizepointer);
+int FS_CRCOpenedFile(qfile_t *file, size_t *filesizepointer);
+void FS_CRCFiles(int count, const char *const *filenames, int *crcs, size_t *filesizes);
+#define FS_CONTENTKEY_SIZE 32
+qboolean FS_FileContentKey(const char *filename, char *key, size_t keysize);
+qboolean FS_FileContentEqual(const char *filename1, const char *filename2);
 void FS_Rescan(void);
 
 typedef struct fssearch_s
@@ -126,6 +132,23 @@ void FS_FreeSearch(fssearch_t *search);
 
 unsigned char *FS_LoadFile (const char *path, mempool_t *pool, qboolean quiet, fs_offset_t *filesizepointer);
 unsigned char *FS_SysLoadFile (const char *path, mempool_t *pool, qboolean quiet, fs_offset_t *filesizepointer);
+
+/// read-only view of a whole file, see FS_MapFile
+typedef struct fs_mappedfile_s fs_mappedfile_t;
+const unsigned char *FS_MapFile (const char *path, qboolean quiet, fs_offset_t *filesizepointer, fs_mappedfile_t **mapping);
+void FS_UnmapFile (fs_mappedfile_t *mapping);
+
+/// asynchronous loading, see FS_LoadFileAsync
+typedef struct fs_asyncfile_s fs_asyncfile_t;
+typedef void (*fs_asynccallback_t) (const char *path, unsigned char *data, fs_offset_t filesize, void *userdata);
+fs_asyncfile_t *FS_LoadFileAsync (const char *path, mempool_t *pool, qboolean quiet, fs_asynccallback_t callback, void *userdata);
+unsigned char *FS_Async_Finish (fs_asyncfile_t *handle, fs_offset_t *filesizepointer);
+void FS_PrefetchFile (const char *path);
+void FS_Async_Frame (void);
+void FS_Async_Flush (void);
+void FS_Async_Shutdown (void);
+void FS_WriteQueue_Flush (void);
+
 qboolean FS_WriteFileInBlocks (const char *filename, const void *const *data, const fs_offset_t *len, size_t count);
 qboolean FS_WriteFile (const char *filename, const void *data, fs_offset_t len);
 
@@ -147,6 +170,14 @@ qboolean FS_SysFileExists (const char *filename);	// only look for files outside
 unsigned char *FS_Deflate(const unsigned char *data, size_t size, size_t *deflated_size, int level, mempool_t *mempool);
 unsigned char *FS_Inflate(const unsigned char *data, size_t size, size_t *inflated_size, mempool_t *mempool);
 
+/// streaming inflate, see FS_InflateStream_Begin
+typedef struct fs_inflatestream_s fs_inflatestream_t;
+fs_inflatestream_t *FS_InflateStream_Begin(size_t sizehint, qboolean checksum, mempool_t *mempool);
+void FS_InflateStream_SetLimit(fs_inflatestream_t *stream, size_t maxsize);
+qboolean FS_InflateStream_Feed(fs_inflatestream_t *stream, const unsigned char *data, size_t size);
+unsigned char *FS_InflateStream_End(fs_inflatestream_t *stream, size_t *inflated_size, int *crcpointer);
+void FS_InflateStream_Abort(fs_inflatestream_t *stream);
+
 void FS_Init_SelfPack(void);
 void FS_Init(void);
 void FS_Shutdown(void);
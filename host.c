@@ -312,7 +312,7 @@ static void Host_SaveConfig_to(const char *file)
 	// LordHavoc: don't save a config if it crashed in startup
 	if (host_framecount >= 3 && !COM_CheckParm("-benchmark") && !COM_CheckParm("-capturedemo"))
 	{
-		f = FS_OpenRealFile(file, "wb", false);
+		f = FS_OpenRealFileAsync(file, "wb", false);
 		if (!f)
 		{
 			Con_Printf("Couldn't write %s.\n", file);
@@ -644,6 +644,9 @@ void Host_ShutdownServer(void)
 	NetConn_Heartbeat(2);
 	NetConn_Heartbeat(2);
 
+	SV_CullTraces_StopThreads();
+	SV_MultiViewDemo_Stop();
+
 // make sure all the clients know we're disconnecting
 	World_End(&sv.world);
 	if(prog->loaded)
@@ -870,6 +873,7 @@ void Host_Main(void)
 
 		Curl_Run();
 		Net_File_Server_Frame();
+		FS_Async_Frame();
 
 		// check for commands typed to the host
 		Host_GetConsoleCommands();
@@ -1624,6 +1628,7 @@ void Host_Shutdown(void)
 		DP_Discord_Shutdown();
 	}
 	#endif
+	FS_Async_Shutdown();
 	Thread_Shutdown();
 	Cmd_Shutdown();
 	#ifndef CONFIG_SV
@@ -601,7 +601,7 @@ void Host_Savegame_to(prvm_prog_t *prog, const char *name)
 	isserver = prog == SVVM_prog;
 
 	Con_Printf("Saving game to %s...\n", name);
-	f = FS_OpenRealFile(name, "wb", false);
+	f = FS_OpenRealFileAsync(name, "wb", false);
 	if (!f)
 	{
 		Con_Print("ERROR: couldn't open.\n");
@@ -2400,6 +2400,7 @@ static void Host_Viewmodel_f (void)
 		if (m && m->loaded && m->Draw)
 		{
 			PRVM_serveredictfloat(e, frame) = 0;
+			PRVM_ED_MarkChanged(prog, e);
 			cl.model_precache[(int)PRVM_serveredictfloat(e, modelindex)] = m;
 		}
 		else
@@ -2432,6 +2433,7 @@ static void Host_Viewframe_f (void)
 			f = m->numframes-1;
 
 		PRVM_serveredictfloat(e, frame) = f;
+		PRVM_ED_MarkChanged(prog, e);
 	}
 }
 
@@ -2466,6 +2468,7 @@ static void Host_Viewnext_f (void)
 		PRVM_serveredictfloat(e, frame) = PRVM_serveredictfloat(e, frame) + 1;
 		if (PRVM_serveredictfloat(e, frame) >= m->numframes)
 			PRVM_serveredictfloat(e, frame) = m->numframes - 1;
+		PRVM_ED_MarkChanged(prog, e);
 
 		PrintFrameName (m, (int)PRVM_serveredictfloat(e, frame));
 	}
@@ -2493,6 +2496,7 @@ static void Host_Viewprev_f (void)
 		PRVM_serveredictfloat(e, frame) = PRVM_serveredictfloat(e, frame) - 1;
 		if (PRVM_serveredictfloat(e, frame) < 0)
 			PRVM_serveredictfloat(e, frame) = 0;
+		PRVM_ED_MarkChanged(prog, e);
 
 		PrintFrameName (m, (int)PRVM_serveredictfloat(e, frame));
 	}
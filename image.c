@@ -980,7 +980,9 @@ unsigned char *loadimagepixelsbgra (const char *filename, qboolean complain, qbo
 {
 	fs_offset_t filesize;
 	imageformat_t *firstformat, *format;
-	unsigned char *f, *data = NULL, *data2 = NULL;
+	const unsigned char *f;
+	fs_mappedfile_t *mapping;
+	unsigned char *data = NULL, *data2 = NULL;
 	char basename[MAX_QPATH], name[MAX_QPATH], name2[MAX_QPATH], *c;
 	char vabuf[1024];
 	//if (developer_memorydebug.integer)
@@ -1014,20 +1016,21 @@ unsigned char *loadimagepixelsbgra (const char *filename, qboolean complain, qbo
 	for (format = firstformat;format->formatstring;format++)
 	{
 		dpsnprintf (name, sizeof(name), format->formatstring, basename);
-		f = FS_LoadFile(name, tempmempool, true, &filesize);
+		// the decoders only read the file, so they can work on a mapping
+		f = FS_MapFile(name, true, &filesize, &mapping);
 		if (f)
 		{
 			int mymiplevel = miplevel ? *miplevel : 0;
 			image_width = 0;
 			image_height = 0;
 			data = format->loadfunc(f, (int)filesize, &mymiplevel);
-			Mem_Free(f);
+			FS_UnmapFile(mapping);
 			if (data)
 			{
 				if(format->loadfunc == JPEG_LoadImage_BGRA) // jpeg can't do alpha, so let's simulate it by loading another jpeg
 				{
 					dpsnprintf (name2, sizeof(name2), format->formatstring, va(vabuf, sizeof(vabuf), "%s_alpha", basename));
-					f = FS_LoadFile(name2, tempmempool, true, &filesize);
+					f = FS_MapFile(name2, true, &filesize, &mapping);
 					if(f)
 					{
 						int mymiplevel2 = miplevel ? *miplevel : 0;
@@ -1042,7 +1045,7 @@ unsigned char *loadimagepixelsbgra (const char *filename, qboolean complain, qbo
 						image_height = image_height_save;
 						if(data2)
 							Mem_Free(data2);
-						Mem_Free(f);
+						FS_UnmapFile(mapping);
 					}
 				}
 				if (developer_loading.integer)
@@ -87,6 +87,9 @@ char sv_readstring[MAX_INPUTLINE];
 cvar_t net_test = {0, "net_test", "0", "internal development use only, leave it alone (usually does nothing anyway)"};
 cvar_t net_usesizelimit = {0, "net_usesizelimit", "1", "use packet size limiting (0: never, 1: in non-CSQC mode, 2: always)"};
 cvar_t net_burstreserve = {0, "net_burstreserve", "0.3", "how much of the burst time to reserve for packet size spikes"};
+cvar_t net_compress = {0, "net_compress", "0", "allow clients to request compression of large reliable messages such as signon data (netcompress extension)"};
+cvar_t net_compress_threshold = {0, "net_compress_threshold", "256", "reliable messages smaller than this many bytes are never compressed"};
+cvar_t net_compress_level = {0, "net_compress_level", "1", "deflate level used for compressed reliable messages, 1 = fastest, 9 = smallest"};
 cvar_t net_messagetimeout = {0, "net_messagetimeout","300", "drops players who have not sent any packets for this many seconds"};
 cvar_t net_connecttimeout = {0, "net_connecttimeout","15", "after requesting a connection, the client must reply within this many seconds or be dropped (cuts down on connect floods). Must be above 10 seconds."};
 cvar_t net_connectfloodblockingtimeout = {0, "net_connectfloodblockingtimeout", "5", "when a connection packet is received, it will block all future connect packets from that IP address for this many seconds (cuts down on connect floods). Note that this does not include retries from the same IP; these are handled earlier and let in."};
@@ -770,6 +773,117 @@ static int NetConn_AddCryptoFlag(crypto_t *crypto)
 	return flag;
 }
 
+/*
+====================
+NetConn_CompressionForName
+====================
+*/
+int NetConn_CompressionForName(const char *name)
+{
+	if (!strcasecmp(name, "deflate"))
+		return NETCOMPRESS_DEFLATE;
+	return NETCOMPRESS_NONE;
+}
+
+const char *NetConn_CompressionName(int compression)
+{
+	switch (compression)
+	{
+	case NETCOMPRESS_DEFLATE:
+		return "deflate";
+	default:
+		return "none";
+	}
+}
+
+/*
+====================
+NetConn_PrepareReliableMessage
+
+Copies conn->message into conn->sendMessage, replacing it with a single
+svc_compressed block if the peer negotiated a codec and compressing the
+message saves space
+====================
+*/
+static void NetConn_PrepareReliableMessage(netconn_t *conn)
+{
+	unsigned char *deflated;
+	size_t deflatedsize;
+	double starttime;
+	int length = conn->message.cursize;
+
+	if (conn->compression == NETCOMPRESS_DEFLATE && length >= max(net_compress_threshold.integer, 16))
+	{
+		starttime = Sys_DirtyTime();
+		deflated = FS_Deflate(conn->message.data, length, &deflatedsize, bound(1, net_compress_level.integer, 9), tempmempool);
+		conn->compressTime += Sys_DirtyTime() - starttime;
+		if (deflated && deflatedsize + 6 < (size_t)length)
+		{
+			conn->sendMessage[0] = svc_compressed;
+			conn->sendMessage[1] = NETCOMPRESS_DEFLATE;
+			StoreLittleLong(conn->sendMessage + 2, length);
+			memcpy(conn->sendMessage + 6, deflated, deflatedsize);
+			conn->sendMessageLength = (int)deflatedsize + 6;
+			conn->compressedMessagesSent++;
+			conn->compressedBytesIn += length;
+			conn->compressedBytesOut += conn->sendMessageLength;
+			Mem_Free(deflated);
+			return;
+		}
+		if (deflated)
+			Mem_Free(deflated);
+	}
+	memcpy(conn->sendMessage, conn->message.data, length);
+	conn->sendMessageLength = length;
+}
+
+#ifndef CONFIG_SV
+/*
+====================
+NetConn_DecompressReliableMessage
+
+Unpacks a svc_compressed reliable message into msg, returns false if it
+is corrupt (the message is dropped)
+====================
+*/
+static qboolean NetConn_DecompressReliableMessage(netconn_t *conn, int length, sizebuf_t *msg)
+{
+	unsigned char *inflated = NULL;
+	size_t inflatedsize = 0;
+	int expectedsize;
+	double starttime;
+	fs_inflatestream_t *stream;
+
+	if (length > 6)
+	{
+		expectedsize = BuffLittleLong(conn->receiveMessage + 2);
+		starttime = Sys_DirtyTime();
+		if (conn->receiveMessage[1] == NETCOMPRESS_DEFLATE && expectedsize > 0 && expectedsize <= msg->maxsize
+		 && (stream = FS_InflateStream_Begin(expectedsize, false, tempmempool)))
+		{
+			// never inflate more than the message can hold
+			FS_InflateStream_SetLimit(stream, expectedsize);
+			FS_InflateStream_Feed(stream, conn->receiveMessage + 6, length - 6);
+			inflated = FS_InflateStream_End(stream, &inflatedsize, NULL);
+		}
+		conn->compressTime += Sys_DirtyTime() - starttime;
+		if (inflated && inflatedsize == (size_t)expectedsize)
+		{
+			SZ_Write(msg, inflated, (int)inflatedsize);
+			Mem_Free(inflated);
+			conn->compressedMessagesReceived++;
+			conn->compressedBytesIn += (int)inflatedsize;
+			conn->compressedBytesOut += length;
+			return true;
+		}
+		if (inflated)
+			Mem_Free(inflated);
+	}
+	Con_Printf("Corrupt compressed reliable message (%i bytes), dropping it!\n", length);
+	return false;
+}
+#endif
+
 int NetConn_SendUnreliableMessage(netconn_t *conn, sizebuf_t *data, protocolversion_t protocol, int rate, int burstsize, qboolean quakesignon_suppressreliables)
 {
 	int totallen = 0;
@@ -909,8 +1023,7 @@ int NetConn_SendUnreliableMessage(netconn_t *conn, sizebuf_t *data, protocolvers
 				SZ_HexDumpToConsole(&conn->message);
 			}
 			#endif
-			memcpy(conn->sendMessage, conn->message.data, conn->message.cursize);
-			conn->sendMessageLength = conn->message.cursize;
+			NetConn_PrepareReliableMessage(conn);
 			SZ_Clear(&conn->message);
 
 			if (conn->sendMessageLength <= MAX_PACKETFRAGMENT)
@@ -1553,7 +1666,13 @@ static int NetConn_ReceivedMessage(netconn_t *conn, const unsigned char *data, s
 							if (conn == cls.netcon)
 							{
 								SZ_Clear(&cl_message);
-								SZ_Write(&cl_message, conn->receiveMessage, (int)length);
+								if (conn->receiveMessage[0] == svc_compressed)
+								{
+									if (!NetConn_DecompressReliableMessage(conn, (int)length, &cl_message))
+										return 1;
+								}
+								else
+									SZ_Write(&cl_message, conn->receiveMessage, (int)length);
 								MSG_BeginReading(&cl_message);
 							}
 							else
@@ -1981,6 +2100,8 @@ static int NetConn_ClientParsePacket(lhnetsocket_t *mysocket, unsigned char *dat
 		{
 			// darkplaces or quake3
 			char protocolnames[1400];
+			char compressinfo[256];
+			extern cvar_t cl_netcompress;
 			Con_DPrintf("\"%s\" received, sending connect request back to %s\n", string, addressstring2);
 			if (net_sourceaddresscheck.integer && LHNETADDRESS_Compare(peeraddress, &cls.connect_address)) {
 				Con_DPrintf("challenge message from wrong server %s\n", addressstring2);
@@ -1993,8 +2114,12 @@ static int NetConn_ClientParsePacket(lhnetsocket_t *mysocket, unsigned char *dat
 			// update the server IP in the userinfo (QW servers expect this, and it is used by the reconnect command)
 			InfoString_SetValue(cls.userinfo, sizeof(cls.userinfo), "*ip", addressstring2);
 			// TODO: add userinfo stuff here instead of using NQ commands?
+			// ask for compressed reliable messages right away, so the serverinfo is covered too
+			*compressinfo = 0;
+			if (cl_netcompress.string[0])
+				InfoString_SetValue(compressinfo, sizeof(compressinfo), "netcompress", cl_netcompress.string);
 			memcpy(senddata, "\377\377\377\377", 4);
-			dpsnprintf(senddata+4, sizeof(senddata)-4, "connect\\protocol\\darkplaces 3\\protocols\\%s%s\\challenge\\%s", protocolnames, cls.connect_userinfo, string + 10);
+			dpsnprintf(senddata+4, sizeof(senddata)-4, "connect\\protocol\\darkplaces 3\\protocols\\%s%s%s\\challenge\\%s", protocolnames, compressinfo, cls.connect_userinfo, string + 10);
 			NetConn_WriteString(mysocket, senddata, peeraddress);
 			return true;
 		}
@@ -3247,6 +3372,8 @@ static int NetConn_ServerParsePacket(lhnetsocket_t *mysocket, unsigned char *dat
 						NetConn_WriteString(mysocket, "\377\377\377\377accept", peeraddress);
 						if(crypto && crypto->authenticated)
 							Crypto_FinishInstance(&client->netconnection->crypto, crypto);
+						if ((s = InfoString_GetValue(string, "netcompress", infostringvalue, sizeof(infostringvalue))) != NULL)
+							SV_SelectNetCompression(client->netconnection, s);
 						SV_SendServerinfo(client);
 					}
 					else
@@ -3279,6 +3406,9 @@ static int NetConn_ServerParsePacket(lhnetsocket_t *mysocket, unsigned char *dat
 					// now set up the client
 					if(crypto && crypto->authenticated)
 						Crypto_FinishInstance(&conn->crypto, crypto);
+					// the serverinfo sent by SV_ConnectClient may be compressed already
+					if ((s = InfoString_GetValue(string, "netcompress", infostringvalue, sizeof(infostringvalue))) != NULL)
+						SV_SelectNetCompression(conn, s);
 					SV_ConnectClient(clientnum, conn);
 					NetConn_Heartbeat(1);
 					return true;
@@ -4114,6 +4244,14 @@ static void PrintStats(netconn_t *conn)
 	Con_Printf("packetsReceived            = %i\n", conn->packetsReceived);
 	Con_Printf("receivedDuplicateCount     = %i\n", conn->receivedDuplicateCount);
 	Con_Printf("droppedDatagrams           = %i\n", conn->droppedDatagrams);
+	if (conn->compression || conn->compressedMessagesReceived)
+	{
+		Con_Printf("compression                = %s\n", NetConn_CompressionName(conn->compression));
+		Con_Printf("compressed messages sent   = %i\n", conn->compressedMessagesSent);
+		Con_Printf("compressed messages recvd  = %i\n", conn->compressedMessagesReceived);
+		Con_Printf("compression ratio          = %i -> %i bytes (%.1f%%)\n", conn->compressedBytesIn, conn->compressedBytesOut, conn->compressedBytesIn ? 100.0 * conn->compressedBytesOut / conn->compressedBytesIn : 100.0);
+		Con_Printf("compression cpu time       = %.3fms\n", conn->compressTime * 1000.0);
+	}
 }
 
 void Net_Stats_f(void)
@@ -4178,6 +4316,9 @@ void NetConn_Init(void)
 	Cvar_RegisterVariable(&net_test);
 	Cvar_RegisterVariable(&net_usesizelimit);
 	Cvar_RegisterVariable(&net_burstreserve);
+	Cvar_RegisterVariable(&net_compress);
+	Cvar_RegisterVariable(&net_compress_threshold);
+	Cvar_RegisterVariable(&net_compress_level);
 	Cvar_RegisterVariable(&rcon_restricted_password);
 	Cvar_RegisterVariable(&rcon_restricted_commands);
 	Cvar_RegisterVariable(&rcon_secure_maxdiff);
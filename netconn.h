@@ -236,6 +236,15 @@ typedef struct netconn_s
 	int unreliableMessagesReceived;
 	int reliableMessagesSent;
 	int reliableMessagesReceived;
+
+	/// codec used for large outgoing reliable messages (NETCOMPRESS_*),
+	/// negotiated by the netcompress client command
+	int compression;
+	int compressedMessagesSent;
+	int compressedBytesIn; ///< uncompressed size of the compressed messages sent and received
+	int compressedBytesOut; ///< compressed size of the same messages
+	int compressedMessagesReceived;
+	double compressTime; ///< seconds spent compressing and decompressing
 } netconn_t;
 
 extern netconn_t *netconn_list;
@@ -429,6 +438,14 @@ extern cvar_t net_address;
 extern cvar_t net_address_ipv6;
 extern cvar_t net_usesizelimit;
 extern cvar_t net_burstreserve;
+extern cvar_t net_compress;
+
+/// codecs for svc_compressed reliable messages
+#define NETCOMPRESS_NONE 0
+#define NETCOMPRESS_DEFLATE 1
+
+int NetConn_CompressionForName(const char *name);
+const char *NetConn_CompressionName(int compression);
 
 qboolean NetConn_CanSend(netconn_t *conn);
 int NetConn_SendUnreliableMessage(netconn_t *conn, sizebuf_t *data, protocolversion_t protocol, int rate, int burstsize, qboolean quakesignon_suppressreliables);
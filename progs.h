@@ -97,6 +97,16 @@ typedef struct edict_engineprivate_s
 	// baseline values
 	entity_state_t baseline;
 
+	// result of the last SV_PrepareEntityForSending on this edict, reused
+	// by the next frame if no network relevant field has changed since
+	// (sendstate_valid is false for entities that have to be prepared every
+	// frame), sendstate_origin/angles catch moves done by C physics code
+	qboolean sendstate_valid;
+	qboolean sendstate_send;
+	vec3_t sendstate_origin;
+	vec3_t sendstate_angles;
+	entity_state_t sendstate;
+
 	// LordHavoc: gross hack to make floating items still work
 	int suspendedinairflag;
 
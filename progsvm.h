@@ -514,7 +514,8 @@ prvm_prog_funcoffsets_t;
 
 // stringbuffer flags
 #define STRINGBUFFER_SAVED     1   // saved in savegames
-#define STRINGBUFFER_QCFLAGS   1   // allowed to be set by QC
+#define STRINGBUFFER_INDEXED   2   // keeps a hash index of the strings for bufstr_find
+#define STRINGBUFFER_QCFLAGS   (STRINGBUFFER_SAVED | STRINGBUFFER_INDEXED) // allowed to be set by QC
 #define STRINGBUFFER_TEMP      128 // internal use ONLY 
 typedef struct prvm_stringbuffer_s
 {
@@ -523,9 +524,59 @@ typedef struct prvm_stringbuffer_s
 	char **strings;
 	const char *origin;
 	unsigned char flags;
+	// all slots below this are in use (bufstr_add search start)
+	int firstfree;
+	// index of the strings by content, built on demand for STRINGBUFFER_INDEXED
+	int hashsize;
+	int *hashfirst; // first string index of each bucket, -1 if empty
+	int *hashnext; // next string index in the same bucket, max_strings entries
 }
 prvm_stringbuffer_t;
 
+typedef struct prvm_freeedict_s
+{
+	int num;
+	float freetime; // entry is stale if the edict was reused since
+}
+prvm_freeedict_t;
+
+// strzone'd strings up to 16 << (PRVM_STRINGPOOL_NUMCLASSES - 1) bytes share
+// slabs of fixed size cells, larger ones get their own allocation; every cell
+// ends the string with a sentinel like Mem_Alloc does to catch overruns
+#define PRVM_STRINGPOOL_MINSHIFT   4
+#define PRVM_STRINGPOOL_NUMCLASSES 8
+#define PRVM_STRINGPOOL_SLABSIZE   32768
+// tempstrings live in a chunked arena so they never move once created;
+// chunk 0 covers offsets [0, CHUNKSIZE) and chunk k covers
+// [CHUNKSIZE << (k-1), CHUNKSIZE << k), so the chunk of an offset is found
+// from its highest set bit
+#define PRVM_TEMPSTRINGS_CHUNKSHIFT 16
+#define PRVM_TEMPSTRINGS_CHUNKSIZE (1 << PRVM_TEMPSTRINGS_CHUNKSHIFT)
+#define PRVM_TEMPSTRINGS_MAXCHUNKS 14 // 512MB of tempstrings
+typedef struct prvm_tempstrings_s
+{
+	// offset of the next tempstring, saved and restored around QC calls
+	int cursize;
+	// total size of the allocated chunks
+	int maxsize;
+	int numchunks;
+	char *chunks[PRVM_TEMPSTRINGS_MAXCHUNKS];
+	// per frame statistics for prvm_profile
+	int framenum;
+	int framebytes;
+	int lastframebytes;
+	int peakframebytes;
+}
+prvm_tempstrings_t;
+
+typedef struct prvm_stringpool_s
+{
+	char *freecells; // free cells, linked through their first bytes
+	int numslabs;
+	int numcells; // cells currently handed out
+}
+prvm_stringpool_t;
+
 // [INIT] variables flagged with this token can be initialized by 'you'
 // NOTE: external code has to create and free the mempools but everything else is done by prvm !
 typedef struct prvm_prog_s
@@ -589,13 +640,22 @@ typedef struct prvm_prog_s
 
 	int					maxknownstrings;
 	int					numknownstrings;
-	// this is updated whenever a string is removed or added
-	// (simple optimization of the free string search)
-	int					firstfreeknownstring;
+	// stack of released knownstrings slots, popped by the next allocation
+	int					numfreeknownstrings;
+	int					*freeknownstrings;
 	const char			**knownstrings;
 	unsigned char		*knownstrings_freeable;
+	unsigned int		*knownstrings_size; // allocation size of freeable strings
 	const char          **knownstrings_origin;
 	const char			***stringshash;
+	// size class pools the small strzone strings are carved from
+	prvm_stringpool_t	stringpools[PRVM_STRINGPOOL_NUMCLASSES];
+	// live strzone strings and their allocated bytes (for prvm_stringstats)
+	int					numzonestrings;
+	size_t				zonestringbytes;
+	// same for the engine owned strings of PRVM_PoolString_Alloc (buffers)
+	int					numpoolstrings;
+	size_t				poolstringbytes;
 
 	memexpandablearray_t	stringbuffersarray;
 
@@ -640,8 +700,8 @@ typedef struct prvm_prog_s
 	const char *         opensearches_origin[PRVM_MAX_OPENSEARCHES];
 	skeleton_t			*skeletons[MAX_EDICTS];
 
-	// buffer for storing all tempstrings created during one invocation of ExecuteProgram
-	sizebuf_t			tempstringsbuf;
+	// arena for storing all tempstrings created during one invocation of ExecuteProgram
+	prvm_tempstrings_t	tempstringsbuf;
 
 	// LordHavoc: moved this here to clean up things that relied on prvm_prog_list too much
 	// FIXME: make VM_CL_R_Polygon functions use Debug_Polygon functions?
@@ -657,6 +717,13 @@ typedef struct prvm_prog_s
 	// number of reserved edicts (allocated from 1)
 	int					reserved_edicts; // [INIT]
 
+	// edicts released by PRVM_ED_Free in the order they were freed (ring
+	// buffer), so PRVM_ED_Alloc can take the oldest one without a search
+	prvm_freeedict_t	*freeedicts;
+	int					maxfreeedicts;
+	int					numfreeedicts;
+	int					firstfreeedict;
+
 	prvm_edict_t		*edicts;
 	prvm_vec_t		*edictsfields;
 	void				*edictprivate;
@@ -664,6 +731,12 @@ typedef struct prvm_prog_s
 	// size of the engine private struct
 	int					edictprivate_size; // [INIT]
 
+	// change tracking: if fieldchangetracked is set (by the VM after loading
+	// the progs), any QC store to a field flagged in it (indexed by field
+	// offset) sets edictschanged[entnum], the VM clears edictschanged itself
+	unsigned char		*fieldchangetracked;
+	unsigned char		*edictschanged;
+
 	prvm_prog_fieldoffsets_t	fieldoffsets;
 	prvm_prog_globaloffsets_t	globaloffsets;
 	prvm_prog_funcoffsets_t	funcoffsets;
@@ -826,6 +899,8 @@ qboolean PRVM_ED_CanAlloc(prvm_prog_t *prog, prvm_edict_t *e);
 prvm_edict_t *PRVM_ED_Alloc(prvm_prog_t *prog);
 void PRVM_ED_Free(prvm_prog_t *prog, prvm_edict_t *ed);
 void PRVM_ED_ClearEdict(prvm_prog_t *prog, prvm_edict_t *e);
+void PRVM_ED_TrackFieldChanges(prvm_prog_t *prog, int fieldoffset, int size);
+#define PRVM_ED_MarkChanged(prog, ed) ((prog)->fieldchangetracked ? (void)((prog)->edictschanged[(prvm_edict_t *)(ed) - (prog)->edicts] = true) : (void)0)
 
 void PRVM_PrintFunctionStatements(prvm_prog_t *prog, const char *name);
 void PRVM_ED_Print(prvm_prog_t *prog, prvm_edict_t *ed, const char *wildcard_fieldname);
@@ -880,7 +955,14 @@ const char *PRVM_GetString(prvm_prog_t *prog, int num);
 int PRVM_SetEngineString(prvm_prog_t *prog, const char *s);
 const char *PRVM_ChangeEngineString(prvm_prog_t *prog, int i, const char *s);
 int PRVM_SetTempString(prvm_prog_t *prog, const char *s);
+// builds a tempstring in place: BeginTempString returns room for maxsize
+// bytes which the caller fills in, EndTempString commits it and returns its id
+char *PRVM_BeginTempString(prvm_prog_t *prog, size_t maxsize);
+int PRVM_EndTempString(prvm_prog_t *prog, const char *s);
 int PRVM_AllocString(prvm_prog_t *prog, size_t bufferlength, char **pointer);
+// pooled storage for engine owned strings (string buffers)
+char *PRVM_PoolString_Alloc(prvm_prog_t *prog, size_t size);
+void PRVM_PoolString_Free(prvm_prog_t *prog, char *s, size_t size);
 void PRVM_FreeString(prvm_prog_t *prog, int num);
 
 ddef_t *PRVM_ED_FieldAtOfs(prvm_prog_t *prog, int ofs);
@@ -1996,21 +1996,33 @@ static void EntityFrame5_ExpandEdicts(entityframe5_database_t *d, int newmax)
 		int *olddeltabits = d->deltabits;
 		unsigned char *oldpriorities = d->priorities;
 		int *oldupdateframenum = d->updateframenum;
+		vec3_t *oldlodorigins = d->lodorigins;
+		unsigned char *oldlodskipped = d->lodskipped;
 		entity_state_t *oldstates = d->states;
 		unsigned char *oldvisiblebits = d->visiblebits;
+		unsigned int *oldpendingbits = d->pendingbits;
+		unsigned int *oldpendingwords = d->pendingwords;
 		d->maxedicts = newmax;
-		data = (unsigned char *)Mem_Alloc(sv_mempool, d->maxedicts * sizeof(int) + d->maxedicts * sizeof(unsigned char) + d->maxedicts * sizeof(int) + d->maxedicts * sizeof(entity_state_t) + (d->maxedicts+7)/8 * sizeof(unsigned char));
+		data = (unsigned char *)Mem_Alloc(sv_mempool, d->maxedicts * sizeof(int) + d->maxedicts * sizeof(unsigned char) + d->maxedicts * sizeof(int) + d->maxedicts * sizeof(vec3_t) + d->maxedicts * sizeof(entity_state_t) + (d->maxedicts+31)/32 * sizeof(unsigned int) + (d->maxedicts+1023)/1024 * sizeof(unsigned int) + (d->maxedicts+7)/8 * sizeof(unsigned char) + d->maxedicts * sizeof(unsigned char));
 		d->deltabits = (int *)data;data += d->maxedicts * sizeof(int);
 		d->priorities = (unsigned char *)data;data += d->maxedicts * sizeof(unsigned char);
 		d->updateframenum = (int *)data;data += d->maxedicts * sizeof(int);
+		d->lodorigins = (vec3_t *)data;data += d->maxedicts * sizeof(vec3_t);
 		d->states = (entity_state_t *)data;data += d->maxedicts * sizeof(entity_state_t);
-		d->visiblebits = (unsigned char *)data;//data += (d->maxedicts+7)/8 * sizeof(unsigned char);
+		d->pendingbits = (unsigned int *)data;data += (d->maxedicts+31)/32 * sizeof(unsigned int);
+		d->pendingwords = (unsigned int *)data;data += (d->maxedicts+1023)/1024 * sizeof(unsigned int);
+		d->visiblebits = (unsigned char *)data;data += (d->maxedicts+7)/8 * sizeof(unsigned char);
+		d->lodskipped = (unsigned char *)data;//data += d->maxedicts * sizeof(unsigned char);
 		if (oldmaxedicts)
 		{
 			memcpy(d->deltabits, olddeltabits, oldmaxedicts * sizeof(int));
 			memcpy(d->priorities, oldpriorities, oldmaxedicts * sizeof(unsigned char));
 			memcpy(d->updateframenum, oldupdateframenum, oldmaxedicts * sizeof(int));
+			memcpy(d->lodorigins, oldlodorigins, oldmaxedicts * sizeof(vec3_t));
+			memcpy(d->lodskipped, oldlodskipped, oldmaxedicts * sizeof(unsigned char));
 			memcpy(d->states, oldstates, oldmaxedicts * sizeof(entity_state_t));
+			memcpy(d->pendingbits, oldpendingbits, (oldmaxedicts+31)/32 * sizeof(unsigned int));
+			memcpy(d->pendingwords, oldpendingwords, (oldmaxedicts+1023)/1024 * sizeof(unsigned int));
 			memcpy(d->visiblebits, oldvisiblebits, (oldmaxedicts+7)/8 * sizeof(unsigned char));
 			// the previous buffers were a single allocation, so just one free
 			Mem_Free(olddeltabits);
@@ -2018,6 +2030,20 @@ static void EntityFrame5_ExpandEdicts(entityframe5_database_t *d, int newmax)
 	}
 }
 
+// marks an entity as having pending deltabits (and thus a priority)
+static void EntityFrame5_SetPending(entityframe5_database_t *d, int num)
+{
+	d->pendingbits[num >> 5] |= 1u << (num & 31);
+	d->pendingwords[num >> 10] |= 1u << ((num >> 5) & 31);
+}
+
+static void EntityFrame5_ClearPending(entityframe5_database_t *d, int num)
+{
+	d->pendingbits[num >> 5] &= ~(1u << (num & 31));
+	if (!d->pendingbits[num >> 5])
+		d->pendingwords[num >> 10] &= ~(1u << ((num >> 5) & 31));
+}
+
 static int EntityState5_Priority(entityframe5_database_t *d, int stateindex)
 {
 	int limit, priority;
@@ -2100,7 +2126,8 @@ void EntityState5_WriteUpdate(int number, const entity_state_t *s, int changedbi
 	}
 	else
 	{
-		if (PRVM_serveredictfunction((&prog->edicts[s->number]), SendEntity))
+		// (sv_multiviewdemo_extract also writes updates, without the progs)
+		if (prog->loaded && s->number < prog->num_edicts && PRVM_serveredictfunction((&prog->edicts[s->number]), SendEntity))
 			return;
 
 		bits = changedbits;
@@ -2791,6 +2818,14 @@ void EntityFrame5_LostFrame(entityframe5_database_t *d, int framenum)
 				d->priorities[i] = max(d->priorities[i], 4);
 			else
 				d->priorities[i] = max(d->priorities[i], 1);
+			EntityFrame5_SetPending(d, i);
+		}
+		// the client does not have the origin sv_netlod compares with, so
+		// the resend must not be deferred until the entity moves far enough
+		if (deltabits[i] & (E5_FULLUPDATE | E5_ORIGIN))
+		{
+			VectorSet(d->lodorigins[i], 1e30f, 1e30f, 1e30f);
+			d->lodskipped[i] = 0;
 		}
 	}
 
@@ -2809,17 +2844,176 @@ void EntityFrame5_AckFrame(entityframe5_database_t *d, int framenum)
 			d->packetlog[i].packetnumber = 0;
 }
 
+/*
+==============================================================================
+
+ENTITY UPDATE CACHE
+
+Most entity updates are written with the same state and the same bits for
+many clients in the same frame, so the encoded bytes are remembered for the
+rest of the frame and copied for the other clients.  An entry only matches
+if the whole state is identical, which also covers states changed per client
+by customizeentityforclient or exteriormodelforclient.
+==============================================================================
+*/
+
+#define ENTITYFRAME5_UPDATECACHESIZE 4096
+
+typedef struct entityframe5_cachedupdate_s
+{
+	int sendframe;
+	int number;
+	int bits;
+	int size;
+	entity_state_t state;
+	unsigned char data[128];
+}
+entityframe5_cachedupdate_t;
+
+static entityframe5_cachedupdate_t *entityframe5_updatecache;
+static int entityframe5_sendframe;
+static int entityframe5_cachehits;
+static int entityframe5_cachemisses;
+static int entityframe5_cachebytessaved;
+
+// called once per server frame before entities are written to the clients
+void EntityFrame5_NewSendFrame(void)
+{
+	if (sv_cullentities_stats.integer && (entityframe5_cachehits || entityframe5_cachemisses))
+		Con_Printf("entity update cache: %d hits, %d misses (%d%% hit rate), %d bytes reused\n", entityframe5_cachehits, entityframe5_cachemisses, entityframe5_cachehits * 100 / (entityframe5_cachehits + entityframe5_cachemisses), entityframe5_cachebytessaved);
+	entityframe5_cachehits = 0;
+	entityframe5_cachemisses = 0;
+	entityframe5_cachebytessaved = 0;
+	entityframe5_sendframe++;
+}
+
+// writes the update into buf, reusing the bytes written for another client
+// this frame when possible
+static void EntityFrame5_WriteCachedUpdate(int number, const entity_state_t *s, int changedbits, sizebuf_t *buf)
+{
+	entityframe5_cachedupdate_t *c;
+
+	if (!sv_entitydeltacache.integer || developer_networkentities.integer >= 2)
+	{
+		EntityState5_WriteUpdate(number, s, changedbits, buf);
+		return;
+	}
+	if (!entityframe5_updatecache)
+		entityframe5_updatecache = (entityframe5_cachedupdate_t *)Mem_Alloc(sv_mempool, ENTITYFRAME5_UPDATECACHESIZE * sizeof(*entityframe5_updatecache));
+	c = entityframe5_updatecache + ((number * 31 + (unsigned int)changedbits * 2654435761u) & (ENTITYFRAME5_UPDATECACHESIZE - 1));
+	if (c->sendframe == entityframe5_sendframe && c->number == number && c->bits == changedbits && !memcmp(&c->state, s, sizeof(*s)))
+	{
+		SZ_Write(buf, c->data, c->size);
+		entityframe5_cachehits++;
+		entityframe5_cachebytessaved += c->size;
+		return;
+	}
+	EntityState5_WriteUpdate(number, s, changedbits, buf);
+	entityframe5_cachemisses++;
+	if (buf->overflowed || buf->cursize > (int)sizeof(c->data))
+		return;
+	c->sendframe = entityframe5_sendframe;
+	c->number = number;
+	c->bits = changedbits;
+	c->size = buf->cursize;
+	memcpy(&c->state, s, sizeof(*s));
+	memcpy(c->data, buf->data, buf->cursize);
+}
+
+/*
+==============================================================================
+
+NETWORK LOD
+
+With sv_netlod an entity far from the viewer whose only pending changes are
+movement is sent less often the farther away it is, and not at all until it
+moved far enough from the origin the client last got for the difference to
+be visible at that distance.  Players, attachments and everything else that
+changed are always sent at the normal priority.
+==============================================================================
+*/
+
+static qboolean EntityFrame5_DeferUpdate(entityframe5_database_t *d, int num, int framenum)
+{
+	const entity_state_t *s = d->states + num;
+	float distance, scale, precision;
+
+	if (!sv_netlod.integer || num == d->viewentnum || num <= svs.maxclients)
+		return false;
+	if (s->active != ACTIVE_NETWORK || s->tagentity || (s->flags & RENDER_VIEWMODEL))
+		return false;
+	if (d->deltabits[num] & ~(E5_ORIGIN | E5_ANGLES))
+		return false;
+	distance = VectorDistance(d->vieworigin, s->netcenter);
+	if (distance < sv_netlod_distance.value)
+		return false;
+	scale = distance / max(1.0f, sv_netlod_distance.value);
+	precision = sv_netlod_precision.value * scale;
+	if (framenum - d->updateframenum[num] < (int)(sv_netlod_interval.value * scale)
+	 || (!(d->deltabits[num] & E5_ANGLES) && VectorDistance2(s->origin, d->lodorigins[num]) < precision * precision))
+	{
+		if (d->lodskipped[num] < 255)
+			d->lodskipped[num]++;
+		d->statsdeferred++;
+		return true;
+	}
+	return false;
+}
+
+// counts a written entity update in the sv_netlod statistics
+static void EntityFrame5_AccountUpdate(entityframe5_database_t *d, int num, int size)
+{
+	prvm_prog_t *prog = SVVM_prog;
+	const char *classname;
+	int i, saved;
+	entityframe5_classstats_t *c;
+
+	// every deferred frame would have sent an update of about the same size
+	saved = d->lodskipped[num] * size;
+	d->lodskipped[num] = 0;
+	VectorCopy(d->states[num].origin, d->lodorigins[num]);
+	d->statsbytes += size;
+	d->statsbytessaved += saved;
+
+	// (sv_multiviewdemo_extract also writes frames, without the progs)
+	if (!sv_netlod_classstats.integer || !prog->loaded || num >= prog->num_edicts)
+		return;
+	classname = PRVM_serveredictstring(PRVM_EDICT_NUM(num), classname) ? PRVM_GetString(prog, PRVM_serveredictstring(PRVM_EDICT_NUM(num), classname)) : "";
+	for (i = 0, c = d->classstats;i < d->numclassstats;i++, c++)
+		if (!strncmp(c->classname, classname, sizeof(c->classname) - 1))
+			break;
+	if (i == d->numclassstats)
+	{
+		// lump the rest together once the table is full
+		if (d->numclassstats == ENTITYFRAME5_MAXCLASSSTATS)
+			c = d->classstats + ENTITYFRAME5_MAXCLASSSTATS - 1;
+		else
+		{
+			d->numclassstats++;
+			strlcpy(c->classname, d->numclassstats == ENTITYFRAME5_MAXCLASSSTATS ? "(other)" : classname, sizeof(c->classname));
+		}
+	}
+	c->updates++;
+	c->bytes += size;
+	c->bytessaved += saved;
+}
+
 qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_database_t *d, int numstates, const entity_state_t **states, int viewentnum, unsigned int movesequence, qboolean need_empty)
 {
 	prvm_prog_t *prog = SVVM_prog;
 	const entity_state_t *n;
 	int i, num, l, framenum, packetlognumber, priority;
+	int w, b, end, numwords;
 	sizebuf_t buf;
 	unsigned char data[128];
 	entityframe5_packetlog_t *packetlog;
 
-	if (prog->max_edicts > d->maxedicts)
-		EntityFrame5_ExpandEdicts(d, prog->max_edicts);
+	// make room for every entity of the frame too, sv_multiviewdemo_extract
+	// writes recorded frames without a running server
+	for (i = 0, num = prog->max_edicts;i < numstates;i++)
+		num = max(num, states[i]->number + 1);
+	if (num > d->maxedicts)
+		EntityFrame5_ExpandEdicts(d, (num + 255) & ~255);
 
 	framenum = d->latestframenum + 1;
 	d->viewentnum = viewentnum;
@@ -2857,6 +3051,7 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 				d->priorities[num] = max(d->priorities[num], 8); // removal is cheap
 				d->states[num] = defaultstate;
 				d->states[num].number = num;
+				EntityFrame5_SetPending(d, num);
 			}
 		}
 		// update the entity state data
@@ -2871,7 +3066,16 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 		}
 		SETPVSBIT(d->visiblebits, num);
 		d->deltabits[num] |= EntityState5_DeltaBits(d->states + num, n);
-		d->priorities[num] = max(d->priorities[num], 1);
+		// entities without changes would lose their priority when building
+		// the priority chains, so do it here and keep them out of the
+		// pending set
+		if (d->deltabits[num])
+		{
+			d->priorities[num] = max(d->priorities[num], 1);
+			EntityFrame5_SetPending(d, num);
+		}
+		else
+			d->priorities[num] = 0;
 		d->states[num] = *n;
 		d->states[num].number = num;
 		// advance to next entity so the next iteration doesn't immediately remove it
@@ -2880,6 +3084,12 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 	// all remaining entities are dead
 	for (;num < d->maxedicts;num++)
 	{
+		// skip 8 entities at a time if none of them were visible
+		if (!d->visiblebits[num >> 3])
+		{
+			num |= 7;
+			continue;
+		}
 		if (CHECKPVSBIT(d->visiblebits, num))
 		{
 			CLEARPVSBIT(d->visiblebits, num);
@@ -2887,6 +3097,7 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 			d->priorities[num] = max(d->priorities[num], 8); // removal is cheap
 			d->states[num] = defaultstate;
 			d->states[num].number = num;
+			EntityFrame5_SetPending(d, num);
 		}
 	}
 
@@ -2895,24 +3106,42 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 	if (buf.cursize + 11 > buf.maxsize)
 		return false;
 
-	// build lists of entities by priority level
+	// build lists of entities by priority level, only visiting the entities
+	// in the pending set (in increasing entity number order, like a scan of
+	// all entities would)
 	memset(d->prioritychaincounts, 0, sizeof(d->prioritychaincounts));
 	l = 0;
-	for (num = 0;num < d->maxedicts;num++)
+	numwords = (d->maxedicts + 1023) >> 10;
+	for (w = 0;w < numwords;w++)
 	{
-		if (d->priorities[num])
+		if (!d->pendingwords[w])
+			continue;
+		for (b = 0;b < 32;b++)
 		{
-			if (d->deltabits[num])
+			if (!(d->pendingwords[w] & (1u << b)))
+				continue;
+			for (num = ((w << 5) + b) << 5, end = num + 32;num < end;num++)
 			{
-				if (d->priorities[num] < (ENTITYFRAME5_PRIORITYLEVELS - 1))
-					d->priorities[num] = EntityState5_Priority(d, num);
-				l = num;
-				priority = d->priorities[num];
-				if (d->prioritychaincounts[priority] < ENTITYFRAME5_MAXSTATES)
-					d->prioritychains[priority][d->prioritychaincounts[priority]++] = num;
+				if (!(d->pendingbits[num >> 5] & (1u << (num & 31))))
+					continue;
+				if (d->priorities[num] && d->deltabits[num])
+				{
+					if (d->priorities[num] < (ENTITYFRAME5_PRIORITYLEVELS - 1))
+						d->priorities[num] = EntityState5_Priority(d, num);
+					// distant movement waits (it stays pending)
+					if (EntityFrame5_DeferUpdate(d, num, framenum))
+						continue;
+					l = num;
+					priority = d->priorities[num];
+					if (d->prioritychaincounts[priority] < ENTITYFRAME5_MAXSTATES)
+						d->prioritychains[priority][d->prioritychaincounts[priority]++] = num;
+				}
+				else
+				{
+					d->priorities[num] = 0;
+					EntityFrame5_ClearPending(d, num);
+				}
 			}
-			else
-				d->priorities[num] = 0;
 		}
 	}
 
@@ -2982,7 +3211,7 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 			if (d->deltabits[num] & E5_FULLUPDATE)
 				d->deltabits[num] = E5_FULLUPDATE | EntityState5_DeltaBits(&defaultstate, n);
 			buf.cursize = 0;
-			EntityState5_WriteUpdate(num, n, d->deltabits[num], &buf);
+			EntityFrame5_WriteCachedUpdate(num, n, d->deltabits[num], &buf);
 			// if the entity won't fit, try the next one
 			if (msg->cursize + buf.cursize + 2 > maxsize)
 				continue;
@@ -2990,6 +3219,7 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 			SZ_Write(msg, buf.data, buf.cursize);
 			// mark age on entity for prioritization
 			d->updateframenum[num] = framenum;
+			EntityFrame5_AccountUpdate(d, num, buf.cursize);
 			// log entity so deltabits can be restored later if lost
 			packetlog->states[packetlog->numstates].number = num;
 			packetlog->states[packetlog->numstates].bits = d->deltabits[num];
@@ -2997,6 +3227,7 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 			// clear deltabits and priority so it won't be sent again
 			d->deltabits[num] = 0;
 			d->priorities[num] = 0;
+			EntityFrame5_ClearPending(d, num);
 		}
 	}
 	MSG_WriteShort(msg, 0x8000);
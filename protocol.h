@@ -254,6 +254,7 @@ void Protocol_Names(char *buffer, size_t buffersize);
 #define svc_trailparticles	60		// [short] entnum [short] effectnum [vector] start [vector] end
 #define svc_pointparticles	61		// [short] effectnum [vector] start [vector] velocity [short] count
 #define svc_pointparticles1	62		// [short] effectnum [vector] start, same as svc_pointparticles except velocity is zero and count is 1
+#define svc_compressed		63		// [byte] codec [long] uncompressed size [compressed data to end of message], replaces a whole reliable message (netcompress extension)
 
 //
 // client to server
@@ -783,12 +784,26 @@ typedef struct entityframe5_packetlog_s
 }
 entityframe5_packetlog_t;
 
+// network bandwidth of one classname for one client (sv_netlod_classstats)
+typedef struct entityframe5_classstats_s
+{
+	char classname[32];
+	unsigned int updates;
+	unsigned int bytes;
+	unsigned int bytessaved;
+}
+entityframe5_classstats_t;
+
+#define ENTITYFRAME5_MAXCLASSSTATS 64
+
 typedef struct entityframe5_database_s
 {
 	// number of the latest message sent to client
 	int latestframenum;
 	// updated by WriteFrame for internal use
 	int viewentnum;
+	// eye position of the client, set before WriteFrame (for sv_netlod)
+	vec3_t vieworigin;
 
 	// logs of all recently sent messages (between acked and latest)
 	entityframe5_packetlog_t packetlog[ENTITYFRAME5_MAXPACKETLOGS];
@@ -803,6 +818,10 @@ typedef struct entityframe5_database_s
 	unsigned char *priorities; // [maxedicts]
 	// last frame this entity was sent on, for prioritzation
 	int *updateframenum; // [maxedicts]
+	// origin this entity was last sent with, for sv_netlod precision
+	vec3_t *lodorigins; // [maxedicts]
+	// number of frames sv_netlod deferred the pending update of this entity
+	unsigned char *lodskipped; // [maxedicts]
 
 	// database of current status of all entities
 	entity_state_t *states; // [maxedicts]
@@ -810,6 +829,11 @@ typedef struct entityframe5_database_s
 	// (duplicate of the active bit of every state in states[])
 	// (derived from states)
 	unsigned char *visiblebits; // [(maxedicts+7)/8]
+	// which entities have a nonzero priority (pending deltabits), and which
+	// words of pendingbits are nonzero, so that building the priority chains
+	// only has to visit the entities that actually need an update
+	unsigned int *pendingbits; // [(maxedicts+31)/32]
+	unsigned int *pendingwords; // [(maxedicts+1023)/1024]
 
 	// old notes
 
@@ -824,6 +848,13 @@ typedef struct entityframe5_database_s
 	//int numchangestates;
 	//entityframe5_changestate_t changestates[MAX_EDICTS];
 
+	// sv_netlod statistics (sv_netlod_stats command)
+	unsigned int statsbytes; // entity update bytes sent
+	unsigned int statsbytessaved; // estimated bytes saved by sv_netlod
+	unsigned int statsdeferred; // updates deferred by sv_netlod
+	int numclassstats;
+	entityframe5_classstats_t classstats[ENTITYFRAME5_MAXCLASSSTATS];
+
 	// buffers for building priority info
 	int prioritychaincounts[ENTITYFRAME5_PRIORITYLEVELS];
 	unsigned short prioritychains[ENTITYFRAME5_PRIORITYLEVELS][ENTITYFRAME5_MAXSTATES];
@@ -838,6 +869,7 @@ void EntityFrame5_CL_ReadFrame(void);
 void EntityFrame5_LostFrame(entityframe5_database_t *d, int framenum);
 void EntityFrame5_AckFrame(entityframe5_database_t *d, int framenum);
 qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_database_t *d, int numstates, const entity_state_t **states, int viewentnum, unsigned int movesequence, qboolean need_empty);
+void EntityFrame5_NewSendFrame(void);
 
 extern cvar_t developer_networkentities;
 
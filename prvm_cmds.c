@@ -1016,17 +1016,18 @@ string	ftos(float)
 void VM_ftos(prvm_prog_t *prog)
 {
 	prvm_vec_t v;
-	char s[128];
+	char *s;
 
 	VM_SAFEPARMCOUNT(1, VM_ftos);
 
 	v = PRVM_G_FLOAT(OFS_PARM0);
 
+	s = PRVM_BeginTempString(prog, 128);
 	if ((prvm_vec_t)((prvm_int_t)v) == v)
-		dpsnprintf(s, sizeof(s), "%.0f", v);
+		dpsnprintf(s, 128, "%.0f", v);
 	else
-		dpsnprintf(s, sizeof(s), "%f", v);
-	PRVM_G_INT(OFS_RETURN) = PRVM_SetTempString(prog, s);
+		dpsnprintf(s, 128, "%f", v);
+	PRVM_G_INT(OFS_RETURN) = PRVM_EndTempString(prog, s);
 }
 
 /*
@@ -1057,12 +1058,13 @@ string	vtos(vector)
 
 void VM_vtos(prvm_prog_t *prog)
 {
-	char s[512];
+	char *s;
 
 	VM_SAFEPARMCOUNT(1,VM_vtos);
 
-	dpsnprintf (s, sizeof(s), "'%5.1f %5.1f %5.1f'", PRVM_G_VECTOR(OFS_PARM0)[0], PRVM_G_VECTOR(OFS_PARM0)[1], PRVM_G_VECTOR(OFS_PARM0)[2]);
-	PRVM_G_INT(OFS_RETURN) = PRVM_SetTempString(prog, s);
+	s = PRVM_BeginTempString(prog, 512);
+	dpsnprintf (s, 512, "'%5.1f %5.1f %5.1f'", PRVM_G_VECTOR(OFS_PARM0)[0], PRVM_G_VECTOR(OFS_PARM0)[1], PRVM_G_VECTOR(OFS_PARM0)[2]);
+	PRVM_G_INT(OFS_RETURN) = PRVM_EndTempString(prog, s);
 }
 
 /*
@@ -1075,12 +1077,13 @@ string	etos(entity)
 
 void VM_etos(prvm_prog_t *prog)
 {
-	char s[128];
+	char *s;
 
 	VM_SAFEPARMCOUNT(1, VM_etos);
 
-	dpsnprintf (s, sizeof(s), "entity %i", PRVM_G_EDICTNUM(OFS_PARM0));
-	PRVM_G_INT(OFS_RETURN) = PRVM_SetTempString(prog, s);
+	s = PRVM_BeginTempString(prog, 128);
+	dpsnprintf (s, 128, "entity %i", PRVM_G_EDICTNUM(OFS_PARM0));
+	PRVM_G_INT(OFS_RETURN) = PRVM_EndTempString(prog, s);
 }
 
 /*
@@ -2076,7 +2079,7 @@ void VM_fopen(prvm_prog_t *prog)
 		break;
 	case 2: // FILE_WRITE
 		modestring = "w";
-		prog->openfiles[filenum] = FS_OpenRealFile(va(vabuf, sizeof(vabuf), "data/%s", filename), modestring, false);
+		prog->openfiles[filenum] = FS_OpenRealFileAsync(va(vabuf, sizeof(vabuf), "data/%s", filename), modestring, false);
 		break;
 	case 3: // FILE_READ_NODATA, DP_RM_FILE extension
 		modestring = "r";
@@ -2431,14 +2434,15 @@ string	strdecolorize(string s)
 // string (string s) strdecolorize = #472; // returns the passed in string with color codes stripped
 void VM_strdecolorize(prvm_prog_t *prog)
 {
-	char szNewString[VM_STRINGTEMP_LENGTH];
+	char *szNewString;
 	const char *szString;
 
 	// Prepare Strings
 	VM_SAFEPARMCOUNT(1,VM_strdecolorize);
 	szString = PRVM_G_STRING(OFS_PARM0);
-	COM_StringDecolorize(szString, 0, szNewString, sizeof(szNewString), TRUE);
-	PRVM_G_INT(OFS_RETURN) = PRVM_SetTempString(prog, szNewString);
+	szNewString = PRVM_BeginTempString(prog, VM_STRINGTEMP_LENGTH);
+	COM_StringDecolorize(szString, 0, szNewString, VM_STRINGTEMP_LENGTH, TRUE);
+	PRVM_G_INT(OFS_RETURN) = PRVM_EndTempString(prog, szNewString);
 }
 
 // DRESK - String Length (not counting color codes)
@@ -2477,16 +2481,17 @@ string	strtolower(string s)
 // string (string s) strtolower = #480; // returns passed in string in lowercase form
 void VM_strtolower(prvm_prog_t *prog)
 {
-	char szNewString[VM_STRINGTEMP_LENGTH];
+	char *szNewString;
 	const char *szString;
 
 	// Prepare Strings
 	VM_SAFEPARMCOUNT(1,VM_strtolower);
 	szString = PRVM_G_STRING(OFS_PARM0);
 
-	COM_ToLowerString(szString, szNewString, sizeof(szNewString) );
+	szNewString = PRVM_BeginTempString(prog, VM_STRINGTEMP_LENGTH);
+	COM_ToLowerString(szString, szNewString, VM_STRINGTEMP_LENGTH);
 
-	PRVM_G_INT(OFS_RETURN) = PRVM_SetTempString(prog, szNewString);
+	PRVM_G_INT(OFS_RETURN) = PRVM_EndTempString(prog, szNewString);
 }
 
 /*
@@ -2499,16 +2504,17 @@ string	strtoupper(string s)
 // string (string s) strtoupper = #481; // returns passed in string in uppercase form
 void VM_strtoupper(prvm_prog_t *prog)
 {
-	char szNewString[VM_STRINGTEMP_LENGTH];
+	char *szNewString;
 	const char *szString;
 
 	// Prepare Strings
 	VM_SAFEPARMCOUNT(1,VM_strtoupper);
 	szString = PRVM_G_STRING(OFS_PARM0);
 
-	COM_ToUpperString(szString, szNewString, sizeof(szNewString) );
+	szNewString = PRVM_BeginTempString(prog, VM_STRINGTEMP_LENGTH);
+	COM_ToUpperString(szString, szNewString, VM_STRINGTEMP_LENGTH);
 
-	PRVM_G_INT(OFS_RETURN) = PRVM_SetTempString(prog, szNewString);
+	PRVM_G_INT(OFS_RETURN) = PRVM_EndTempString(prog, szNewString);
 }
 
 /*
@@ -2523,11 +2529,12 @@ string strcat(string,string,...[string])
 // and returns as a tempstring
 void VM_strcat(prvm_prog_t *prog)
 {
-	char s[VM_STRINGTEMP_LENGTH];
+	char *s;
 	VM_SAFEPARMCOUNTRANGE(1, 8, VM_strcat);
 
-	VM_VarString(prog, 0, s, sizeof(s));
-	PRVM_G_INT(OFS_RETURN) = PRVM_SetTempString(prog, s);
+	s = PRVM_BeginTempString(prog, VM_STRINGTEMP_LENGTH);
+	VM_VarString(prog, 0, s, VM_STRINGTEMP_LENGTH);
+	PRVM_G_INT(OFS_RETURN) = PRVM_EndTempString(prog, s);
 }
 
 /*
@@ -2545,7 +2552,7 @@ void VM_substring(prvm_prog_t *prog)
 	int u_slength = 0, u_start;
 	size_t u_length;
 	const char *s;
-	char string[VM_STRINGTEMP_LENGTH];
+	char *string;
 
 	VM_SAFEPARMCOUNT(3,VM_substring);
 
@@ -2595,12 +2602,13 @@ void VM_substring(prvm_prog_t *prog)
 		return;
 	}
 	u_length = u8_bytelen(s + u_start, length);
-	if (u_length >= sizeof(string)-1)
-		u_length = sizeof(string)-1;
+	if (u_length >= VM_STRINGTEMP_LENGTH-1)
+		u_length = VM_STRINGTEMP_LENGTH-1;
 
+	string = PRVM_BeginTempString(prog, u_length + 1);
 	memcpy(string, s + u_start, u_length);
 	string[u_length] = 0;
-	PRVM_G_INT(OFS_RETURN) = PRVM_SetTempString(prog, string);
+	PRVM_G_INT(OFS_RETURN) = PRVM_EndTempString(prog, string);
 }
 
 /*
@@ -4857,6 +4865,7 @@ static void BufStr_Expand(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer,
 	if (stringbuffer->max_strings <= strindex)
 	{
 		char **oldstrings = stringbuffer->strings;
+		int *oldhashnext = stringbuffer->hashnext;
 		stringbuffer->max_strings = max(stringbuffer->max_strings * 2, 128);
 		while (stringbuffer->max_strings <= strindex)
 			stringbuffer->max_strings *= 2;
@@ -4865,7 +4874,120 @@ static void BufStr_Expand(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer,
 			memcpy(stringbuffer->strings, oldstrings, stringbuffer->num_strings * sizeof(stringbuffer->strings[0]));
 		if (oldstrings)
 			Mem_Free(oldstrings);
+		if (oldhashnext)
+		{
+			stringbuffer->hashnext = (int *) Mem_Alloc(prog->progs_mempool, stringbuffer->max_strings * sizeof(stringbuffer->hashnext[0]));
+			if (stringbuffer->num_strings > 0)
+				memcpy(stringbuffer->hashnext, oldhashnext, stringbuffer->num_strings * sizeof(stringbuffer->hashnext[0]));
+			Mem_Free(oldhashnext);
+		}
+	}
+}
+
+static unsigned int BufStr_HashString(const char *str)
+{
+	return CRC_Block((const unsigned char *)str, strlen(str));
+}
+
+static void BufStr_FreeIndex(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer)
+{
+	if (stringbuffer->hashfirst)
+		Mem_Free(stringbuffer->hashfirst);
+	if (stringbuffer->hashnext)
+		Mem_Free(stringbuffer->hashnext);
+	stringbuffer->hashfirst = NULL;
+	stringbuffer->hashnext = NULL;
+	stringbuffer->hashsize = 0;
+}
+
+static void BufStr_IndexLink(prvm_stringbuffer_t *stringbuffer, int strindex)
+{
+	int bucket = BufStr_HashString(stringbuffer->strings[strindex]) & (stringbuffer->hashsize - 1);
+	stringbuffer->hashnext[strindex] = stringbuffer->hashfirst[bucket];
+	stringbuffer->hashfirst[bucket] = strindex;
+}
+
+// (re)builds the index with enough buckets for the current strings
+static void BufStr_BuildIndex(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer)
+{
+	int i;
+	BufStr_FreeIndex(prog, stringbuffer);
+	if (!stringbuffer->max_strings)
+		return;
+	for (stringbuffer->hashsize = 64;stringbuffer->hashsize < stringbuffer->num_strings;stringbuffer->hashsize *= 2)
+		;
+	stringbuffer->hashfirst = (int *) Mem_Alloc(prog->progs_mempool, stringbuffer->hashsize * sizeof(stringbuffer->hashfirst[0]));
+	stringbuffer->hashnext = (int *) Mem_Alloc(prog->progs_mempool, stringbuffer->max_strings * sizeof(stringbuffer->hashnext[0]));
+	for (i = 0;i < stringbuffer->hashsize;i++)
+		stringbuffer->hashfirst[i] = -1;
+	for (i = stringbuffer->num_strings - 1;i >= 0;i--)
+		if (stringbuffer->strings[i])
+			BufStr_IndexLink(stringbuffer, i);
+}
+
+static void BufStr_IndexUnlink(prvm_stringbuffer_t *stringbuffer, int strindex)
+{
+	int *link = &stringbuffer->hashfirst[BufStr_HashString(stringbuffer->strings[strindex]) & (stringbuffer->hashsize - 1)];
+	while (*link != strindex)
+		link = &stringbuffer->hashnext[*link];
+	*link = stringbuffer->hashnext[strindex];
+}
+
+/*
+========================
+BufStr_StoreString
+
+replaces the string in a slot (NULL frees it), keeping the index up to date;
+the strings are stored in the progs string pools instead of one heap
+allocation each
+========================
+*/
+static void BufStr_StoreString(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer, int strindex, const char *str)
+{
+	size_t alloclen;
+
+	BufStr_Expand(prog, stringbuffer, strindex);
+	stringbuffer->num_strings = max(stringbuffer->num_strings, strindex + 1);
+	if (stringbuffer->strings[strindex])
+	{
+		if (stringbuffer->hashfirst)
+			BufStr_IndexUnlink(stringbuffer, strindex);
+		PRVM_PoolString_Free(prog, stringbuffer->strings[strindex], strlen(stringbuffer->strings[strindex]) + 1);
+		stringbuffer->strings[strindex] = NULL;
+	}
+
+	if (str)
+	{
+		// not the NULL string!
+		alloclen = strlen(str) + 1;
+		stringbuffer->strings[strindex] = PRVM_PoolString_Alloc(prog, alloclen);
+		memcpy(stringbuffer->strings[strindex], str, alloclen);
+		if (stringbuffer->hashfirst)
+		{
+			if (stringbuffer->num_strings > stringbuffer->hashsize * 2)
+				BufStr_BuildIndex(prog, stringbuffer);
+			else
+				BufStr_IndexLink(stringbuffer, strindex);
+		}
 	}
+	else
+		stringbuffer->firstfree = min(stringbuffer->firstfree, strindex);
+}
+
+// frees all strings of a buffer
+static void BufStr_ClearStrings(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer)
+{
+	int i;
+	for (i = 0;i < stringbuffer->num_strings;i++)
+		if (stringbuffer->strings[i])
+			PRVM_PoolString_Free(prog, stringbuffer->strings[i], strlen(stringbuffer->strings[i]) + 1);
+	if (stringbuffer->strings)
+		Mem_Free(stringbuffer->strings);
+	stringbuffer->strings = NULL;
+	stringbuffer->num_strings = 0;
+	stringbuffer->max_strings = 0;
+	stringbuffer->firstfree = 0;
+	BufStr_FreeIndex(prog, stringbuffer);
 }
 
 static void BufStr_Shrink(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer)
@@ -4876,12 +4998,7 @@ static void BufStr_Shrink(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer)
 
 	// if empty, free the string pointer array
 	if (stringbuffer->num_strings == 0)
-	{
-		stringbuffer->max_strings = 0;
-		if (stringbuffer->strings)
-			Mem_Free(stringbuffer->strings);
-		stringbuffer->strings = NULL;
-	}
+		BufStr_ClearStrings(prog, stringbuffer);
 }
 
 static int BufStr_SortStringsUP (const void *in1, const void *in2)
@@ -4941,40 +5058,19 @@ prvm_stringbuffer_t *BufStr_FindCreateReplace (prvm_prog_t *prog, int bufindex,
 
 void BufStr_Set(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer, int strindex, const char *str)
 {
-	size_t  alloclen;
-
 	if (!stringbuffer || strindex < 0)
 		return;
 
-	BufStr_Expand(prog, stringbuffer, strindex);
-	stringbuffer->num_strings = max(stringbuffer->num_strings, strindex + 1);
-	if (stringbuffer->strings[strindex])
-		Mem_Free(stringbuffer->strings[strindex]);
-	stringbuffer->strings[strindex] = NULL;
-
-	if (str)
-	{
-		// not the NULL string!
-		alloclen = strlen(str) + 1;
-		stringbuffer->strings[strindex] = (char *)Mem_Alloc(prog->progs_mempool, alloclen);
-		memcpy(stringbuffer->strings[strindex], str, alloclen);
-	}
-
+	BufStr_StoreString(prog, stringbuffer, strindex, str);
 	BufStr_Shrink(prog, stringbuffer);
 }
 
 void BufStr_Del(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer)
 {
-	int i;
-
 	if (!stringbuffer)
 		return;
 
-	for (i = 0;i < stringbuffer->num_strings;i++)
-		if (stringbuffer->strings[i])
-			Mem_Free(stringbuffer->strings[i]);
-	if (stringbuffer->strings)
-		Mem_Free(stringbuffer->strings);
+	BufStr_ClearStrings(prog, stringbuffer);
 	if(stringbuffer->origin)
 		PRVM_Free((char *)stringbuffer->origin);
 	Mem_ExpandableArray_FreeRecord(&prog->stringbuffersarray, stringbuffer);
@@ -5105,25 +5201,11 @@ void VM_buf_copy (prvm_prog_t *prog)
 		return;
 	}
 
-	for (i = 0;i < dststringbuffer->num_strings;i++)
-		if (dststringbuffer->strings[i])
-			Mem_Free(dststringbuffer->strings[i]);
-	if (dststringbuffer->strings)
-		Mem_Free(dststringbuffer->strings);
-	*dststringbuffer = *srcstringbuffer;
-	if (dststringbuffer->max_strings)
-		dststringbuffer->strings = (char **)Mem_Alloc(prog->progs_mempool, sizeof(dststringbuffer->strings[0]) * dststringbuffer->max_strings);
-
-	for (i = 0;i < dststringbuffer->num_strings;i++)
-	{
+	BufStr_ClearStrings(prog, dststringbuffer);
+	dststringbuffer->flags = srcstringbuffer->flags;
+	for (i = 0;i < srcstringbuffer->num_strings;i++)
 		if (srcstringbuffer->strings[i])
-		{
-			size_t stringlen;
-			stringlen = strlen(srcstringbuffer->strings[i]) + 1;
-			dststringbuffer->strings[i] = (char *)Mem_Alloc(prog->progs_mempool, stringlen);
-			memcpy(dststringbuffer->strings[i], srcstringbuffer->strings[i], stringlen);
-		}
-	}
+			BufStr_StoreString(prog, dststringbuffer, i, srcstringbuffer->strings[i]);
 }
 
 /*
@@ -5159,7 +5241,10 @@ void VM_buf_sort (prvm_prog_t *prog)
 	else
 		qsort(stringbuffer->strings, stringbuffer->num_strings, sizeof(char*), BufStr_SortStringsDOWN);
 
+	stringbuffer->firstfree = 0;
 	BufStr_Shrink(prog, stringbuffer);
+	if (stringbuffer->hashfirst)
+		BufStr_BuildIndex(prog, stringbuffer);
 }
 
 /*
@@ -5278,7 +5363,6 @@ void VM_bufstr_add (prvm_prog_t *prog)
 	int				order, strindex;
 	prvm_stringbuffer_t *stringbuffer;
 	const char		*string;
-	size_t			alloclen;
 
 	VM_SAFEPARMCOUNT(3, VM_bufstr_add);
 
@@ -5299,16 +5383,14 @@ void VM_bufstr_add (prvm_prog_t *prog)
 	if(order)
 		strindex = stringbuffer->num_strings;
 	else
-		for (strindex = 0;strindex < stringbuffer->num_strings;strindex++)
+	{
+		for (strindex = min(stringbuffer->firstfree, stringbuffer->num_strings);strindex < stringbuffer->num_strings;strindex++)
 			if (stringbuffer->strings[strindex] == NULL)
 				break;
+		stringbuffer->firstfree = strindex + 1;
+	}
 
-	BufStr_Expand(prog, stringbuffer, strindex);
-
-	stringbuffer->num_strings = max(stringbuffer->num_strings, strindex + 1);
-	alloclen = strlen(string) + 1;
-	stringbuffer->strings[strindex] = (char *)Mem_Alloc(prog->progs_mempool, alloclen);
-	memcpy(stringbuffer->strings[strindex], string, alloclen);
+	BufStr_StoreString(prog, stringbuffer, strindex, string);
 
 	PRVM_G_FLOAT(OFS_RETURN) = strindex;
 }
@@ -5340,11 +5422,7 @@ void VM_bufstr_free (prvm_prog_t *prog)
 	}
 
 	if (i < stringbuffer->num_strings)
-	{
-		if(stringbuffer->strings[i])
-			Mem_Free(stringbuffer->strings[i]);
-		stringbuffer->strings[i] = NULL;
-	}
+		BufStr_StoreString(prog, stringbuffer, i, NULL);
 
 	BufStr_Shrink(prog, stringbuffer);
 }
@@ -5358,7 +5436,6 @@ float buf_loadfile(string filename, float bufhandle) = #535;
 */
 void VM_buf_loadfile(prvm_prog_t *prog)
 {
-	size_t alloclen;
 	prvm_stringbuffer_t *stringbuffer;
 	char string[VM_STRINGTEMP_LENGTH];
 	int strindex, c, end;
@@ -5415,11 +5492,7 @@ void VM_buf_loadfile(prvm_prog_t *prog)
 		// add and continue
 		if (c >= 0 || end)
 		{
-			BufStr_Expand(prog, stringbuffer, strindex);
-			stringbuffer->num_strings = max(stringbuffer->num_strings, strindex + 1);
-			alloclen = strlen(string) + 1;
-			stringbuffer->strings[strindex] = (char *)Mem_Alloc(prog->progs_mempool, alloclen);
-			memcpy(stringbuffer->strings[strindex], string, alloclen);
+			BufStr_StoreString(prog, stringbuffer, strindex, string);
 			strindex = stringbuffer->num_strings;
 		}
 		else
@@ -5606,7 +5679,7 @@ void VM_bufstr_find(prvm_prog_t *prog)
 {
 	prvm_stringbuffer_t *stringbuffer;
 	char string[VM_STRINGTEMP_LENGTH];
-	int matchrule, matchlen, i, step;
+	int matchrule, matchlen, i, j, step;
 	const char *match;
 
 	VM_SAFEPARMCOUNTRANGE(3, 5, VM_bufstr_find);
@@ -5640,6 +5713,19 @@ void VM_bufstr_find(prvm_prog_t *prog)
 	// find
 	i = (prog->argc > 3) ? (int)PRVM_G_FLOAT(OFS_PARM3) : 0;
 	step = (prog->argc > 4) ? (int)PRVM_G_FLOAT(OFS_PARM4) : 1;
+	if (matchrule == MATCH_WHOLE && (stringbuffer->flags & STRINGBUFFER_INDEXED) && step > 0 && i >= 0 && matchlen < VM_STRINGTEMP_LENGTH)
+	{
+		// exact match on an indexed buffer, only look at the strings in the
+		// bucket and return the first one the linear scan would have found
+		if (!stringbuffer->hashfirst)
+			BufStr_BuildIndex(prog, stringbuffer);
+		if (!stringbuffer->hashfirst)
+			return;
+		for (j = stringbuffer->hashfirst[BufStr_HashString(match) & (stringbuffer->hashsize - 1)];j >= 0;j = stringbuffer->hashnext[j])
+			if (j >= i && (j - i) % step == 0 && (PRVM_G_FLOAT(OFS_RETURN) < 0 || j < PRVM_G_FLOAT(OFS_RETURN)) && !strcmp(stringbuffer->strings[j], match))
+				PRVM_G_FLOAT(OFS_RETURN) = j;
+		return;
+	}
 	while(i < stringbuffer->num_strings)
 	{
 		if (stringbuffer->strings[i] && match_rule(stringbuffer->strings[i], VM_STRINGTEMP_LENGTH, match, matchlen, matchrule))
@@ -5702,7 +5788,6 @@ void VM_buf_cvarlist(prvm_prog_t *prog)
 	cvar_t *cvar;
 	const char *partial, *antipartial;
 	size_t len, antilen;
-	size_t alloclen;
 	qboolean ispattern, antiispattern;
 	int n;
 	prvm_stringbuffer_t	*stringbuffer;
@@ -5730,12 +5815,7 @@ void VM_buf_cvarlist(prvm_prog_t *prog)
 	else
 		antilen = strlen(antipartial);
 
-	for (n = 0;n < stringbuffer->num_strings;n++)
-		if (stringbuffer->strings[n])
-			Mem_Free(stringbuffer->strings[n]);
-	if (stringbuffer->strings)
-		Mem_Free(stringbuffer->strings);
-	stringbuffer->strings = NULL;
+	BufStr_ClearStrings(prog, stringbuffer);
 
 	ispattern = partial && (strchr(partial, '*') || strchr(partial, '?'));
 	antiispattern = antipartial && (strchr(antipartial, '*') || strchr(antipartial, '?'));
@@ -5752,14 +5832,8 @@ void VM_buf_cvarlist(prvm_prog_t *prog)
 		++n;
 	}
 
-	stringbuffer->max_strings = stringbuffer->num_strings = n;
-	if (stringbuffer->max_strings)
-		stringbuffer->strings = (char **)Mem_Alloc(prog->progs_mempool, sizeof(stringbuffer->strings[0]) * stringbuffer->max_strings);
-
-	if (stringbuffer->strings == NULL) {
-		VM_Warning(prog, "VM_buf_cvarlist: can't allocate space for buffer in %s\n", prog->name);
-		return;
-	}
+	if (n)
+		BufStr_Expand(prog, stringbuffer, n - 1);
 
 	n = 0;
 	for(cvar = cvar_vars; cvar; cvar = cvar->next)
@@ -5770,9 +5844,7 @@ void VM_buf_cvarlist(prvm_prog_t *prog)
 		if(antilen && (antiispattern ? matchpattern_with_separator(cvar->name, antipartial, false, "", false) : !strncmp(antipartial, cvar->name, antilen)))
 			continue;
 
-		alloclen = strlen(cvar->name) + 1;
-		stringbuffer->strings[n] = (char *)Mem_Alloc(prog->progs_mempool, alloclen);
-		memcpy(stringbuffer->strings[n], cvar->name, alloclen);
+		BufStr_StoreString(prog, stringbuffer, n, cvar->name);
 
 		++n;
 	}
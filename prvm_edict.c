@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 #include "progsvm.h"
+#include "siphash.h"
 #include "csprogs.h"
 #include "thread.h"
 
@@ -45,6 +46,7 @@ cvar_t prvm_errordump = {0, "prvm_errordump", "0", "write a savegame on crash to
 cvar_t prvm_breakpointdump = {0, "prvm_breakpointdump", "0", "write a savegame on breakpoint to breakpoint-server.dmp"};
 cvar_t prvm_reuseedicts_startuptime = {0, "prvm_reuseedicts_startuptime", "2", "allows immediate re-use of freed entity slots during start of new level (value in seconds)"};
 cvar_t prvm_reuseedicts_neverinsameframe = {0, "prvm_reuseedicts_neverinsameframe", "1", "never allows re-use of freed entity slots during same frame"};
+cvar_t prvm_progscache = {CVAR_SAVE, "prvm_progscache", "1", "keeps converted progs in progscache/ and loads them from there when the progs, the engine build and its extensions did not change"};
 
 static double prvm_reuseedicts_always_allow = 0;
 qboolean prvm_runawaycheck = true;
@@ -90,6 +92,9 @@ static void PRVM_MEM_Alloc(prvm_prog_t *prog)
 	// alloc edict private space
 	prog->edictprivate = Mem_Alloc(prog->progs_mempool, prog->max_edicts * prog->edictprivate_size);
 
+	// alloc change tracking flags (only used if the VM enables tracking)
+	prog->edictschanged = (unsigned char *)Mem_Alloc(prog->progs_mempool, prog->limit_edicts);
+
 	// alloc edict fields
 	prog->entityfieldsarea = prog->entityfields * prog->max_edicts;
 	prog->edictsfields = (prvm_vec_t *)Mem_Alloc(prog->progs_mempool, prog->entityfieldsarea * sizeof(prvm_vec_t));
@@ -136,6 +141,27 @@ void PRVM_MEM_IncreaseEdicts(prvm_prog_t *prog)
 //============================================================================
 // normal prvm
 
+/*
+===============
+PRVM_ED_TrackFieldChanges
+
+Flags size slots starting at fieldoffset so that QC stores to them mark the
+edict in prog->edictschanged, used by the server to only re-prepare the
+network state of entities that were modified
+===============
+*/
+void PRVM_ED_TrackFieldChanges(prvm_prog_t *prog, int fieldoffset, int size)
+{
+	if (fieldoffset < 0 || fieldoffset + size > prog->entityfields)
+		return;
+	if (!prog->fieldchangetracked)
+	{
+		prog->fieldchangetracked = (unsigned char *)Mem_Alloc(prog->progs_mempool, prog->entityfields);
+		memset(prog->edictschanged, 1, prog->limit_edicts);
+	}
+	memset(prog->fieldchangetracked + fieldoffset, 1, size);
+}
+
 int PRVM_ED_FindFieldOffset(prvm_prog_t *prog, const char *field)
 {
 	ddef_t *d;
@@ -215,6 +241,7 @@ freed and sets the allocation origin.
 void PRVM_ED_ClearEdict(prvm_prog_t *prog, prvm_edict_t *e)
 {
 	memset(e->fields.fp, 0, prog->entityfields * sizeof(prvm_vec_t));
+	PRVM_ED_MarkChanged(prog, e);
 	e->priv.required->free = false;
 	e->priv.required->freetime = realtime;
 	if(e->priv.required->allocation_origin)
@@ -259,6 +286,35 @@ qboolean PRVM_ED_CanAlloc(prvm_prog_t *prog, prvm_edict_t *e)
 	return false; // entity slot still blocked because the entity was freed less than one second ago
 }
 
+/*
+=================
+PRVM_ED_QueueFree
+
+Appends a freshly freed edict to the free queue, which stays sorted by
+freetime because realtime never goes backwards
+=================
+*/
+static void PRVM_ED_QueueFree(prvm_prog_t *prog, prvm_edict_t *ed)
+{
+	prvm_freeedict_t *f;
+	if (prog->numfreeedicts >= prog->maxfreeedicts)
+	{
+		prvm_freeedict_t *oldfreeedicts = prog->freeedicts;
+		int i, oldmax = prog->maxfreeedicts;
+		prog->maxfreeedicts = max(prog->maxfreeedicts * 2, 256);
+		prog->freeedicts = (prvm_freeedict_t *)PRVM_Alloc(prog->maxfreeedicts * sizeof(prvm_freeedict_t));
+		for (i = 0;i < prog->numfreeedicts;i++)
+			prog->freeedicts[i] = oldfreeedicts[(prog->firstfreeedict + i) % oldmax];
+		prog->firstfreeedict = 0;
+		if (oldfreeedicts)
+			Mem_Free(oldfreeedicts);
+	}
+	f = &prog->freeedicts[(prog->firstfreeedict + prog->numfreeedicts) % prog->maxfreeedicts];
+	f->num = PRVM_NUM_FOR_EDICT(ed);
+	f->freetime = ed->priv.required->freetime;
+	prog->numfreeedicts++;
+}
+
 /*
 =================
 PRVM_ED_Alloc
@@ -274,26 +330,44 @@ prvm_edict_t *PRVM_ED_Alloc(prvm_prog_t *prog)
 {
 	int i;
 	prvm_edict_t *e;
+	prvm_freeedict_t *f;
 
-	// the client qc dont need maxclients
-	// thus it doesnt need to use svs.maxclients
-	// AK:	changed i=svs.maxclients+1
-	// AK:	changed so the edict 0 wont spawn -> used as reserved/world entity
-	//		although the menu/client has no world
-	for (i = prog->reserved_edicts + 1;i < prog->num_edicts;i++)
+	// the free queue is ordered by freetime, and PRVM_ED_CanAlloc only gets
+	// more permissive the longer ago an edict was freed, so if the oldest
+	// entry can't be reused yet no other one can be either
+	while (prog->numfreeedicts)
 	{
-		e = PRVM_EDICT_NUM(i);
-		if(PRVM_ED_CanAlloc(prog, e))
+		f = &prog->freeedicts[prog->firstfreeedict];
+		e = NULL;
+		// skip entries whose edict was reused (or cut off the end of the
+		// edict list) since they were queued
+		if (f->num > prog->reserved_edicts && f->num < prog->num_edicts)
+		{
+			e = PRVM_EDICT_NUM(f->num);
+			if (!e->priv.required->free || e->priv.required->freetime != f->freetime)
+				e = NULL;
+		}
+		if (e && !PRVM_ED_CanAlloc(prog, e))
+			break;
+		prog->firstfreeedict = (prog->firstfreeedict + 1) % prog->maxfreeedicts;
+		prog->numfreeedicts--;
+		if (e)
 		{
 			PRVM_ED_ClearEdict (prog, e);
 			return e;
 		}
 	}
 
-	if (i == prog->limit_edicts)
+	// the client qc dont need maxclients
+	// thus it doesnt need to use svs.maxclients
+	// AK:	changed i=svs.maxclients+1
+	// AK:	changed so the edict 0 wont spawn -> used as reserved/world entity
+	//		although the menu/client has no world
+	i = max(prog->num_edicts, prog->reserved_edicts + 1);
+	if (i >= prog->limit_edicts)
 		Host_Error(prog, "%s: PRVM_ED_Alloc: no free edicts", prog->name);
 
-	prog->num_edicts++;
+	prog->num_edicts = i + 1;
 	if (prog->num_edicts >= prog->max_edicts)
 		PRVM_MEM_IncreaseEdicts(prog);
 
@@ -318,6 +392,7 @@ void PRVM_ED_Free(prvm_prog_t *prog, prvm_edict_t *ed)
 		return;
 
 	prog->free_edict(prog, ed);
+	PRVM_ED_MarkChanged(prog, ed);
 
 	ed->priv.required->free = true;
 	ed->priv.required->freetime = realtime;
@@ -326,6 +401,7 @@ void PRVM_ED_Free(prvm_prog_t *prog, prvm_edict_t *ed)
 		Mem_Free((char *)ed->priv.required->allocation_origin);
 		ed->priv.required->allocation_origin = NULL;
 	}
+	PRVM_ED_QueueFree(prog, ed);
 }
 
 //===========================================================================
@@ -874,6 +950,34 @@ static void PRVM_ED_Count_f (void)
 	prog->count_edicts(prog);
 }
 
+/*
+=============
+PRVM_StringStats_f
+
+Prints zone string usage of a VM, including the size class pools
+=============
+*/
+static void PRVM_StringStats_f (void)
+{
+	prvm_prog_t *prog;
+	int c;
+
+	if(Cmd_Argc() != 2)
+	{
+		Con_Print("prvm_stringstats <program name>\n");
+		return;
+	}
+
+	if (!(prog = PRVM_FriendlyProgFromString(Cmd_Argv(1))))
+		return;
+
+	Con_Printf("%s: %i zone strings using %lu bytes, %i known string slots (%i free)\n", prog->name, prog->numzonestrings, (unsigned long)prog->zonestringbytes, prog->numknownstrings, prog->numfreeknownstrings);
+	Con_Printf("%s: %i buffer strings using %lu bytes\n", prog->name, prog->numpoolstrings, (unsigned long)prog->poolstringbytes);
+	for (c = 0;c < PRVM_STRINGPOOL_NUMCLASSES;c++)
+		if (prog->stringpools[c].numslabs)
+			Con_Printf("%5i byte cells: %6i in use, %3i slabs (%i bytes)\n", 1 << (c + PRVM_STRINGPOOL_MINSHIFT), prog->stringpools[c].numcells, prog->stringpools[c].numslabs, prog->stringpools[c].numslabs * PRVM_STRINGPOOL_SLABSIZE);
+}
+
 /*
 ==============================================================================
 
@@ -988,7 +1092,10 @@ qboolean PRVM_ED_ParseEpair(prvm_prog_t *prog, prvm_edict_t *ent, ddef_t *key, c
 	mfunction_t *func;
 
 	if (ent)
+	{
 		val = (prvm_eval_t *)(ent->fields.fp + key->ofs);
+		PRVM_ED_MarkChanged(prog, ent);
+	}
 	else
 		val = (prvm_eval_t *)(prog->globals.fp + key->ofs);
 	switch (key->type & ~DEF_SAVEGLOBAL)
@@ -1385,6 +1492,8 @@ const char *PRVM_ED_ParseEdict (prvm_prog_t *prog, const char *data, prvm_edict_
 	if (!init) {
 		ent->priv.required->free = true;
 		ent->priv.required->freetime = realtime;
+		if (PRVM_NUM_FOR_EDICT(ent) > prog->reserved_edicts)
+			PRVM_ED_QueueFree(prog, ent);
 	}
 
 	return data;
@@ -2058,23 +2167,20 @@ static void PRVM_LoadLNO( prvm_prog_t *prog, const char *progname ) {
 
 /*
 ===============
-PRVM_LoadProgs
+PRVM_Prog_Convert
+
+Converts the functions, defs, globals and statements of a progs.dat to the
+in-memory format, byte swapping and bounds checking them on the way
 ===============
 */
-static void PRVM_UpdateBreakpoints(prvm_prog_t *prog);
-void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * data, fs_offset_t size, int numrequiredfunc, const char **required_func, int numrequiredfields, prvm_required_field_t *required_field, int numrequiredglobals, prvm_required_field_t *required_global)
+static void PRVM_Prog_Convert(prvm_prog_t *prog, dprograms_t *dprograms)
 {
 	int i;
-	dprograms_t *dprograms;
-	dstatement_t *instatements;
-	ddef_t *infielddefs;
-	ddef_t *inglobaldefs;
-    ddef_t *arrayext;
-	int *inglobals;
-	dfunction_t *infunctions;
-	char *instrings;
-	fs_offset_t filesize;
-	int requiredglobalspace;
+	dstatement_t *instatements = (dstatement_t *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_statements));
+	ddef_t *infielddefs = (ddef_t *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_fielddefs));
+	ddef_t *inglobaldefs = (ddef_t *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_globaldefs));
+	int *inglobals = (int *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_globals));
+	dfunction_t *infunctions = (dfunction_t *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_functions));
 	opcode_t op;
 	int a;
 	int b;
@@ -2086,93 +2192,6 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 	}
 	u;
 	unsigned int d;
-	char vabuf[1024];
-	char vabuf2[1024];
-	cvar_t *cvar;
-
-	if (prog->loaded)
-		Host_Error(prog, "PRVM_LoadProgs: there is already a %s program loaded!", prog->name );
-
-	Host_LockSession(); // all progs can use the session cvar
-	Crypto_LoadKeys(); // all progs might use the keys at init time
-
-	if (data)
-	{
-		dprograms = (dprograms_t *) data;
-		filesize = size;
-	}
-	else
-		dprograms = (dprograms_t *)FS_LoadFile (filename, prog->progs_mempool, false, &filesize);
-	if (dprograms == NULL || filesize < (fs_offset_t)sizeof(dprograms_t))
-		Host_Error(prog, "PRVM_LoadProgs: couldn't load %s for %s", filename, prog->name);
-	// TODO bounds check header fields (e.g. numstatements), they must never go behind end of file
-
-	prog->profiletime = Sys_DirtyTime();
-	prog->starttime = realtime;
-
-	Con_DPrintf("%s programs occupy %iK.\n", prog->name, (int)(filesize/1024));
-
-	requiredglobalspace = 0;
-	for (i = 0;i < numrequiredglobals;i++)
-		requiredglobalspace += required_global[i].type == ev_vector ? 3 : 1;
-
-	prog->filecrc = CRC_Block((unsigned char *)dprograms, filesize);
-
-// byte swap the header
-	prog->progs_version = LittleLong(dprograms->version);
-	prog->progs_crc = LittleLong(dprograms->crc);
-	if (prog->progs_version != PROG_VERSION)
-		Host_Error(prog, "%s: %s has wrong version number (%i should be %i)", prog->name, filename, prog->progs_version, PROG_VERSION);
-	instatements = (dstatement_t *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_statements));
-	prog->progs_numstatements = LittleLong(dprograms->numstatements);
-	inglobaldefs = (ddef_t *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_globaldefs));
-	prog->progs_numglobaldefs = LittleLong(dprograms->numglobaldefs);
-	infielddefs = (ddef_t *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_fielddefs));
-	prog->progs_numfielddefs = LittleLong(dprograms->numfielddefs);
-	infunctions = (dfunction_t *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_functions));
-	prog->progs_numfunctions = LittleLong(dprograms->numfunctions);
-	instrings = (char *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_strings));
-	prog->progs_numstrings = LittleLong(dprograms->numstrings);
-	inglobals = (int *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_globals));
-	prog->progs_numglobals = LittleLong(dprograms->numglobals);
-	prog->progs_entityfields = LittleLong(dprograms->entityfields);
-
-	prog->numstatements = prog->progs_numstatements;
-	prog->numglobaldefs = prog->progs_numglobaldefs;
-	prog->numfielddefs = prog->progs_numfielddefs;
-	prog->numfunctions = prog->progs_numfunctions;
-	prog->numstrings = prog->progs_numstrings;
-	prog->numglobals = prog->progs_numglobals;
-	prog->entityfields = prog->progs_entityfields;
-
-	if (LittleLong(dprograms->ofs_strings) + prog->progs_numstrings > (int)filesize)
-		Host_Error(prog, "%s: %s strings go past end of file", prog->name, filename);
-	prog->strings = (char *)Mem_Alloc(prog->progs_mempool, prog->progs_numstrings);
-	memcpy(prog->strings, instrings, prog->progs_numstrings);
-	prog->stringssize = prog->progs_numstrings;
-
-	prog->numknownstrings = 0;
-	prog->maxknownstrings = 0;
-	prog->knownstrings = NULL;
-	prog->knownstrings_freeable = NULL;
-
-	Mem_ExpandableArray_NewArray(&prog->stringbuffersarray, prog->progs_mempool, sizeof(prvm_stringbuffer_t), 64);
-
-	// we need to expand the globaldefs and fielddefs to include engine defs
-	prog->globaldefs = (ddef_t *)Mem_Alloc(prog->progs_mempool, (prog->progs_numglobaldefs + numrequiredglobals) * sizeof(ddef_t));
-    prog->globals_size = prog->progs_numglobals + requiredglobalspace + 2;
-	prog->globals.fp = (prvm_vec_t *)Mem_Alloc(prog->progs_mempool, prog->globals_size * sizeof(prvm_vec_t));
-		// + 2 is because of an otherwise occurring overrun in RETURN instruction
-		// when trying to return the last or second-last global
-		// (RETURN always returns a vector, there is no RETURN_F instruction)
-	prog->fielddefs = (ddef_t *)Mem_Alloc(prog->progs_mempool, (prog->progs_numfielddefs + numrequiredfields) * sizeof(ddef_t));
-	// we need to convert the statements to our memory format
-	prog->statements = (mstatement_t *)Mem_Alloc(prog->progs_mempool, prog->progs_numstatements * sizeof(mstatement_t));
-	// allocate space for profiling statement usage
-	prog->statement_profile = (double *)Mem_Alloc(prog->progs_mempool, prog->progs_numstatements * sizeof(*prog->statement_profile));
-	prog->explicit_profile = (double *)Mem_Alloc(prog->progs_mempool, prog->progs_numstatements * sizeof(*prog->statement_profile));
-	// functions need to be converted to the memory format
-	prog->functions = (mfunction_t *)Mem_Alloc(prog->progs_mempool, sizeof(mfunction_t) * prog->progs_numfunctions);
 
 	for (i = 0;i < prog->progs_numfunctions;i++)
 	{
@@ -2197,19 +2216,6 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 		// TODO bounds check ofs, s_name
 	}
 
-	// append the required globals
-	for (i = 0;i < numrequiredglobals;i++)
-	{
-		prog->globaldefs[prog->numglobaldefs].type = required_global[i].type;
-		prog->globaldefs[prog->numglobaldefs].ofs = prog->numglobals;
-		prog->globaldefs[prog->numglobaldefs].s_name = PRVM_SetEngineString(prog, required_global[i].name);
-		if (prog->globaldefs[prog->numglobaldefs].type == ev_vector)
-			prog->numglobals += 3;
-		else
-			prog->numglobals++;
-		prog->numglobaldefs++;
-	}
-
 	// copy the progs fields to the new fields list
 	for (i = 0;i < prog->numfielddefs;i++)
 	{
@@ -2221,19 +2227,6 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 		// TODO bounds check ofs, s_name
 	}
 
-	// append the required fields
-	for (i = 0;i < numrequiredfields;i++)
-	{
-		prog->fielddefs[prog->numfielddefs].type = required_field[i].type;
-		prog->fielddefs[prog->numfielddefs].ofs = prog->entityfields;
-		prog->fielddefs[prog->numfielddefs].s_name = PRVM_SetEngineString(prog, required_field[i].name);
-		if (prog->fielddefs[prog->numfielddefs].type == ev_vector)
-			prog->entityfields += 3;
-		else
-			prog->entityfields++;
-		prog->numfielddefs++;
-	}
-
 	// LordHavoc: TODO: reorder globals to match engine struct
 	// LordHavoc: TODO: reorder fields to match engine struct
 #define remapglobal(index) (index)
@@ -2449,6 +2442,316 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 			Host_Error(prog, "PRVM_LoadProgs: program may fall off the edge (does not end with RETURN, GOTO or DONE) in %s", prog->name);
 			break;
 	}
+}
+
+/*
+==============================================================================
+
+PROGS CACHE
+
+The result of PRVM_Prog_Convert and PRVM_FindOffsets only depends on the
+progs contents and on the engine build, so it is written to
+progscache/PROGSFILE.cache after converting and read back with a single
+file load the next time the same progs are loaded.
+==============================================================================
+*/
+
+#define PRVM_PROGSCACHE_MAGIC "DPPRVMC1"
+
+typedef struct prvm_progscache_header_s
+{
+	char magic[8];
+	unsigned long long progshash; // hash of the progs contents
+	unsigned long long enginehash; // hash of engine build, extensions and required defs
+	int filecrc;
+	int numfunctions;
+	int numglobaldefs;
+	int numfielddefs;
+	int numglobals;
+	int numstatements;
+	int numexplicitcoveragestatements;
+	int padding;
+	prvm_prog_fieldoffsets_t fieldoffsets;
+	prvm_prog_globaloffsets_t globaloffsets;
+	prvm_prog_funcoffsets_t funcoffsets;
+}
+prvm_progscache_header_t;
+
+static const uint8_t prvm_progscache_hashkey[16] = {'D', 'P', 'R', 'M', 'p', 'r', 'o', 'g', 's', 'c', 'a', 'c', 'h', 'e', 0, 1};
+
+static unsigned long long PRVM_ProgsCache_Hash(unsigned long long h, const void *data, size_t size)
+{
+	uint64_t piece;
+	siphash(&piece, (const uint8_t *)data, size, prvm_progscache_hashkey);
+	return (h ^ piece) * 0x100000001b3ULL;
+}
+
+static unsigned long long PRVM_ProgsCache_EngineHash(prvm_prog_t *prog, int numrequiredfields, prvm_required_field_t *required_field, int numrequiredglobals, prvm_required_field_t *required_global)
+{
+	int i, sizes[4];
+	unsigned long long h = 0;
+	sizes[0] = sizeof(prvm_vec_t);
+	sizes[1] = sizeof(mfunction_t);
+	sizes[2] = sizeof(mstatement_t);
+	sizes[3] = mem_bigendian;
+	h = PRVM_ProgsCache_Hash(h, sizes, sizeof(sizes));
+	h = PRVM_ProgsCache_Hash(h, buildstring, strlen(buildstring));
+	h = PRVM_ProgsCache_Hash(h, prog->name, strlen(prog->name));
+	if (prog->extensionstring)
+		h = PRVM_ProgsCache_Hash(h, prog->extensionstring, strlen(prog->extensionstring));
+	for (i = 0;i < numrequiredfields;i++)
+	{
+		h = PRVM_ProgsCache_Hash(h, required_field[i].name, strlen(required_field[i].name));
+		h = PRVM_ProgsCache_Hash(h, &required_field[i].type, sizeof(required_field[i].type));
+	}
+	for (i = 0;i < numrequiredglobals;i++)
+	{
+		h = PRVM_ProgsCache_Hash(h, required_global[i].name, strlen(required_global[i].name));
+		h = PRVM_ProgsCache_Hash(h, &required_global[i].type, sizeof(required_global[i].type));
+	}
+	return h;
+}
+
+/*
+===============
+PRVM_ProgsCache_Load
+
+Fills in the converted progs from the cache file if it matches, returns
+false if the progs have to be converted.  The converted statements are not
+checked again, so the cache is only read from where PRVM_ProgsCache_Save
+wrote it and never from a pack.
+===============
+*/
+static qboolean PRVM_ProgsCache_Load(prvm_prog_t *prog, const char *cachename, unsigned long long progshash, unsigned long long enginehash)
+{
+	unsigned char *data, *p;
+	fs_offset_t filesize;
+	prvm_progscache_header_t *header;
+	size_t functionssize = prog->progs_numfunctions * sizeof(mfunction_t);
+	size_t globaldefssize = prog->progs_numglobaldefs * sizeof(ddef_t);
+	size_t fielddefssize = prog->progs_numfielddefs * sizeof(ddef_t);
+	size_t globalssize = prog->progs_numglobals * sizeof(prvm_vec_t);
+	size_t statementssize = prog->progs_numstatements * sizeof(mstatement_t);
+	char path[MAX_OSPATH];
+
+	dpsnprintf(path, sizeof(path), "%s%s", fs_gamedir, cachename);
+	data = FS_SysLoadFile(path, tempmempool, true, &filesize);
+	if (!data)
+		return false;
+	header = (prvm_progscache_header_t *)data;
+	if ((size_t)filesize != sizeof(*header) + functionssize + globaldefssize + fielddefssize + globalssize + statementssize
+	 || memcmp(header->magic, PRVM_PROGSCACHE_MAGIC, sizeof(header->magic))
+	 || header->progshash != progshash
+	 || header->enginehash != enginehash
+	 || header->numfunctions != prog->progs_numfunctions
+	 || header->numglobaldefs != prog->progs_numglobaldefs
+	 || header->numfielddefs != prog->progs_numfielddefs
+	 || header->numglobals != prog->progs_numglobals
+	 || header->numstatements != prog->progs_numstatements)
+	{
+		Con_DPrintf("%s: progs cache %s is outdated\n", prog->name, cachename);
+		Mem_Free(data);
+		return false;
+	}
+
+	prog->filecrc = header->filecrc;
+	prog->numexplicitcoveragestatements = header->numexplicitcoveragestatements;
+	prog->fieldoffsets = header->fieldoffsets;
+	prog->globaloffsets = header->globaloffsets;
+	prog->funcoffsets = header->funcoffsets;
+	p = data + sizeof(*header);
+	memcpy(prog->functions, p, functionssize);p += functionssize;
+	memcpy(prog->globaldefs, p, globaldefssize);p += globaldefssize;
+	memcpy(prog->fielddefs, p, fielddefssize);p += fielddefssize;
+	memcpy(prog->globals.fp, p, globalssize);p += globalssize;
+	memcpy(prog->statements, p, statementssize);
+	Mem_Free(data);
+	Con_DPrintf("%s: loaded converted progs from %s\n", prog->name, cachename);
+	return true;
+}
+
+static void PRVM_ProgsCache_Save(prvm_prog_t *prog, const char *cachename, unsigned long long progshash, unsigned long long enginehash)
+{
+	prvm_progscache_header_t header;
+	const void *blocks[6];
+	fs_offset_t sizes[6];
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PRVM_PROGSCACHE_MAGIC, sizeof(header.magic));
+	header.progshash = progshash;
+	header.enginehash = enginehash;
+	header.filecrc = prog->filecrc;
+	header.numfunctions = prog->progs_numfunctions;
+	header.numglobaldefs = prog->progs_numglobaldefs;
+	header.numfielddefs = prog->progs_numfielddefs;
+	header.numglobals = prog->progs_numglobals;
+	header.numstatements = prog->progs_numstatements;
+	header.numexplicitcoveragestatements = prog->numexplicitcoveragestatements;
+	header.fieldoffsets = prog->fieldoffsets;
+	header.globaloffsets = prog->globaloffsets;
+	header.funcoffsets = prog->funcoffsets;
+
+	blocks[0] = &header;sizes[0] = sizeof(header);
+	blocks[1] = prog->functions;sizes[1] = prog->progs_numfunctions * sizeof(mfunction_t);
+	blocks[2] = prog->globaldefs;sizes[2] = prog->progs_numglobaldefs * sizeof(ddef_t);
+	blocks[3] = prog->fielddefs;sizes[3] = prog->progs_numfielddefs * sizeof(ddef_t);
+	blocks[4] = prog->globals.fp;sizes[4] = prog->progs_numglobals * sizeof(prvm_vec_t);
+	blocks[5] = prog->statements;sizes[5] = prog->progs_numstatements * sizeof(mstatement_t);
+	FS_WriteFileInBlocks(cachename, blocks, sizes, 6);
+}
+
+/*
+===============
+PRVM_LoadProgs
+===============
+*/
+static void PRVM_UpdateBreakpoints(prvm_prog_t *prog);
+void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * data, fs_offset_t size, int numrequiredfunc, const char **required_func, int numrequiredfields, prvm_required_field_t *required_field, int numrequiredglobals, prvm_required_field_t *required_global)
+{
+	int i;
+	dprograms_t *dprograms;
+    ddef_t *arrayext;
+	char *instrings;
+	fs_offset_t filesize;
+	int requiredglobalspace;
+	qboolean cached;
+	unsigned long long progshash = 0, enginehash = 0;
+	char cachename[MAX_QPATH + 16];
+	char vabuf[1024];
+	char vabuf2[1024];
+	cvar_t *cvar;
+
+	if (prog->loaded)
+		Host_Error(prog, "PRVM_LoadProgs: there is already a %s program loaded!", prog->name );
+
+	Host_LockSession(); // all progs can use the session cvar
+	Crypto_LoadKeys(); // all progs might use the keys at init time
+
+	if (data)
+	{
+		dprograms = (dprograms_t *) data;
+		filesize = size;
+	}
+	else
+		dprograms = (dprograms_t *)FS_LoadFile (filename, prog->progs_mempool, false, &filesize);
+	if (dprograms == NULL || filesize < (fs_offset_t)sizeof(dprograms_t))
+		Host_Error(prog, "PRVM_LoadProgs: couldn't load %s for %s", filename, prog->name);
+	// TODO bounds check header fields (e.g. numstatements), they must never go behind end of file
+
+	prog->profiletime = Sys_DirtyTime();
+	prog->starttime = realtime;
+
+	Con_DPrintf("%s programs occupy %iK.\n", prog->name, (int)(filesize/1024));
+
+	requiredglobalspace = 0;
+	for (i = 0;i < numrequiredglobals;i++)
+		requiredglobalspace += required_global[i].type == ev_vector ? 3 : 1;
+
+// byte swap the header
+	prog->progs_version = LittleLong(dprograms->version);
+	prog->progs_crc = LittleLong(dprograms->crc);
+	if (prog->progs_version != PROG_VERSION)
+		Host_Error(prog, "%s: %s has wrong version number (%i should be %i)", prog->name, filename, prog->progs_version, PROG_VERSION);
+	prog->progs_numstatements = LittleLong(dprograms->numstatements);
+	prog->progs_numglobaldefs = LittleLong(dprograms->numglobaldefs);
+	prog->progs_numfielddefs = LittleLong(dprograms->numfielddefs);
+	prog->progs_numfunctions = LittleLong(dprograms->numfunctions);
+	instrings = (char *)((unsigned char *)dprograms + LittleLong(dprograms->ofs_strings));
+	prog->progs_numstrings = LittleLong(dprograms->numstrings);
+	prog->progs_numglobals = LittleLong(dprograms->numglobals);
+	prog->progs_entityfields = LittleLong(dprograms->entityfields);
+
+	prog->numstatements = prog->progs_numstatements;
+	prog->numglobaldefs = prog->progs_numglobaldefs;
+	prog->numfielddefs = prog->progs_numfielddefs;
+	prog->numfunctions = prog->progs_numfunctions;
+	prog->numstrings = prog->progs_numstrings;
+	prog->numglobals = prog->progs_numglobals;
+	prog->entityfields = prog->progs_entityfields;
+
+	if (LittleLong(dprograms->ofs_strings) + prog->progs_numstrings > (int)filesize)
+		Host_Error(prog, "%s: %s strings go past end of file", prog->name, filename);
+	prog->strings = (char *)Mem_Alloc(prog->progs_mempool, prog->progs_numstrings);
+	memcpy(prog->strings, instrings, prog->progs_numstrings);
+	prog->stringssize = prog->progs_numstrings;
+
+	prog->numknownstrings = 0;
+	prog->maxknownstrings = 0;
+	prog->numfreeknownstrings = 0;
+	prog->freeknownstrings = NULL;
+	prog->knownstrings = NULL;
+	prog->knownstrings_freeable = NULL;
+	prog->knownstrings_size = NULL;
+	memset(prog->stringpools, 0, sizeof(prog->stringpools));
+	prog->numzonestrings = 0;
+	prog->zonestringbytes = 0;
+	prog->numpoolstrings = 0;
+	prog->poolstringbytes = 0;
+
+	Mem_ExpandableArray_NewArray(&prog->stringbuffersarray, prog->progs_mempool, sizeof(prvm_stringbuffer_t), 64);
+
+	// we need to expand the globaldefs and fielddefs to include engine defs
+	prog->globaldefs = (ddef_t *)Mem_Alloc(prog->progs_mempool, (prog->progs_numglobaldefs + numrequiredglobals) * sizeof(ddef_t));
+    prog->globals_size = prog->progs_numglobals + requiredglobalspace + 2;
+	prog->globals.fp = (prvm_vec_t *)Mem_Alloc(prog->progs_mempool, prog->globals_size * sizeof(prvm_vec_t));
+		// + 2 is because of an otherwise occurring overrun in RETURN instruction
+		// when trying to return the last or second-last global
+		// (RETURN always returns a vector, there is no RETURN_F instruction)
+	prog->fielddefs = (ddef_t *)Mem_Alloc(prog->progs_mempool, (prog->progs_numfielddefs + numrequiredfields) * sizeof(ddef_t));
+	// we need to convert the statements to our memory format
+	prog->statements = (mstatement_t *)Mem_Alloc(prog->progs_mempool, prog->progs_numstatements * sizeof(mstatement_t));
+	// allocate space for profiling statement usage
+	prog->statement_profile = (double *)Mem_Alloc(prog->progs_mempool, prog->progs_numstatements * sizeof(*prog->statement_profile));
+	prog->explicit_profile = (double *)Mem_Alloc(prog->progs_mempool, prog->progs_numstatements * sizeof(*prog->statement_profile));
+	// functions need to be converted to the memory format
+	prog->functions = (mfunction_t *)Mem_Alloc(prog->progs_mempool, sizeof(mfunction_t) * prog->progs_numfunctions);
+
+	cached = false;
+	if (prvm_progscache.integer)
+	{
+		dpsnprintf(cachename, sizeof(cachename), "progscache/%s.cache", filename);
+		progshash = PRVM_ProgsCache_Hash(0, dprograms, filesize);
+		enginehash = PRVM_ProgsCache_EngineHash(prog, numrequiredfields, required_field, numrequiredglobals, required_global);
+		cached = PRVM_ProgsCache_Load(prog, cachename, progshash, enginehash);
+	}
+	if (!cached)
+	{
+		prog->filecrc = CRC_Block((unsigned char *)dprograms, filesize);
+		PRVM_Prog_Convert(prog, dprograms);
+	}
+
+	// append the required globals
+	for (i = 0;i < numrequiredglobals;i++)
+	{
+		prog->globaldefs[prog->numglobaldefs].type = required_global[i].type;
+		prog->globaldefs[prog->numglobaldefs].ofs = prog->numglobals;
+		prog->globaldefs[prog->numglobaldefs].s_name = PRVM_SetEngineString(prog, required_global[i].name);
+		if (prog->globaldefs[prog->numglobaldefs].type == ev_vector)
+			prog->numglobals += 3;
+		else
+			prog->numglobals++;
+		prog->numglobaldefs++;
+	}
+
+	// append the required fields
+	for (i = 0;i < numrequiredfields;i++)
+	{
+		prog->fielddefs[prog->numfielddefs].type = required_field[i].type;
+		prog->fielddefs[prog->numfielddefs].ofs = prog->entityfields;
+		prog->fielddefs[prog->numfielddefs].s_name = PRVM_SetEngineString(prog, required_field[i].name);
+		if (prog->fielddefs[prog->numfielddefs].type == ev_vector)
+			prog->entityfields += 3;
+		else
+			prog->entityfields++;
+		prog->numfielddefs++;
+	}
+
+	if (!cached)
+	{
+		PRVM_FindOffsets(prog);
+		if (prvm_progscache.integer)
+			PRVM_ProgsCache_Save(prog, cachename, progshash, enginehash);
+	}
 
 	// we're done with the file now
 	if(!data)
@@ -2664,8 +2967,6 @@ fail:
 
 	prog->flag = 0;
 
-	PRVM_FindOffsets(prog);
-
 	prog->init_cmd(prog);
 
 	// init mempools
@@ -3107,6 +3408,7 @@ void PRVM_Init (void)
 	Cmd_AddCommand ("prvm_edict", PRVM_ED_PrintEdict_f, "print all data about an entity number in the selected VM (server, client, menu)");
 	Cmd_AddCommand ("prvm_edicts", PRVM_ED_PrintEdicts_f, "prints all data about all entities in the selected VM (server, client, menu)");
 	Cmd_AddCommand ("prvm_edictcount", PRVM_ED_Count_f, "prints number of active entities in the selected VM (server, client, menu)");
+	Cmd_AddCommand ("prvm_stringstats", PRVM_StringStats_f, "prints number and size of strzone'd strings in the selected VM (server, client, menu)");
 	Cmd_AddCommand ("prvm_profile", PRVM_Profile_f, "prints execution statistics about the most used QuakeC functions in the selected VM (server, client, menu)");
 	Cmd_AddCommand ("prvm_childprofile", PRVM_ChildProfile_f, "prints execution statistics about the most used QuakeC functions in the selected VM (server, client, menu), sorted by time taken in function with child calls");
 	Cmd_AddCommand ("prvm_callprofile", PRVM_CallProfile_f, "prints execution statistics about the most time consuming QuakeC calls from the engine in the selected VM (server, client, menu)");
@@ -3139,6 +3441,7 @@ void PRVM_Init (void)
 	Cvar_RegisterVariable (&prvm_breakpointdump);
 	Cvar_RegisterVariable (&prvm_reuseedicts_startuptime);
 	Cvar_RegisterVariable (&prvm_reuseedicts_neverinsameframe);
+	Cvar_RegisterVariable (&prvm_progscache);
 
 	// COMMANDLINEOPTION: PRVM: -norunaway disables the runaway loop check (it might be impossible to exit DarkPlaces if used!)
 	prvm_runawaycheck = !COM_CheckParm("-norunaway");
@@ -3166,6 +3469,32 @@ unsigned int PRVM_EDICT_NUM_ERROR(prvm_prog_t *prog, unsigned int n, const char
 
 #define PRVM_KNOWNSTRINGBASE 0x40000000
 
+static int PRVM_TempStrings_Chunk(int ofs)
+{
+	int chunk = 0;
+	for (ofs >>= PRVM_TEMPSTRINGS_CHUNKSHIFT;ofs;ofs >>= 1)
+		chunk++;
+	return chunk;
+}
+
+static int PRVM_TempStrings_ChunkBase(int chunk)
+{
+	return chunk ? PRVM_TEMPSTRINGS_CHUNKSIZE << (chunk - 1) : 0;
+}
+
+static int PRVM_TempStrings_ChunkSize(int chunk)
+{
+	return chunk ? PRVM_TEMPSTRINGS_CHUNKSIZE << (chunk - 1) : PRVM_TEMPSTRINGS_CHUNKSIZE;
+}
+
+static char *PRVM_TempStrings_Pointer(prvm_prog_t *prog, int ofs)
+{
+	int chunk = PRVM_TempStrings_Chunk(ofs);
+	if (chunk >= prog->tempstringsbuf.numchunks)
+		return NULL;
+	return prog->tempstringsbuf.chunks[chunk] + (ofs - PRVM_TempStrings_ChunkBase(chunk));
+}
+
 const char *PRVM_GetString(prvm_prog_t *prog, int num)
 {
 	if (num < 0)
@@ -3184,7 +3513,7 @@ const char *PRVM_GetString(prvm_prog_t *prog, int num)
 		// tempstring returned by engine to QC (becomes invalid after returning to engine)
 		num -= prog->stringssize;
 		if (num < prog->tempstringsbuf.cursize)
-			return (char *)prog->tempstringsbuf.data + num;
+			return PRVM_TempStrings_Pointer(prog, num);
 		else
 		{
 			VM_Warning(prog, "PRVM_GetString: Invalid temp-string offset (%i >= %i prog->tempstringsbuf.cursize)\n", num, prog->tempstringsbuf.cursize);
@@ -3229,6 +3558,143 @@ const char *PRVM_ChangeEngineString(prvm_prog_t *prog, int i, const char *s)
 	return old;
 }
 
+/*
+=================
+PRVM_NewKnownString
+
+Returns a free slot in the knownstrings arrays, reusing released slots first
+and otherwise growing the arrays geometrically
+=================
+*/
+static int PRVM_NewKnownString(prvm_prog_t *prog)
+{
+	if (prog->numfreeknownstrings)
+		return prog->freeknownstrings[--prog->numfreeknownstrings];
+	if (prog->numknownstrings >= prog->maxknownstrings)
+	{
+		const char **oldstrings = prog->knownstrings;
+		const unsigned char *oldstrings_freeable = prog->knownstrings_freeable;
+		const unsigned int *oldstrings_size = prog->knownstrings_size;
+		const char **oldstrings_origin = prog->knownstrings_origin;
+		const int *oldfreestrings = prog->freeknownstrings;
+		prog->maxknownstrings = max(prog->maxknownstrings * 2, 128);
+		prog->knownstrings = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
+		prog->knownstrings_freeable = (unsigned char *)PRVM_Alloc(prog->maxknownstrings * sizeof(unsigned char));
+		prog->knownstrings_size = (unsigned int *)PRVM_Alloc(prog->maxknownstrings * sizeof(unsigned int));
+		prog->freeknownstrings = (int *)PRVM_Alloc(prog->maxknownstrings * sizeof(int));
+		if(prog->leaktest_active)
+			prog->knownstrings_origin = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
+		if (prog->numknownstrings)
+		{
+			memcpy((char **)prog->knownstrings, oldstrings, prog->numknownstrings * sizeof(char *));
+			memcpy((char **)prog->knownstrings_freeable, oldstrings_freeable, prog->numknownstrings * sizeof(unsigned char));
+			memcpy(prog->knownstrings_size, oldstrings_size, prog->numknownstrings * sizeof(unsigned int));
+			if(prog->leaktest_active)
+				memcpy((char **)prog->knownstrings_origin, oldstrings_origin, prog->numknownstrings * sizeof(char *));
+		}
+		if (oldstrings)
+			Mem_Free((char **)oldstrings);
+		if (oldstrings_freeable)
+			Mem_Free((unsigned char *)oldstrings_freeable);
+		if (oldstrings_size)
+			Mem_Free((unsigned int *)oldstrings_size);
+		if (oldstrings_origin)
+			Mem_Free((char **)oldstrings_origin);
+		if (oldfreestrings)
+			Mem_Free((int *)oldfreestrings);
+	}
+	return prog->numknownstrings++;
+}
+
+#define PRVM_STRINGPOOL_SENTINEL_FOR_ADDRESS(p) ((sentinel_seed ^ (unsigned int) (uintptr_t) (p)) + sentinel_seed)
+
+// returns the size class a strzone buffer of this size (and its sentinel) is
+// pooled in, or -1 if it is too large and gets its own allocation
+static int PRVM_StringPoolClass(size_t size)
+{
+	int c;
+	for (c = 0;c < PRVM_STRINGPOOL_NUMCLASSES;c++)
+		if (size + sizeof(unsigned int) <= ((size_t)1 << (c + PRVM_STRINGPOOL_MINSHIFT)))
+			return c;
+	return -1;
+}
+
+static char *PRVM_StringPool_Alloc(prvm_prog_t *prog, int c, size_t size)
+{
+	prvm_stringpool_t *pool = &prog->stringpools[c];
+	size_t cellsize = (size_t)1 << (c + PRVM_STRINGPOOL_MINSHIFT);
+	char *cell;
+	unsigned int sentinel;
+	if (!pool->freecells)
+	{
+		// carve a new slab into cells and chain them all into the free list
+		char *slab = (char *)PRVM_Alloc(PRVM_STRINGPOOL_SLABSIZE);
+		size_t i, numcells = PRVM_STRINGPOOL_SLABSIZE / cellsize;
+		for (i = 0;i < numcells - 1;i++)
+			*(char **)(slab + i * cellsize) = slab + (i + 1) * cellsize;
+		*(char **)(slab + i * cellsize) = NULL;
+		pool->freecells = slab;
+		pool->numslabs++;
+	}
+	cell = pool->freecells;
+	pool->freecells = *(char **)cell;
+	pool->numcells++;
+	// zeroed like PRVM_Alloc memory, with the sentinel right after the string
+	memset(cell, 0, cellsize);
+	sentinel = PRVM_STRINGPOOL_SENTINEL_FOR_ADDRESS(cell + size);
+	memcpy(cell + size, &sentinel, sizeof(sentinel));
+	return cell;
+}
+
+static void PRVM_StringPool_Free(prvm_prog_t *prog, int c, char *cell, size_t size)
+{
+	prvm_stringpool_t *pool = &prog->stringpools[c];
+	unsigned int sentinel = PRVM_STRINGPOOL_SENTINEL_FOR_ADDRESS(cell + size);
+	if (memcmp(cell + size, &sentinel, sizeof(sentinel)))
+		Sys_Error("PRVM_StringPool_Free: trashed sentinel (%s string of %u bytes)", prog->name, (unsigned int)size);
+	*(char **)cell = pool->freecells;
+	pool->freecells = cell;
+	pool->numcells--;
+}
+
+/*
+===============
+PRVM_PoolString_Alloc
+
+Allocates engine owned string storage from the string pools, falling back to
+the progs heap for sizes beyond the largest class; PRVM_PoolString_Free must
+be given the same size
+===============
+*/
+char *PRVM_PoolString_Alloc(prvm_prog_t *prog, size_t size)
+{
+	int c = PRVM_StringPoolClass(size);
+	prog->numpoolstrings++;
+	if (c >= 0)
+	{
+		prog->poolstringbytes += (size_t)1 << (c + PRVM_STRINGPOOL_MINSHIFT);
+		return PRVM_StringPool_Alloc(prog, c, size);
+	}
+	prog->poolstringbytes += size;
+	return (char *)PRVM_Alloc(size);
+}
+
+void PRVM_PoolString_Free(prvm_prog_t *prog, char *s, size_t size)
+{
+	int c = PRVM_StringPoolClass(size);
+	prog->numpoolstrings--;
+	if (c >= 0)
+	{
+		prog->poolstringbytes -= (size_t)1 << (c + PRVM_STRINGPOOL_MINSHIFT);
+		PRVM_StringPool_Free(prog, c, s, size);
+	}
+	else
+	{
+		prog->poolstringbytes -= size;
+		PRVM_Free(s);
+	}
+}
+
 int PRVM_SetEngineString(prvm_prog_t *prog, const char *s)
 {
 	int i;
@@ -3238,8 +3704,9 @@ int PRVM_SetEngineString(prvm_prog_t *prog, const char *s)
 		Host_Error(prog, "PRVM_SetEngineString: s in prog->strings area");
 	// if it's in the tempstrings area, use a reserved range
 	// (otherwise we'd get millions of useless string offsets cluttering the database)
-	if (s >= (char *)prog->tempstringsbuf.data && s < (char *)prog->tempstringsbuf.data + prog->tempstringsbuf.maxsize)
-		return prog->stringssize + (s - (char *)prog->tempstringsbuf.data);
+	for (i = 0;i < prog->tempstringsbuf.numchunks;i++)
+		if (s >= prog->tempstringsbuf.chunks[i] && s < prog->tempstringsbuf.chunks[i] + PRVM_TempStrings_ChunkSize(i))
+			return prog->stringssize + PRVM_TempStrings_ChunkBase(i) + (int)(s - prog->tempstringsbuf.chunks[i]);
 	// see if it's a known string address
 	for (i = 0;i < prog->numknownstrings;i++)
 		if (prog->knownstrings[i] == s)
@@ -3247,34 +3714,10 @@ int PRVM_SetEngineString(prvm_prog_t *prog, const char *s)
 	// new unknown engine string
 	if (developer_insane.integer)
 		Con_DPrintf("new engine string %p = \"%s\"\n", s, s);
-	for (i = prog->firstfreeknownstring;i < prog->numknownstrings;i++)
-		if (!prog->knownstrings[i])
-			break;
-	if (i >= prog->numknownstrings)
-	{
-		if (i >= prog->maxknownstrings)
-		{
-			const char **oldstrings = prog->knownstrings;
-			const unsigned char *oldstrings_freeable = prog->knownstrings_freeable;
-			const char **oldstrings_origin = prog->knownstrings_origin;
-			prog->maxknownstrings += 128;
-			prog->knownstrings = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
-			prog->knownstrings_freeable = (unsigned char *)PRVM_Alloc(prog->maxknownstrings * sizeof(unsigned char));
-			if(prog->leaktest_active)
-				prog->knownstrings_origin = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
-			if (prog->numknownstrings)
-			{
-				memcpy((char **)prog->knownstrings, oldstrings, prog->numknownstrings * sizeof(char *));
-				memcpy((char **)prog->knownstrings_freeable, oldstrings_freeable, prog->numknownstrings * sizeof(unsigned char));
-				if(prog->leaktest_active)
-					memcpy((char **)prog->knownstrings_origin, oldstrings_origin, prog->numknownstrings * sizeof(char *));
-			}
-		}
-		prog->numknownstrings++;
-	}
-	prog->firstfreeknownstring = i + 1;
+	i = PRVM_NewKnownString(prog);
 	prog->knownstrings[i] = s;
 	prog->knownstrings_freeable[i] = false;
+	prog->knownstrings_size[i] = 0;
 	if(prog->leaktest_active)
 		prog->knownstrings_origin[i] = NULL;
 	return PRVM_KNOWNSTRINGBASE + i;
@@ -3282,91 +3725,115 @@ int PRVM_SetEngineString(prvm_prog_t *prog, const char *s)
 
 // temp string handling
 
-// all tempstrings go into this buffer consecutively, and it is reset
+// all tempstrings go into this arena consecutively, and it is reset
 // whenever PRVM_ExecuteProgram returns to the engine
 // (technically each PRVM_ExecuteProgram call saves the cursize value and
 //  restores it on return, so multiple recursive calls can share the same
-//  buffer)
-// the buffer size is automatically grown as needed
+//  arena)
+// the arena grows by adding chunks that double the total size, existing
+// tempstrings are never moved, so builtins can write their result directly
+// into it with PRVM_BeginTempString/PRVM_EndTempString
+
+static void PRVM_TempStrings_Account(prvm_prog_t *prog, int size)
+{
+	prvm_tempstrings_t *t = &prog->tempstringsbuf;
+	if (t->framenum != host_framecount)
+	{
+		t->lastframebytes = t->framenum == host_framecount - 1 ? t->framebytes : 0;
+		t->peakframebytes = max(t->peakframebytes, t->lastframebytes);
+		t->framenum = host_framecount;
+		t->framebytes = 0;
+	}
+	t->framebytes += size;
+}
+
+// returns room for size bytes at the current tempstring offset, skipping to
+// the start of the next chunk if the current one is too small
+static char *PRVM_TempStrings_Reserve(prvm_prog_t *prog, int size)
+{
+	prvm_tempstrings_t *t = &prog->tempstringsbuf;
+	int ofs = t->cursize;
+	int chunk = PRVM_TempStrings_Chunk(ofs);
+	while (ofs + size > PRVM_TempStrings_ChunkBase(chunk) + PRVM_TempStrings_ChunkSize(chunk))
+	{
+		chunk++;
+		if (chunk >= PRVM_TEMPSTRINGS_MAXCHUNKS)
+			Host_Error(prog, "PRVM_SetTempString: ran out of tempstring memory!  (refusing to grow tempstring buffer over %iMB, cursize %i, size %i)\n", (PRVM_TEMPSTRINGS_CHUNKSIZE << (PRVM_TEMPSTRINGS_MAXCHUNKS - 1)) >> 20, t->cursize, size);
+		ofs = PRVM_TempStrings_ChunkBase(chunk);
+	}
+	while (t->numchunks <= chunk)
+	{
+		Con_DPrintf("PRVM_SetTempString: enlarging tempstrings buffer (%iKB -> %iKB)\n", t->maxsize/1024, (t->maxsize + PRVM_TempStrings_ChunkSize(t->numchunks))/1024);
+		t->chunks[t->numchunks] = (char *)Mem_Alloc(prog->progs_mempool, PRVM_TempStrings_ChunkSize(t->numchunks));
+		t->maxsize += PRVM_TempStrings_ChunkSize(t->numchunks);
+		t->numchunks++;
+	}
+	t->cursize = ofs;
+	return t->chunks[chunk] + (ofs - PRVM_TempStrings_ChunkBase(chunk));
+}
 
 int PRVM_SetTempString(prvm_prog_t *prog, const char *s)
 {
-	int size;
+	int size, num;
 	char *t;
 	if (!s)
 		return 0;
 	size = (int)strlen(s) + 1;
 	if (developer_insane.integer)
 		Con_DPrintf("PRVM_SetTempString: cursize %i, size %i\n", prog->tempstringsbuf.cursize, size);
-	if (prog->tempstringsbuf.maxsize < prog->tempstringsbuf.cursize + size)
-	{
-		sizebuf_t old = prog->tempstringsbuf;
-		if (prog->tempstringsbuf.cursize + size >= 1<<30)
-			Host_Error(prog, "PRVM_SetTempString: ran out of tempstring memory!  (refusing to grow tempstring buffer over 1024MB, cursize %i, size %i)\n", prog->tempstringsbuf.cursize, size);
-		prog->tempstringsbuf.maxsize = max(prog->tempstringsbuf.maxsize, 65536);
-		while (prog->tempstringsbuf.maxsize < prog->tempstringsbuf.cursize + size)
-			prog->tempstringsbuf.maxsize *= 2;
-		if (prog->tempstringsbuf.maxsize != old.maxsize || prog->tempstringsbuf.data == NULL)
-		{
-			Con_DPrintf("PRVM_SetTempString: enlarging tempstrings buffer (%iKB -> %iKB)\n", old.maxsize/1024, prog->tempstringsbuf.maxsize/1024);
-			prog->tempstringsbuf.data = (unsigned char *) Mem_Alloc(prog->progs_mempool, prog->tempstringsbuf.maxsize);
-			if (old.data)
-			{
-				if (old.cursize)
-					memcpy(prog->tempstringsbuf.data, old.data, old.cursize);
-				Mem_Free(old.data);
-			}
-		}
-	}
-	t = (char *)prog->tempstringsbuf.data + prog->tempstringsbuf.cursize;
+	t = PRVM_TempStrings_Reserve(prog, size);
 	memcpy(t, s, size);
+	num = prog->stringssize + prog->tempstringsbuf.cursize;
+	prog->tempstringsbuf.cursize += size;
+	PRVM_TempStrings_Account(prog, size);
+	return num;
+}
+
+char *PRVM_BeginTempString(prvm_prog_t *prog, size_t maxsize)
+{
+	char *t = PRVM_TempStrings_Reserve(prog, (int)maxsize);
+	t[0] = 0;
+	return t;
+}
+
+int PRVM_EndTempString(prvm_prog_t *prog, const char *s)
+{
+	int size, num;
+	if (s != PRVM_TempStrings_Pointer(prog, prog->tempstringsbuf.cursize))
+		Host_Error(prog, "PRVM_EndTempString: string was not started with PRVM_BeginTempString");
+	size = (int)strlen(s) + 1;
+	if (developer_insane.integer)
+		Con_DPrintf("PRVM_EndTempString: cursize %i, size %i\n", prog->tempstringsbuf.cursize, size);
+	num = prog->stringssize + prog->tempstringsbuf.cursize;
 	prog->tempstringsbuf.cursize += size;
-	return PRVM_SetEngineString(prog, t);
+	PRVM_TempStrings_Account(prog, size);
+	return num;
 }
 
 int PRVM_AllocString(prvm_prog_t *prog, size_t bufferlength, char **pointer)
 {
-	int i;
+	int i, c;
 	if (!bufferlength)
 	{
 		if (pointer)
 			*pointer = NULL;
 		return 0;
 	}
-	for (i = prog->firstfreeknownstring;i < prog->numknownstrings;i++)
-		if (!prog->knownstrings[i])
-			break;
-	if (i >= prog->numknownstrings)
+	i = PRVM_NewKnownString(prog);
+	c = PRVM_StringPoolClass(bufferlength);
+	if (c >= 0)
 	{
-		if (i >= prog->maxknownstrings)
-		{
-			const char **oldstrings = prog->knownstrings;
-			const unsigned char *oldstrings_freeable = prog->knownstrings_freeable;
-			const char **oldstrings_origin = prog->knownstrings_origin;
-			prog->maxknownstrings += 128;
-			prog->knownstrings = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
-			prog->knownstrings_freeable = (unsigned char *)PRVM_Alloc(prog->maxknownstrings * sizeof(unsigned char));
-			if(prog->leaktest_active)
-				prog->knownstrings_origin = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
-			if (prog->numknownstrings)
-			{
-				memcpy((char **)prog->knownstrings, oldstrings, prog->numknownstrings * sizeof(char *));
-				memcpy((char **)prog->knownstrings_freeable, oldstrings_freeable, prog->numknownstrings * sizeof(unsigned char));
-				if(prog->leaktest_active)
-					memcpy((char **)prog->knownstrings_origin, oldstrings_origin, prog->numknownstrings * sizeof(char *));
-			}
-			if (oldstrings)
-				Mem_Free((char **)oldstrings);
-			if (oldstrings_freeable)
-				Mem_Free((unsigned char *)oldstrings_freeable);
-			if (oldstrings_origin)
-				Mem_Free((char **)oldstrings_origin);
-		}
-		prog->numknownstrings++;
+		prog->knownstrings[i] = PRVM_StringPool_Alloc(prog, c, bufferlength);
+		prog->zonestringbytes += (size_t)1 << (c + PRVM_STRINGPOOL_MINSHIFT);
+	}
+	else
+	{
+		prog->knownstrings[i] = (char *)PRVM_Alloc(bufferlength);
+		prog->zonestringbytes += bufferlength;
 	}
-	prog->firstfreeknownstring = i + 1;
-	prog->knownstrings[i] = (char *)PRVM_Alloc(bufferlength);
 	prog->knownstrings_freeable[i] = true;
+	prog->knownstrings_size[i] = (unsigned int)bufferlength;
+	prog->numzonestrings++;
 	if(prog->leaktest_active)
 		prog->knownstrings_origin[i] = PRVM_AllocationOrigin(prog);
 	if (pointer)
@@ -3376,6 +3843,7 @@ int PRVM_AllocString(prvm_prog_t *prog, size_t bufferlength, char **pointer)
 
 void PRVM_FreeString(prvm_prog_t *prog, int num)
 {
+	int c;
 	if (num == 0)
 		Host_Error(prog, "PRVM_FreeString: attempt to free a NULL string");
 	else if (num >= 0 && num < prog->stringssize)
@@ -3387,13 +3855,25 @@ void PRVM_FreeString(prvm_prog_t *prog, int num)
 			Host_Error(prog, "PRVM_FreeString: attempt to free a non-existent or already freed string");
 		if (!prog->knownstrings_freeable[num])
 			Host_Error(prog, "PRVM_FreeString: attempt to free a string owned by the engine");
-		PRVM_Free((char *)prog->knownstrings[num]);
+		c = PRVM_StringPoolClass(prog->knownstrings_size[num]);
+		if (c >= 0)
+		{
+			PRVM_StringPool_Free(prog, c, (char *)prog->knownstrings[num], prog->knownstrings_size[num]);
+			prog->zonestringbytes -= (size_t)1 << (c + PRVM_STRINGPOOL_MINSHIFT);
+		}
+		else
+		{
+			PRVM_Free((char *)prog->knownstrings[num]);
+			prog->zonestringbytes -= prog->knownstrings_size[num];
+		}
+		prog->numzonestrings--;
 		if(prog->leaktest_active)
 			if(prog->knownstrings_origin[num])
 				PRVM_Free((char *)prog->knownstrings_origin[num]);
 		prog->knownstrings[num] = NULL;
 		prog->knownstrings_freeable[num] = false;
-		prog->firstfreeknownstring = min(prog->firstfreeknownstring, num);
+		prog->knownstrings_size[num] = 0;
+		prog->freeknownstrings[prog->numfreeknownstrings++] = num;
 	}
 	else
 		Host_Error(prog, "PRVM_FreeString: invalid string offset %i", num);
@@ -580,6 +580,8 @@ void PRVM_Profile (prvm_prog_t *prog, int maxfunctions, double mintime, int sort
 			best->callcount = 0;
 		}
 	} while (best);
+
+	Con_Printf("tempstrings: %i bytes last frame, %i bytes peak frame, %iKB arena in %i chunks\n", prog->tempstringsbuf.lastframebytes, prog->tempstringsbuf.peakframebytes, prog->tempstringsbuf.maxsize / 1024, prog->tempstringsbuf.numchunks);
 }
 
 /*
@@ -909,6 +911,7 @@ void MVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessag
 	// these do not change
 	mstatement_t *cached_statements = prog->statements;
 	qboolean cached_allowworldwrites = prog->allowworldwrites;
+	unsigned char *cached_fieldchangetracked = prog->fieldchangetracked;
 	unsigned int cached_flag = prog->flag;
 
 	calltime = Sys_DirtyTime();
@@ -1016,6 +1019,7 @@ void CLVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessa
 	// these do not change
 	mstatement_t *cached_statements = prog->statements;
 	qboolean cached_allowworldwrites = prog->allowworldwrites;
+	unsigned char *cached_fieldchangetracked = prog->fieldchangetracked;
 	unsigned int cached_flag = prog->flag;
 
 	calltime = Sys_DirtyTime();
@@ -1127,6 +1131,7 @@ void PRVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessa
 	// these do not change
 	mstatement_t *cached_statements = prog->statements;
 	qboolean cached_allowworldwrites = prog->allowworldwrites;
+	unsigned char *cached_fieldchangetracked = prog->fieldchangetracked;
 	unsigned int cached_flag = prog->flag;
 
 	calltime = Sys_DirtyTime();
@@ -580,6 +580,8 @@
 				}
 #endif
 				OPC->_int = OPA->edict * cached_entityfields + OPB->_int;
+				if (cached_fieldchangetracked && cached_fieldchangetracked[OPB->_int])
+					prog->edictschanged[OPA->edict] = true;
 				DISPATCH_OPCODE();
 
 			HANDLE_OPCODE(OP_LOAD_F):
@@ -776,6 +778,7 @@
 					PRVM_gameedictfloat(ed,nextthink) = PRVM_gameglobalfloat(time) + 0.1;
 					PRVM_gameedictfloat(ed,frame) = OPA->_float;
 					PRVM_gameedictfunction(ed,think) = OPB->function;
+					PRVM_ED_MarkChanged(prog, ed);
 				}
 				else
 				{
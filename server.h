@@ -145,6 +145,13 @@ typedef struct server_s
 	/// LordHavoc: increased signon message buffer from 8192
 	unsigned char signon_buf[NET_MAXMESSAGE];
 
+	/// precache lists of the svc_serverinfo message shared by all
+	/// connecting clients, rebuilt by SV_WriteServerinfo when
+	/// serverinfo_valid is cleared (by adding a precache)
+	sizebuf_t serverinfo;
+	unsigned char serverinfo_buf[NET_MAXMESSAGE];
+	qboolean serverinfo_valid;
+
 	/// connection flood blocking
 	/// note this is in server_t rather than server_static_t so that it is
 	/// reset on each map command (such as New Game in singleplayer)
@@ -165,12 +172,17 @@ typedef struct server_s
 	int writeentitiestoclient_numeyes;
 	int writeentitiestoclient_pvsbytes;
 	unsigned char *writeentitiestoclient_pvs;
+	/// PVS culling results shared with other clients with the same PVS this frame (NULL if not shared)
+	unsigned char *writeentitiestoclient_pvsvisible;
 	const entity_state_t *writeentitiestoclient_sendstates[MAX_EDICTS];
 	unsigned short writeentitiestoclient_csqcsendstates[MAX_EDICTS];
 
 	int numsendentities;
 	entity_state_t sendentities[MAX_EDICTS];
 	entity_state_t *sendentitiesindex[MAX_EDICTS];
+	/// false forces SV_PrepareEntitiesForSending to prepare every entity again (e.g. after a late model precache)
+	qboolean preparedentities_valid;
+	int preparedentities_onlycsqcnetworking;
 
 	int sententitiesmark;
 	int sententities[MAX_EDICTS];
@@ -215,6 +227,16 @@ typedef struct client_s
 	/// temporarily exceed rate by this amount of bytes
 	int rate_burstsize;
 
+	/// sv_congestioncontrol estimate of the bytes per second the link takes
+	/// without loss or queueing, never above rate
+	double congestion_rate;
+	double congestion_nextupdate;
+	/// lowest ping seen, queueing delay shows up as ping above this
+	float congestion_minping;
+	/// entity frames acked and lost since congestion_nextupdate was set
+	int congestion_ackedframes;
+	int congestion_lostframes;
+
 	/// realtime this client connected
 	double connecttime;
 
@@ -443,6 +465,12 @@ extern cvar_t sv_clmovement_maxnetfps;
 extern cvar_t sv_cullentities_nevercullbmodels;
 extern cvar_t sv_cullentities_pvs;
 extern cvar_t sv_cullentities_stats;
+extern cvar_t sv_entitydeltacache;
+extern cvar_t sv_netlod;
+extern cvar_t sv_netlod_classstats;
+extern cvar_t sv_netlod_distance;
+extern cvar_t sv_netlod_interval;
+extern cvar_t sv_netlod_precision;
 extern cvar_t sv_cullentities_trace;
 extern cvar_t sv_cullentities_trace_delay;
 extern cvar_t sv_cullentities_trace_enlarge;
@@ -530,6 +558,7 @@ void SV_StartSound (prvm_edict_t *entity, int channel, const char *sample, int v
 void SV_StartPointSound (vec3_t origin, const char *sample, int volume, float attenuation, float speed);
 
 void SV_ConnectClient (int clientnum, netconn_t *netconnection);
+void SV_SelectNetCompression(netconn_t *conn, const char *codecs);
 void SV_DropClient (qboolean crash);
 
 void SV_SendClientMessages(void);
@@ -613,6 +642,7 @@ const char *Host_TimingReport(char *buf, size_t buflen); ///< for output in Host
 
 int SV_GetPitchSign(prvm_prog_t *prog, prvm_edict_t *ent);
 void SV_GetEntityMatrix(prvm_prog_t *prog, prvm_edict_t *ent, matrix4x4_t *out, qboolean viewmatrix);
+void SV_CullTraces_StopThreads(void);
 
 #ifndef CONFIG_SV
 void SV_StartThread(void);
@@ -1005,11 +1005,16 @@ S_FreeSfx
 void S_FreeSfx (sfx_t *sfx, qboolean force)
 {
 	unsigned int i;
+	sfx_t *alias, *owner = NULL;
 
 	// Do not free a precached sound during purge
 	if (!force && (sfx->flags & (SFXFLAG_LEVELSOUND | SFXFLAG_MENUSOUND)))
 		return;
 
+	// Nor one whose data other sounds are still using
+	if (!force && sfx->contentrefs > 0)
+		return;
+
 	if (developer_loading.integer)
 		Con_Printf ("unloading sound %s\n", sfx->name);
 
@@ -1043,6 +1048,34 @@ void S_FreeSfx (sfx_t *sfx, qboolean force)
 		}
 	}
 
+	// Sounds sharing the data of this one keep it, the first of them takes
+	// it over and the others become its aliases
+	for (alias = known_sfx; alias != NULL && sfx->contentrefs > 0; alias = alias->next)
+	{
+		if (alias->fetcher != &content_alias_fetcher || alias->fetcher_data != sfx)
+			continue;
+		for (i = 0; i < total_channels; i++)
+			if (channels[i].sfx == alias)
+				S_StopChannel (i, true, false);
+		sfx->contentrefs--;
+		if (owner == NULL)
+		{
+			owner = alias;
+			owner->memsize = sfx->memsize;
+			strlcpy (owner->contentkey, sfx->contentkey, sizeof (owner->contentkey));
+			strlcpy (owner->contentfile, sfx->contentfile, sizeof (owner->contentfile));
+			owner->fetcher_data = sfx->fetcher_data;
+			owner->fetcher = sfx->fetcher;
+			sfx->fetcher = NULL;
+			sfx->fetcher_data = NULL;
+		}
+		else
+		{
+			alias->fetcher_data = owner;
+			owner->contentrefs++;
+		}
+	}
+
 	// Free it
 	if (sfx->fetcher != NULL && sfx->fetcher->freesfx != NULL)
 		sfx->fetcher->freesfx(sfx);
@@ -1050,6 +1083,25 @@ void S_FreeSfx (sfx_t *sfx, qboolean force)
 }
 
 
+/*
+==================
+S_FindSfxContent
+
+Returns the loaded sfx with the same contents as filename, whose
+FS_FileContentKey is contentkey, if there is one
+==================
+*/
+sfx_t *S_FindSfxContent (const char *contentkey, const char *filename)
+{
+	sfx_t *sfx;
+
+	for (sfx = known_sfx; sfx != NULL; sfx = sfx->next)
+		if (sfx->fetcher != NULL && sfx->fetcher != &content_alias_fetcher && !strcmp (sfx->contentkey, contentkey) && FS_FileContentEqual (sfx->contentfile, filename))
+			return sfx;
+	return NULL;
+}
+
+
 /*
 ==================
 S_ClearUsed
@@ -74,6 +74,10 @@ struct sfx_s
 
 	float				volume_mult;    // for replay gain (multiplier to apply)
 	float				volume_peak;    // for replay gain (highest peak); if set to 0, ReplayGain isn't supported
+
+	char				contentkey[FS_CONTENTKEY_SIZE];	// FS_FileContentKey of the loaded file, empty if it has no copies
+	char				contentfile[MAX_QPATH + 16];	// the file that was loaded, to compare contents with (cf FS_FileContentEqual)
+	int					contentrefs;	// number of sfx playing the data of this one (cf content_alias_fetcher)
 };
 
 // maximum supported speakers constant
@@ -116,6 +120,9 @@ struct snd_fetcher_s
 	snd_fetcher_freesfx_t		freesfx;
 };
 
+// plays the data of the sfx in fetcher_data, for files with the same contents
+extern const snd_fetcher_t content_alias_fetcher;
+
 extern unsigned int total_channels;
 extern channel_t channels[MAX_CHANNELS];
 
@@ -153,6 +160,7 @@ extern qboolean simsound;
 void S_MixToBuffer(void *stream, unsigned int frames);
 
 qboolean S_LoadSound (sfx_t *sfx, qboolean complain);
+sfx_t *S_FindSfxContent (const char *contentkey, const char *filename);
 
 snd_buffer_t *Snd_CreateSndBuffer (const unsigned char *samples, unsigned int sampleframes, const snd_format_t* in_format, unsigned int sb_speed);
 qboolean Snd_AppendToSndBuffer (snd_buffer_t* sb, const unsigned char *samples, unsigned int sampleframes, const snd_format_t* format);
@@ -296,6 +296,77 @@ qboolean Snd_AppendToSndBuffer (snd_buffer_t* sb, const unsigned char *samples,
 
 //=============================================================================
 
+/*
+==============
+Content aliases
+
+A sound file with the same contents as an already loaded one (the same
+sample shipped under several names or in several packs) doesn't get its own
+copy, the sfx plays the samples of the loaded one instead.
+==============
+*/
+static void S_ContentAlias_GetSamplesFloat (channel_t *ch, sfx_t *sfx, int firstsampleframe, int numsampleframes, float *outsamplesfloat)
+{
+	sfx_t *source = (sfx_t *)sfx->fetcher_data;
+	source->fetcher->getsamplesfloat (ch, source, firstsampleframe, numsampleframes, outsamplesfloat);
+}
+
+static void S_ContentAlias_StopChannel (channel_t *ch)
+{
+	sfx_t *source = (sfx_t *)ch->sfx->fetcher_data;
+	if (source->fetcher->stopchannel != NULL)
+		source->fetcher->stopchannel (ch);
+}
+
+static void S_ContentAlias_FreeSfx (sfx_t *sfx)
+{
+	sfx_t *source = (sfx_t *)sfx->fetcher_data;
+	source->contentrefs--;
+}
+
+const snd_fetcher_t content_alias_fetcher = { S_ContentAlias_GetSamplesFloat, S_ContentAlias_StopChannel, S_ContentAlias_FreeSfx };
+
+/*
+==============
+S_LoadSoundFile
+
+Loads filename with loadfile, unless a sound with the same contents is
+loaded already
+==============
+*/
+static qboolean S_LoadSoundFile (sfx_t *sfx, const char *filename, qboolean (*loadfile) (const char *filename, sfx_t *sfx))
+{
+	char contentkey[FS_CONTENTKEY_SIZE];
+	sfx_t *source;
+
+	if (!FS_FileContentKey (filename, contentkey, sizeof (contentkey)))
+		return loadfile (filename, sfx);
+
+	source = S_FindSfxContent (contentkey, filename);
+	if (source == NULL)
+	{
+		if (!loadfile (filename, sfx))
+			return false;
+		strlcpy (sfx->contentkey, contentkey, sizeof (sfx->contentkey));
+		strlcpy (sfx->contentfile, filename, sizeof (sfx->contentfile));
+		return true;
+	}
+
+	if (developer_loading.integer)
+		Con_Printf ("sound %s has the same contents as %s, sharing it\n", sfx->name, source->name);
+	sfx->format = source->format;
+	sfx->flags |= source->flags & SFXFLAG_STREAMED;
+	sfx->loopstart = source->loopstart;
+	sfx->total_length = source->total_length;
+	sfx->volume_mult = source->volume_mult;
+	sfx->volume_peak = source->volume_peak;
+	sfx->fetcher_data = source;
+	source->contentrefs++;
+	// set last, the mixer may be looking at this sfx already
+	sfx->fetcher = &content_alias_fetcher;
+	return true;
+}
+
 /*
 ==============
 S_LoadSound
@@ -334,13 +405,13 @@ qboolean S_LoadSound (sfx_t *sfx, qboolean complain)
 		len = strlen(namebuffer);
 		if (len >= 4 && !strcasecmp (namebuffer + len - 4, ".wav"))
 		{
-			if (S_LoadWavFile (namebuffer, sfx))
+			if (S_LoadSoundFile (sfx, namebuffer, S_LoadWavFile))
 				goto loaded;
 			memcpy (namebuffer + len - 3, "ogg", 4);
 		}
 		if (len >= 4 && (!strcasecmp (namebuffer + len - 4, ".ogg") || !strcasecmp (namebuffer + len - 4, ".ogv")))
 		{
-			if (OGG_LoadVorbisFile (namebuffer, sfx))
+			if (S_LoadSoundFile (sfx, namebuffer, OGG_LoadVorbisFile))
 				goto loaded;
 		}
 	}
@@ -353,13 +424,13 @@ qboolean S_LoadSound (sfx_t *sfx, qboolean complain)
 	// request foo.mod: tries foo.mod only
 	if (len >= 4 && !strcasecmp (namebuffer + len - 4, ".wav"))
 	{
-		if (S_LoadWavFile (namebuffer, sfx))
+		if (S_LoadSoundFile (sfx, namebuffer, S_LoadWavFile))
 			goto loaded;
 		memcpy (namebuffer + len - 3, "ogg", 4);
 	}
 	if (len >= 4 && (!strcasecmp (namebuffer + len - 4, ".ogg") || !strcasecmp (namebuffer + len - 4, ".ogv")))
 	{
-		if (OGG_LoadVorbisFile (namebuffer, sfx))
+		if (S_LoadSoundFile (sfx, namebuffer, OGG_LoadVorbisFile))
 			goto loaded;
 	}
 
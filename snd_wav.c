@@ -38,10 +38,10 @@ typedef struct wavinfo_s
 } wavinfo_t;
 
 
-static unsigned char *data_p;
-static unsigned char *iff_end;
-static unsigned char *last_chunk;
-static unsigned char *iff_data;
+static const unsigned char *data_p;
+static const unsigned char *iff_end;
+static const unsigned char *last_chunk;
+static const unsigned char *iff_data;
 static int iff_chunk_len;
 
 
@@ -71,7 +71,8 @@ static void FindNextChunk(const char *name)
 	{
 		data_p=last_chunk;
 
-		if (data_p >= iff_end)
+		// the 8 byte chunk header has to fit too, the file may be mapped
+		if (iff_end - data_p < 8)
 		{	// didn't find the chunk
 			data_p = NULL;
 			return;
@@ -128,7 +129,7 @@ static void DumpChunks(void)
 GetWavinfo
 ============
 */
-static wavinfo_t GetWavinfo (char *name, unsigned char *wav, int wavlength)
+static wavinfo_t GetWavinfo (char *name, const unsigned char *wav, int wavlength)
 {
 	wavinfo_t info;
 	int i;
@@ -145,7 +146,7 @@ static wavinfo_t GetWavinfo (char *name, unsigned char *wav, int wavlength)
 
 	// find "RIFF" chunk
 	FindChunk("RIFF");
-	if (!(data_p && !strncmp((const char *)data_p+8, "WAVE", 4)))
+	if (!(data_p && iff_chunk_len >= 4 && !strncmp((const char *)data_p+8, "WAVE", 4)))
 	{
 		Con_Print("Missing RIFF/WAVE chunks\n");
 		return info;
@@ -156,7 +157,7 @@ static wavinfo_t GetWavinfo (char *name, unsigned char *wav, int wavlength)
 	//DumpChunks ();
 
 	FindChunk("fmt ");
-	if (!data_p)
+	if (!data_p || iff_chunk_len < 16)
 	{
 		Con_Print("Missing fmt chunk\n");
 		return info;
@@ -176,14 +177,14 @@ static wavinfo_t GetWavinfo (char *name, unsigned char *wav, int wavlength)
 
 	// get cue chunk
 	FindChunk("cue ");
-	if (data_p)
+	if (data_p && iff_chunk_len >= 28)
 	{
 		data_p += 32;
 		info.loopstart = GetLittleLong();
 
 		// if the next chunk is a LIST chunk, look for a cue length marker
 		FindNextChunk ("LIST");
-		if (data_p)
+		if (data_p && iff_chunk_len >= 24)
 		{
 			if (!strncmp ((const char *)data_p + 28, "mark", 4))
 			{	// this is not a proper parse, but it works with cooledit...
@@ -268,7 +269,8 @@ S_LoadWavFile
 qboolean S_LoadWavFile (const char *filename, sfx_t *sfx)
 {
 	fs_offset_t filesize;
-	unsigned char *data;
+	const unsigned char *data;
+	fs_mappedfile_t *mapping;
 	wavinfo_t info;
 	int i, len;
 	const unsigned char *inb;
@@ -279,14 +281,15 @@ qboolean S_LoadWavFile (const char *filename, sfx_t *sfx)
 		return true;
 
 	// Load the file
-	data = FS_LoadFile(filename, snd_mempool, false, &filesize);
+	// the samples are converted into fetcher_data anyway, so read them from a mapping
+	data = FS_MapFile(filename, false, &filesize, &mapping);
 	if (!data)
 		return false;
 
 	// Don't try to load it if it's not a WAV file
-	if (memcmp (data, "RIFF", 4) || memcmp (data + 8, "WAVE", 4))
+	if (filesize < 12 || memcmp (data, "RIFF", 4) || memcmp (data + 8, "WAVE", 4))
 	{
-		Mem_Free(data);
+		FS_UnmapFile(mapping);
 		return false;
 	}
 
@@ -297,7 +300,7 @@ qboolean S_LoadWavFile (const char *filename, sfx_t *sfx)
 	if (info.channels < 1 || info.channels > 2)  // Stereo sounds are allowed (intended for music)
 	{
 		Con_Printf("%s has an unsupported number of channels (%i)\n",sfx->name, info.channels);
-		Mem_Free(data);
+		FS_UnmapFile(mapping);
 		return false;
 	}
 	//if (info.channels == 2)
@@ -336,6 +339,7 @@ qboolean S_LoadWavFile (const char *filename, sfx_t *sfx)
 		for (i = 0;i < len;i++)
 			outb[i] = inb[i] - 0x80;
 	}
+	FS_UnmapFile(mapping);
 
 	if (info.loopstart < 0)
 		sfx->loopstart = sfx->total_length;
@@ -1,7 +1,11 @@
+#include <stddef.h>
 #include "quakedef.h"
 #include "sv_demo.h"
+#include "thread.h"
 
 extern cvar_t sv_autodemo_perclient_discardable;
+extern cvar_t sv_autodemo_multiview;
+extern cvar_t sv_autodemo_multiview_nameformat;
 
 void SV_StartDemoRecording(client_t *client, const char *filename, int forcetrack)
 {
@@ -97,3 +101,623 @@ void SV_WriteNetnameIntoDemo(client_t *client)
 	MSG_WriteString(&buf, "\n");
 	SV_WriteDemoMessage(client, &buf, false);
 }
+
+/*
+==============================================================================
+
+MULTI-VIEW DEMOS
+
+sv_autodemo_multiview records each match into a single file holding the
+states of all network entities once per frame, plus the reliable messages,
+stats, view angles and the rest of the datagrams of each client, so
+recording every player costs about as much as one per-client demo.
+sv_multiviewdemo_extract turns the point of view of one player into a normal
+demo the client can play.
+
+File layout: "DPMVDEM1", [int] protocol, [int] size of the recorded part of
+entity_state_t, then records of [byte] type [int] length [data]:
+MVDEMO_ENTITIES      for each changed entity [short] number, [8 bytes] mask
+                     of changed 32bit words of the state and those words,
+                     [short] number|0x8000 for removed entities, [short]
+                     0x8000 ends the list
+MVDEMO_CLIENTCONNECT [byte] client [string] name
+MVDEMO_RELIABLE      [byte] client [reliable message]
+MVDEMO_DATAGRAM      [byte] client [3 floats] view angles [short] number of
+                     changed stats, each as [byte] stat [int] value, then
+                     the datagram up to the entity updates
+
+The file is written by a background thread from a ring of buffers, the
+server only copies the records into them.  csqc entities, complex animation
+and per-client customizeentityforclient changes are not recorded, entities
+are not culled for the extracted player either.
+==============================================================================
+*/
+
+#define MVDEMO_MAGIC "DPMVDEM1"
+#define MVDEMO_ENTITIES 1
+#define MVDEMO_CLIENTCONNECT 2
+#define MVDEMO_RELIABLE 3
+#define MVDEMO_DATAGRAM 4
+
+// the recorded part of entity_state_t (the rest is animation data with
+// pointers in it)
+#define MVDEMO_STATESIZE ((int)offsetof(entity_state_t, framegroupblend))
+#define MVDEMO_STATEWORDS (MVDEMO_STATESIZE / 4)
+
+#define MVDEMO_BUFFERSIZE (256*1024)
+#define MVDEMO_NUMBUFFERS 8
+
+typedef struct sv_mvdemo_s
+{
+	qfile_t *file;
+	char filename[MAX_OSPATH];
+	// entity states as of the last MVDEMO_ENTITIES record
+	entity_state_t *states; // [MAX_EDICTS]
+	int numstates;
+	// stats as of the last MVDEMO_DATAGRAM record of each client
+	int (*stats)[MAX_CL_STATS]; // [svs.maxclients]
+	// record being built
+	unsigned char *record;
+	size_t recordsize;
+	size_t recordmaxsize;
+	// ring of buffers, filled by the server and written by the thread
+	unsigned char *buffers[MVDEMO_NUMBUFFERS];
+	int bufferlength[MVDEMO_NUMBUFFERS];
+	int fill;
+	int flush; // protected by mutex
+	int numqueued; // protected by mutex
+	qboolean quit; // protected by mutex
+	void *thread;
+	void *mutex;
+	void *wakecond;
+	void *donecond;
+}
+sv_mvdemo_t;
+
+static sv_mvdemo_t sv_mvdemo;
+
+static int SV_MultiViewDemo_Thread(void *unused)
+{
+	int i;
+	Thread_LockMutex(sv_mvdemo.mutex);
+	for (;;)
+	{
+		while (!sv_mvdemo.numqueued && !sv_mvdemo.quit)
+			Thread_CondWait(sv_mvdemo.wakecond, sv_mvdemo.mutex);
+		if (!sv_mvdemo.numqueued)
+			break;
+		i = sv_mvdemo.flush;
+		Thread_UnlockMutex(sv_mvdemo.mutex);
+		FS_Write(sv_mvdemo.file, sv_mvdemo.buffers[i], sv_mvdemo.bufferlength[i]);
+		Thread_LockMutex(sv_mvdemo.mutex);
+		sv_mvdemo.flush = (i + 1) % MVDEMO_NUMBUFFERS;
+		sv_mvdemo.numqueued--;
+		Thread_CondBroadcast(sv_mvdemo.donecond);
+	}
+	Thread_UnlockMutex(sv_mvdemo.mutex);
+	return 0;
+}
+
+// hands the buffer being filled to the writer thread and moves on to the
+// next free one
+static void SV_MultiViewDemo_SubmitBuffer(void)
+{
+	if (!sv_mvdemo.bufferlength[sv_mvdemo.fill])
+		return;
+	if (!sv_mvdemo.thread)
+	{
+		FS_Write(sv_mvdemo.file, sv_mvdemo.buffers[sv_mvdemo.fill], sv_mvdemo.bufferlength[sv_mvdemo.fill]);
+		sv_mvdemo.bufferlength[sv_mvdemo.fill] = 0;
+		return;
+	}
+	Thread_LockMutex(sv_mvdemo.mutex);
+	sv_mvdemo.numqueued++;
+	Thread_CondBroadcast(sv_mvdemo.wakecond);
+	while (sv_mvdemo.numqueued >= MVDEMO_NUMBUFFERS)
+		Thread_CondWait(sv_mvdemo.donecond, sv_mvdemo.mutex);
+	Thread_UnlockMutex(sv_mvdemo.mutex);
+	sv_mvdemo.fill = (sv_mvdemo.fill + 1) % MVDEMO_NUMBUFFERS;
+	sv_mvdemo.bufferlength[sv_mvdemo.fill] = 0;
+}
+
+static void SV_MultiViewDemo_Append(const void *data, size_t size)
+{
+	const unsigned char *in = (const unsigned char *)data;
+	size_t n;
+	while (size)
+	{
+		if (sv_mvdemo.bufferlength[sv_mvdemo.fill] == MVDEMO_BUFFERSIZE)
+			SV_MultiViewDemo_SubmitBuffer();
+		n = min(size, (size_t)(MVDEMO_BUFFERSIZE - sv_mvdemo.bufferlength[sv_mvdemo.fill]));
+		memcpy(sv_mvdemo.buffers[sv_mvdemo.fill] + sv_mvdemo.bufferlength[sv_mvdemo.fill], in, n);
+		sv_mvdemo.bufferlength[sv_mvdemo.fill] += (int)n;
+		in += n;
+		size -= n;
+	}
+}
+
+static void SV_MultiViewDemo_RecordData(const void *data, size_t size)
+{
+	if (sv_mvdemo.recordsize + size > sv_mvdemo.recordmaxsize)
+	{
+		sv_mvdemo.recordmaxsize = max(sv_mvdemo.recordmaxsize * 2, sv_mvdemo.recordsize + size);
+		sv_mvdemo.record = (unsigned char *)Mem_Realloc(sv_mempool, sv_mvdemo.record, sv_mvdemo.recordmaxsize);
+	}
+	memcpy(sv_mvdemo.record + sv_mvdemo.recordsize, data, size);
+	sv_mvdemo.recordsize += size;
+}
+
+static void SV_MultiViewDemo_RecordShort(int i)
+{
+	unsigned char b[2];
+	b[0] = i & 0xFF;
+	b[1] = (i >> 8) & 0xFF;
+	SV_MultiViewDemo_RecordData(b, 2);
+}
+
+static void SV_MultiViewDemo_RecordLong(int i)
+{
+	unsigned char b[4];
+	StoreLittleLong(b, i);
+	SV_MultiViewDemo_RecordData(b, 4);
+}
+
+static void SV_MultiViewDemo_BeginRecord(int type)
+{
+	unsigned char header[5];
+	sv_mvdemo.recordsize = 0;
+	// length is filled in by EndRecord
+	memset(header, 0, sizeof(header));
+	header[0] = type;
+	SV_MultiViewDemo_RecordData(header, sizeof(header));
+}
+
+static void SV_MultiViewDemo_EndRecord(void)
+{
+	StoreLittleLong(sv_mvdemo.record + 1, (int)sv_mvdemo.recordsize - 5);
+	SV_MultiViewDemo_Append(sv_mvdemo.record, sv_mvdemo.recordsize);
+}
+
+void SV_MultiViewDemo_Start(void)
+{
+	char timestr[128];
+	int i;
+
+	SV_MultiViewDemo_Stop();
+	if (!sv_autodemo_multiview.integer)
+		return;
+	if (sv.protocol != PROTOCOL_DARKPLACES5 && sv.protocol != PROTOCOL_DARKPLACES6 && sv.protocol != PROTOCOL_DARKPLACES7)
+	{
+		Con_Printf("sv_autodemo_multiview needs protocol DP5 or later\n");
+		return;
+	}
+
+	Cvar_LockThreadMutex();
+	dpsnprintf(sv_mvdemo.filename, sizeof(sv_mvdemo.filename), "%s_%s.mvdem", Sys_TimeString(sv_autodemo_multiview_nameformat.string, timestr, sizeof(timestr)), sv.worldbasename);
+	Cvar_UnlockThreadMutex();
+	sv_mvdemo.file = FS_OpenRealFile(sv_mvdemo.filename, "wb", false);
+	if (!sv_mvdemo.file)
+	{
+		Con_Printf("ERROR: couldn't open multi-view demo %s.\n", sv_mvdemo.filename);
+		return;
+	}
+	Con_Printf("Recording multi-view demo to %s\n", sv_mvdemo.filename);
+
+	sv_mvdemo.states = (entity_state_t *)Mem_Alloc(sv_mempool, MAX_EDICTS * sizeof(entity_state_t));
+	sv_mvdemo.numstates = 0;
+	sv_mvdemo.stats = (int (*)[MAX_CL_STATS])Mem_Alloc(sv_mempool, svs.maxclients * sizeof(*sv_mvdemo.stats));
+	for (i = 0;i < MVDEMO_NUMBUFFERS;i++)
+	{
+		sv_mvdemo.buffers[i] = (unsigned char *)Mem_Alloc(sv_mempool, MVDEMO_BUFFERSIZE);
+		sv_mvdemo.bufferlength[i] = 0;
+	}
+	sv_mvdemo.fill = sv_mvdemo.flush = sv_mvdemo.numqueued = 0;
+	sv_mvdemo.quit = false;
+	if (Thread_HasThreads())
+	{
+		sv_mvdemo.mutex = Thread_CreateMutex();
+		sv_mvdemo.wakecond = Thread_CreateCond();
+		sv_mvdemo.donecond = Thread_CreateCond();
+		sv_mvdemo.thread = Thread_CreateThread(SV_MultiViewDemo_Thread, NULL);
+	}
+
+	SV_MultiViewDemo_Append(MVDEMO_MAGIC, 8);
+	sv_mvdemo.recordsize = 0;
+	SV_MultiViewDemo_RecordLong(sv.protocol);
+	SV_MultiViewDemo_RecordLong(MVDEMO_STATESIZE);
+	SV_MultiViewDemo_Append(sv_mvdemo.record, sv_mvdemo.recordsize);
+}
+
+void SV_MultiViewDemo_Stop(void)
+{
+	int i;
+
+	if (!sv_mvdemo.file)
+		return;
+
+	SV_MultiViewDemo_SubmitBuffer();
+	if (sv_mvdemo.thread)
+	{
+		Thread_LockMutex(sv_mvdemo.mutex);
+		sv_mvdemo.quit = true;
+		Thread_CondBroadcast(sv_mvdemo.wakecond);
+		Thread_UnlockMutex(sv_mvdemo.mutex);
+		Thread_WaitThread(sv_mvdemo.thread, 0);
+		Thread_DestroyCond(sv_mvdemo.donecond);
+		Thread_DestroyCond(sv_mvdemo.wakecond);
+		Thread_DestroyMutex(sv_mvdemo.mutex);
+		sv_mvdemo.thread = NULL;
+	}
+	FS_Close(sv_mvdemo.file);
+	sv_mvdemo.file = NULL;
+	Con_Printf("Stopped recording multi-view demo %s\n", sv_mvdemo.filename);
+
+	for (i = 0;i < MVDEMO_NUMBUFFERS;i++)
+	{
+		Mem_Free(sv_mvdemo.buffers[i]);
+		sv_mvdemo.buffers[i] = NULL;
+	}
+	Mem_Free(sv_mvdemo.states);
+	sv_mvdemo.states = NULL;
+	Mem_Free(sv_mvdemo.stats);
+	sv_mvdemo.stats = NULL;
+	if (sv_mvdemo.record)
+		Mem_Free(sv_mvdemo.record);
+	sv_mvdemo.record = NULL;
+	sv_mvdemo.recordmaxsize = 0;
+}
+
+// writes the changes of sv.sendentities since the last call
+void SV_MultiViewDemo_WriteEntities(void)
+{
+	int i, j, num, oldnumstates;
+	unsigned long long mask;
+	entity_state_t n;
+	entity_state_t *o;
+	const unsigned int *nw;
+	unsigned int *ow;
+	unsigned char maskbytes[8];
+
+	if (!sv_mvdemo.file)
+		return;
+
+	SV_MultiViewDemo_BeginRecord(MVDEMO_ENTITIES);
+	oldnumstates = sv_mvdemo.numstates;
+	num = 1;
+	for (i = 0;i <= sv.numsendentities;i++)
+	{
+		// the extra iteration removes everything past the last entity
+		int end = i < sv.numsendentities ? sv.sendentities[i].number : oldnumstates;
+		for (;num < end;num++)
+		{
+			o = sv_mvdemo.states + num;
+			if (o->active)
+			{
+				memset(o, 0, MVDEMO_STATESIZE);
+				SV_MultiViewDemo_RecordShort(num | 0x8000);
+			}
+		}
+		if (i == sv.numsendentities)
+			break;
+		if (sv.sendentities[i].active != ACTIVE_NETWORK)
+			continue;
+		// time changes every frame and is not used for sending
+		n = sv.sendentities[i];
+		n.time = 0;
+		o = sv_mvdemo.states + num;
+		nw = (const unsigned int *)&n;
+		ow = (unsigned int *)o;
+		mask = 0;
+		for (j = 0;j < MVDEMO_STATEWORDS;j++)
+			if (nw[j] != ow[j])
+				mask |= 1ull << j;
+		if (mask)
+		{
+			SV_MultiViewDemo_RecordShort(num);
+			for (j = 0;j < 8;j++)
+				maskbytes[j] = (unsigned char)(mask >> (j * 8));
+			SV_MultiViewDemo_RecordData(maskbytes, 8);
+			for (j = 0;j < MVDEMO_STATEWORDS;j++)
+			{
+				if (mask & (1ull << j))
+				{
+					ow[j] = nw[j];
+					SV_MultiViewDemo_RecordData(nw + j, 4);
+				}
+			}
+		}
+		num++;
+		sv_mvdemo.numstates = max(sv_mvdemo.numstates, num);
+	}
+	SV_MultiViewDemo_RecordShort(0x8000);
+	SV_MultiViewDemo_EndRecord();
+}
+
+void SV_MultiViewDemo_ClientConnect(client_t *client)
+{
+	unsigned char clientnum = (unsigned char)(client - svs.clients);
+
+	if (!sv_mvdemo.file)
+		return;
+	memset(sv_mvdemo.stats[clientnum], 0, sizeof(sv_mvdemo.stats[0]));
+	SV_MultiViewDemo_BeginRecord(MVDEMO_CLIENTCONNECT);
+	SV_MultiViewDemo_RecordData(&clientnum, 1);
+	SV_MultiViewDemo_RecordData(client->name, strlen(client->name) + 1);
+	SV_MultiViewDemo_EndRecord();
+}
+
+void SV_MultiViewDemo_WriteReliable(client_t *client, const sizebuf_t *msg)
+{
+	unsigned char clientnum = (unsigned char)(client - svs.clients);
+
+	if (!sv_mvdemo.file || !msg->cursize)
+		return;
+	SV_MultiViewDemo_BeginRecord(MVDEMO_RELIABLE);
+	SV_MultiViewDemo_RecordData(&clientnum, 1);
+	SV_MultiViewDemo_RecordData(msg->data, msg->cursize);
+	SV_MultiViewDemo_EndRecord();
+}
+
+// msg holds the datagram of the client up to the entity updates
+void SV_MultiViewDemo_WriteDatagram(client_t *client, const sizebuf_t *msg, const int *stats)
+{
+	prvm_prog_t *prog = SVVM_prog;
+	unsigned char clientnum = (unsigned char)(client - svs.clients);
+	unsigned char statnum;
+	int i, numchanged;
+	int *oldstats;
+	float f;
+
+	if (!sv_mvdemo.file)
+		return;
+	oldstats = sv_mvdemo.stats[clientnum];
+	SV_MultiViewDemo_BeginRecord(MVDEMO_DATAGRAM);
+	SV_MultiViewDemo_RecordData(&clientnum, 1);
+	for (i = 0;i < 3;i++)
+	{
+		f = LittleFloat(PRVM_serveredictvector(client->edict, v_angle)[i]);
+		SV_MultiViewDemo_RecordData(&f, 4);
+	}
+	for (i = 0, numchanged = 0;i < MAX_CL_STATS;i++)
+		if (oldstats[i] != stats[i])
+			numchanged++;
+	SV_MultiViewDemo_RecordShort(numchanged);
+	for (i = 0;i < MAX_CL_STATS;i++)
+	{
+		if (oldstats[i] != stats[i])
+		{
+			statnum = i;
+			SV_MultiViewDemo_RecordData(&statnum, 1);
+			SV_MultiViewDemo_RecordLong(stats[i]);
+			oldstats[i] = stats[i];
+		}
+	}
+	SV_MultiViewDemo_RecordData(msg->data, msg->cursize);
+	SV_MultiViewDemo_EndRecord();
+}
+
+static void SV_MultiViewDemo_WriteDemoMessage(qfile_t *f, const unsigned char *data, int size, const float *angles)
+{
+	int i, len;
+	float a;
+	len = LittleLong(size);
+	FS_Write(f, &len, 4);
+	for (i = 0;i < 3;i++)
+	{
+		a = LittleFloat(angles[i]);
+		FS_Write(f, &a, 4);
+	}
+	FS_Write(f, data, size);
+}
+
+/*
+==================
+SV_MultiViewDemo_Extract_f
+
+sv_multiviewdemo_extract <mvdem file> [<client number> <demo file>]
+==================
+*/
+void SV_MultiViewDemo_Extract_f(void)
+{
+	static client_t fakeclient;
+	static unsigned char msgdata[NET_MAXMESSAGE];
+	static int stats[MAX_CL_STATS];
+	static const entity_state_t *sendstates[MAX_EDICTS];
+	char filename[MAX_OSPATH];
+	unsigned char header[16], *record = NULL, *p, *end;
+	int type, length, recordmaxsize = 0, clientnum = -1, cliententity, protocol, numstates = 0, numsendstates, connects = 0, frames = 0, i, j, num;
+	unsigned long long mask;
+	float angles[3], f;
+	qfile_t *in, *out = NULL;
+	entity_state_t *states, *s;
+	entityframe5_database_t *d = NULL;
+	sizebuf_t msg;
+	client_t *oldhostclient = host_client;
+	protocolversion_t oldprotocol = sv.protocol;
+
+	if (Cmd_Argc() != 2 && Cmd_Argc() != 4)
+	{
+		Con_Print("usage: sv_multiviewdemo_extract <mvdem file> [<client number> <demo file>]\n");
+		Con_Print("lists the players in a multi-view demo, or writes the point of view of one of them to a demo\n");
+		return;
+	}
+
+	strlcpy(filename, Cmd_Argv(1), sizeof(filename));
+	FS_DefaultExtension(filename, ".mvdem", sizeof(filename));
+	in = FS_OpenRealFile(filename, "rb", false);
+	if (!in)
+	{
+		Con_Printf("couldn't open %s\n", filename);
+		return;
+	}
+	if (FS_Read(in, header, 16) != 16 || memcmp(header, MVDEMO_MAGIC, 8) || BuffLittleLong(header + 12) != MVDEMO_STATESIZE)
+	{
+		Con_Printf("%s is not a multi-view demo of this engine build\n", filename);
+		FS_Close(in);
+		return;
+	}
+	protocol = BuffLittleLong(header + 8);
+
+	if (Cmd_Argc() == 4)
+	{
+		clientnum = atoi(Cmd_Argv(2)) - 1;
+		if (clientnum < 0 || clientnum >= MAX_SCOREBOARD)
+		{
+			Con_Printf("invalid client number %s\n", Cmd_Argv(2));
+			FS_Close(in);
+			return;
+		}
+		strlcpy(filename, Cmd_Argv(3), sizeof(filename));
+		FS_DefaultExtension(filename, ".dem", sizeof(filename));
+		out = FS_OpenRealFile(filename, "wb", false);
+		if (!out)
+		{
+			Con_Printf("couldn't open %s\n", filename);
+			FS_Close(in);
+			return;
+		}
+		FS_Printf(out, "%i\n", -1);
+		d = EntityFrame5_AllocDatabase(sv_mempool);
+		memset(&fakeclient, 0, sizeof(fakeclient));
+		memset(stats, 0, sizeof(stats));
+	}
+	cliententity = clientnum + 1;
+	VectorClear(angles);
+	states = (entity_state_t *)Mem_Alloc(tempmempool, MAX_EDICTS * sizeof(entity_state_t));
+
+	while (FS_Read(in, header, 5) == 5)
+	{
+		type = header[0];
+		length = BuffLittleLong(header + 1);
+		if (length < 1 || length > 64*1024*1024)
+			break;
+		if (recordmaxsize < length)
+		{
+			recordmaxsize = length;
+			record = (unsigned char *)Mem_Realloc(tempmempool, record, recordmaxsize);
+		}
+		if (FS_Read(in, record, length) != length)
+			break;
+		p = record;
+		end = record + length;
+
+		if (type == MVDEMO_ENTITIES)
+		{
+			while (p + 2 <= end)
+			{
+				num = p[0] | (p[1] << 8);
+				p += 2;
+				if (num == 0x8000)
+					break;
+				if (num & 0x8000)
+				{
+					num &= 0x7FFF;
+					memset(states + num, 0, sizeof(*states));
+					continue;
+				}
+				if (num >= MAX_EDICTS || p + 8 > end)
+					break;
+				for (j = 0, mask = 0;j < 8;j++)
+					mask |= (unsigned long long)p[j] << (j * 8);
+				p += 8;
+				for (j = 0;j < MVDEMO_STATEWORDS && p + 4 <= end;j++)
+				{
+					if (mask & (1ull << j))
+					{
+						memcpy((unsigned int *)(states + num) + j, p, 4);
+						p += 4;
+					}
+				}
+				states[num].number = num;
+				numstates = max(numstates, num + 1);
+			}
+			continue;
+		}
+		if (type == MVDEMO_CLIENTCONNECT && length >= 2)
+		{
+			record[length - 1] = 0;
+			if (clientnum < 0)
+				Con_Printf("client %i: %s\n", record[0] + 1, record + 1);
+			else if (record[0] == clientnum && ++connects > 1)
+			{
+				// another player got the same slot
+				break;
+			}
+			continue;
+		}
+		if (clientnum < 0 || record[0] != clientnum)
+			continue;
+		p++;
+		if (type == MVDEMO_RELIABLE)
+			SV_MultiViewDemo_WriteDemoMessage(out, p, (int)(end - p), angles);
+		else if (type == MVDEMO_DATAGRAM && p + 14 <= end)
+		{
+			for (i = 0;i < 3;i++, p += 4)
+			{
+				memcpy(&f, p, 4);
+				angles[i] = LittleFloat(f);
+			}
+			j = p[0] | (p[1] << 8);
+			p += 2;
+			for (i = 0;i < j && p + 5 <= end;i++, p += 5)
+				stats[p[0]] = BuffLittleLong(p + 1);
+			if (end - p > (int)sizeof(msgdata) / 2)
+				continue;
+
+			msg.data = msgdata;
+			msg.maxsize = sizeof(msgdata);
+			msg.cursize = 0;
+			msg.allowoverflow = true;
+			msg.overflowed = false;
+			SZ_Write(&msg, p, (int)(end - p));
+
+			// pick the entities this client would get
+			numsendstates = 0;
+			for (num = 1, s = states + 1;num < numstates;num++, s++)
+			{
+				if (s->active != ACTIVE_NETWORK)
+					continue;
+				if (s->nodrawtoclient == cliententity || (s->drawonlytoclient && s->drawonlytoclient != cliententity))
+					continue;
+				if (s->viewmodelforclient && s->viewmodelforclient != cliententity)
+					continue;
+				if (s->exteriormodelforclient)
+				{
+					if (s->exteriormodelforclient == cliententity)
+						s->flags |= RENDER_EXTERIORMODEL;
+					else
+						s->flags &= ~RENDER_EXTERIORMODEL;
+				}
+				sendstates[numsendstates++] = s;
+			}
+
+			// the E5 writer works on host_client and sv.protocol
+			host_client = &fakeclient;
+			sv.protocol = (protocolversion_t)protocol;
+			Protocol_UpdateClientStats(stats);
+			VectorCopy(states[cliententity].origin, d->vieworigin);
+			d->vieworigin[2] += stats[STAT_VIEWHEIGHT];
+			EntityFrame5_WriteFrame(&msg, msg.maxsize, d, numsendstates, sendstates, cliententity, 0, true);
+			EntityFrame5_AckFrame(d, d->latestframenum);
+			host_client = oldhostclient;
+			sv.protocol = oldprotocol;
+
+			if (!msg.overflowed)
+				SV_MultiViewDemo_WriteDemoMessage(out, msg.data, msg.cursize, angles);
+			frames++;
+		}
+	}
+
+	if (out)
+	{
+		msgdata[0] = svc_disconnect;
+		SV_MultiViewDemo_WriteDemoMessage(out, msgdata, 1, angles);
+		FS_Close(out);
+		EntityFrame5_FreeDatabase(d);
+		Con_Printf("wrote %i frames of client %i to %s\n", frames, clientnum + 1, filename);
+	}
+	if (record)
+		Mem_Free(record);
+	Mem_Free(states);
+	FS_Close(in);
+}
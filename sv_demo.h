@@ -6,4 +6,12 @@ void SV_WriteDemoMessage(client_t *client, sizebuf_t *sendbuffer, qboolean clien
 void SV_StopDemoRecording(client_t *client);
 void SV_WriteNetnameIntoDemo(client_t *client);
 
+void SV_MultiViewDemo_Start(void);
+void SV_MultiViewDemo_Stop(void);
+void SV_MultiViewDemo_WriteEntities(void);
+void SV_MultiViewDemo_ClientConnect(client_t *client);
+void SV_MultiViewDemo_WriteReliable(client_t *client, const sizebuf_t *msg);
+void SV_MultiViewDemo_WriteDatagram(client_t *client, const sizebuf_t *msg, const int *stats);
+void SV_MultiViewDemo_Extract_f(void);
+
 #endif
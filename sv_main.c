@@ -29,8 +29,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 static void SV_SaveEntFile_f(void);
 static void SV_StartDownload_f(void);
 static void SV_Download_f(void);
+static void SV_NetCompress_f(void);
 static void SV_VM_Setup(void);
 extern cvar_t net_connecttimeout;
+extern cvar_t mod_collision_bih;
+extern cvar_t mod_q3bsp_tracelineofsight_brushes;
 
 cvar_t csqc_progname = {0, "csqc_progname","csprogs.dat","name of csprogs.dat file to load"};
 cvar_t csqc_progcrc = {CVAR_READONLY, "csqc_progcrc","-1","CRC of csprogs.dat file to load (-1 is none), only used during level changes and then reset to -1"};
@@ -87,10 +90,24 @@ cvar_t sv_clmovement_enable = {0, "sv_clmovement_enable", "1", "whether to allow
 cvar_t sv_clmovement_minping = {0, "sv_clmovement_minping", "0", "if client ping is below this time in milliseconds, then their ability to use cl_movement prediction is disabled for a while (as they don't need it)"};
 cvar_t sv_clmovement_minping_disabletime = {0, "sv_clmovement_minping_disabletime", "1000", "when client falls below minping, disable their prediction for this many milliseconds (should be at least 1000 or else their prediction may turn on/off frequently)"};
 cvar_t sv_clmovement_inputtimeout = {0, "sv_clmovement_inputtimeout", "0.2", "when a client does not send input for this many seconds, force them to move anyway (unlike QuakeWorld)"};
+cvar_t sv_congestioncontrol = {0, "sv_congestioncontrol", "1", "adapt the send rate and packet size of each client to the bandwidth their link can take, estimated from lost entity frames and rising ping (never exceeds the client rate)"};
+cvar_t sv_congestioncontrol_delay = {0, "sv_congestioncontrol_delay", "0.15", "ping increase over the lowest ping seen (in seconds) that is taken as a sign of queueing on the client link"};
+cvar_t sv_congestioncontrol_interval = {0, "sv_congestioncontrol_interval", "0.5", "how often (in seconds) the congestion estimate of a client is updated"};
+cvar_t sv_congestioncontrol_loss = {0, "sv_congestioncontrol_loss", "0.1", "fraction of lost entity frames above which the send rate of a client is reduced"};
+cvar_t sv_congestioncontrol_minrate = {0, "sv_congestioncontrol_minrate", "4000", "congestion control never reduces the send rate of a client below this many bytes per second"};
 cvar_t sv_cullentities_nevercullbmodels = {0, "sv_cullentities_nevercullbmodels", "0", "if enabled the clients are always notified of moving doors and lifts and other submodels of world (warning: eats a lot of network bandwidth on some levels!)"};
 cvar_t sv_cullentities_pvs = {0, "sv_cullentities_pvs", "1", "fast but loose culling of hidden entities"};
+cvar_t sv_cullentities_pvs_share = {0, "sv_cullentities_pvs_share", "1", "clients whose combined PVS is identical share the PVS culling results of each frame"};
 cvar_t sv_cullentities_stats = {0, "sv_cullentities_stats", "0", "displays stats on network entities culled by various methods for each client"};
+cvar_t sv_prepareentities_incremental = {0, "sv_prepareentities_incremental", "1", "reuse the network state of entities whose networked fields were not written since the last frame (2 = prepare everything and report entities that changed without being marked)"};
+cvar_t sv_entitydeltacache = {0, "sv_entitydeltacache", "1", "encode each entity update only once per frame and copy it to every client that needs the same update (sv_cullentities_stats shows the hit rate)"};
+cvar_t sv_netlod = {0, "sv_netlod", "0", "send movement of entities far from the viewer less often, the updates themselves are unchanged (players and other changes are not affected, see sv_netlod_stats)"};
+cvar_t sv_netlod_classstats = {0, "sv_netlod_classstats", "0", "collect the entity update bandwidth of each client per classname for sv_netlod_stats"};
+cvar_t sv_netlod_distance = {0, "sv_netlod_distance", "1500", "distance from the viewer at which sv_netlod starts reducing the update rate, the reduction grows with distance"};
+cvar_t sv_netlod_interval = {0, "sv_netlod_interval", "2", "number of frames between movement updates of an entity at sv_netlod_distance, scales with distance"};
+cvar_t sv_netlod_precision = {0, "sv_netlod_precision", "2", "movement smaller than this many units is not sent for an entity at sv_netlod_distance, scales with distance"};
 cvar_t sv_cullentities_trace = {0, "sv_cullentities_trace", "0", "somewhat slow but very tight culling of hidden entities, minimizes network traffic and makes wallhack cheats useless"};
+cvar_t sv_cullentities_trace_threads = {0, "sv_cullentities_trace_threads", "4", "number of worker threads running the sv_cullentities_trace line of sight tests (0 = trace on the main thread)"};
 cvar_t sv_cullentities_trace_delay = {0, "sv_cullentities_trace_delay", "1", "number of seconds until the entity gets actually culled"};
 cvar_t sv_cullentities_trace_delay_players = {0, "sv_cullentities_trace_delay_players", "0.2", "number of seconds until the entity gets actually culled if it is a player entity"};
 cvar_t sv_cullentities_trace_enlarge = {0, "sv_cullentities_trace_enlarge", "0", "box enlargement for entity culling"};
@@ -206,6 +223,8 @@ cvar_t cutscene = {0, "cutscene", "1", "enables cutscenes in nehahra, can be use
 cvar_t sv_autodemo_perclient = {CVAR_SAVE, "sv_autodemo_perclient", "0", "set to 1 to enable autorecorded per-client demos (they'll start to record at the beginning of a match); set it to 2 to also record client->server packets (for debugging)"};
 cvar_t sv_autodemo_perclient_nameformat = {CVAR_SAVE, "sv_autodemo_perclient_nameformat", "sv_autodemos/%Y-%m-%d_%H-%M", "The format of the sv_autodemo_perclient filename, followed by the map name, the client number and the IP address + port number, separated by underscores (the date is encoded using strftime escapes)" };
 cvar_t sv_autodemo_perclient_discardable = {CVAR_SAVE, "sv_autodemo_perclient_discardable", "0", "Allow game code to decide whether a demo should be kept or discarded."};
+cvar_t sv_autodemo_multiview = {CVAR_SAVE, "sv_autodemo_multiview", "0", "set to 1 to record each match into one multi-view demo holding the point of view of every player (at about the cost of one per-client demo), sv_multiviewdemo_extract turns a player's view into a normal demo"};
+cvar_t sv_autodemo_multiview_nameformat = {CVAR_SAVE, "sv_autodemo_multiview_nameformat", "sv_autodemos/%Y-%m-%d_%H-%M", "The format of the sv_autodemo_multiview filename, followed by the map name (the date is encoded using strftime escapes)"};
 
 cvar_t halflifebsp = {0, "halflifebsp", "0", "indicates the current map is hlbsp format (useful to know because of different bounding box sizes)"};
 cvar_t sv_mapformat_is_quake2 = {0, "sv_mapformat_is_quake2", "0", "indicates the current map is q2bsp format (useful to know because of different entity behaviors, .frame on submodels and other things)"};
@@ -438,6 +457,39 @@ static void SV_AreaStats_f(void)
 	World_PrintAreaStats(&sv.world, "server");
 }
 
+static int SV_NetLODStats_Compare(const void *a_, const void *b_)
+{
+	const entityframe5_classstats_t *a = (const entityframe5_classstats_t *)a_;
+	const entityframe5_classstats_t *b = (const entityframe5_classstats_t *)b_;
+	return (a->bytes + a->bytessaved < b->bytes + b->bytessaved) - (a->bytes + a->bytessaved > b->bytes + b->bytessaved);
+}
+
+static void SV_NetLODStats_f(void)
+{
+	int i, j;
+	client_t *client;
+	entityframe5_database_t *d;
+	entityframe5_classstats_t classstats[ENTITYFRAME5_MAXCLASSSTATS];
+	qboolean reset = Cmd_Argc() >= 2 && !strcmp(Cmd_Argv(1), "reset");
+
+	for (i = 0, client = svs.clients;i < svs.maxclients;i++, client++)
+	{
+		if (!client->active || !(d = client->entitydatabase5))
+			continue;
+		if (reset)
+		{
+			d->statsbytes = d->statsbytessaved = d->statsdeferred = 0;
+			d->numclassstats = 0;
+			continue;
+		}
+		Con_Printf("client \"%s\": %u entity update bytes sent, %u deferred updates, about %u bytes saved (%.1f%%)\n", client->name, d->statsbytes, d->statsdeferred, d->statsbytessaved, d->statsbytes + d->statsbytessaved ? 100.0 * d->statsbytessaved / (d->statsbytes + d->statsbytessaved) : 0.0);
+		memcpy(classstats, d->classstats, d->numclassstats * sizeof(*classstats));
+		qsort(classstats, d->numclassstats, sizeof(*classstats), SV_NetLODStats_Compare);
+		for (j = 0;j < d->numclassstats;j++)
+			Con_Printf("  %-24s %8u updates %10u bytes %10u saved\n", classstats[j].classname[0] ? classstats[j].classname : "(no classname)", classstats[j].updates, classstats[j].bytes, classstats[j].bytessaved);
+	}
+}
+
 /*
 ===============
 SV_Init
@@ -463,8 +515,11 @@ void SV_Init (void)
 
 	Cmd_AddCommand("sv_saveentfile", SV_SaveEntFile_f, "save map entities to .ent file (to allow external editing)");
 	Cmd_AddCommand("sv_areastats", SV_AreaStats_f, "prints statistics on entity culling during collision traces");
+	Cmd_AddCommand("sv_multiviewdemo_extract", SV_MultiViewDemo_Extract_f, "lists the players in a multi-view demo (sv_autodemo_multiview), or writes the point of view of one of them to a normal demo");
+	Cmd_AddCommand("sv_netlod_stats", SV_NetLODStats_f, "prints the entity update bandwidth of each client and how much sv_netlod saved (per classname with sv_netlod_classstats 1), \"sv_netlod_stats reset\" clears the counters");
 	Cmd_AddCommand_WithClientCommand("sv_startdownload", NULL, SV_StartDownload_f, "begins sending a file to the client (network protocol use only)");
 	Cmd_AddCommand_WithClientCommand("download", NULL, SV_Download_f, "downloads a specified file from the server");
+	Cmd_AddCommand_WithClientCommand("netcompress", NULL, SV_NetCompress_f, "selects a codec for compressing large reliable messages to the client (network protocol use only)");
 
 	Cvar_RegisterVariable (&sv_disablenotify);
 	Cvar_RegisterVariable (&coop);
@@ -504,10 +559,24 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_clmovement_minping);
 	Cvar_RegisterVariable (&sv_clmovement_minping_disabletime);
 	Cvar_RegisterVariable (&sv_clmovement_inputtimeout);
+	Cvar_RegisterVariable (&sv_congestioncontrol);
+	Cvar_RegisterVariable (&sv_congestioncontrol_delay);
+	Cvar_RegisterVariable (&sv_congestioncontrol_interval);
+	Cvar_RegisterVariable (&sv_congestioncontrol_loss);
+	Cvar_RegisterVariable (&sv_congestioncontrol_minrate);
 	Cvar_RegisterVariable (&sv_cullentities_nevercullbmodels);
 	Cvar_RegisterVariable (&sv_cullentities_pvs);
+	Cvar_RegisterVariable (&sv_cullentities_pvs_share);
 	Cvar_RegisterVariable (&sv_cullentities_stats);
+	Cvar_RegisterVariable (&sv_prepareentities_incremental);
+	Cvar_RegisterVariable (&sv_entitydeltacache);
+	Cvar_RegisterVariable (&sv_netlod);
+	Cvar_RegisterVariable (&sv_netlod_classstats);
+	Cvar_RegisterVariable (&sv_netlod_distance);
+	Cvar_RegisterVariable (&sv_netlod_interval);
+	Cvar_RegisterVariable (&sv_netlod_precision);
 	Cvar_RegisterVariable (&sv_cullentities_trace);
+	Cvar_RegisterVariable (&sv_cullentities_trace_threads);
 	Cvar_RegisterVariable (&sv_cullentities_trace_delay);
 	Cvar_RegisterVariable (&sv_cullentities_trace_delay_players);
 	Cvar_RegisterVariable (&sv_cullentities_trace_enlarge);
@@ -624,6 +693,8 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_autodemo_perclient);
 	Cvar_RegisterVariable (&sv_autodemo_perclient_nameformat);
 	Cvar_RegisterVariable (&sv_autodemo_perclient_discardable);
+	Cvar_RegisterVariable (&sv_autodemo_multiview);
+	Cvar_RegisterVariable (&sv_autodemo_multiview_nameformat);
 
 	Cvar_RegisterVariable (&halflifebsp);
 	Cvar_RegisterVariable (&dprm_version);
@@ -885,6 +956,65 @@ CLIENT SPAWNING
 ==============================================================================
 */
 
+/*
+================
+SV_WriteServerinfo
+
+Writes the svc_serverinfo message (precache lists and cd track).  The
+precache lists are the same for every client, so they are only built once
+per level (and again when a precache is added) and then copied to each
+connecting client, the level name and cd track are written fresh because
+QC may change them at any time.
+================
+*/
+static void SV_WriteServerinfo(sizebuf_t *msg)
+{
+	prvm_prog_t *prog = SVVM_prog;
+	int i;
+	sizebuf_t *buf = &sv.serverinfo;
+
+	MSG_WriteByte (msg, svc_serverinfo);
+	MSG_WriteLong (msg, Protocol_NumberForEnum(sv.protocol));
+	MSG_WriteByte (msg, svs.maxclients);
+
+	if (!coop.integer && deathmatch.integer)
+		MSG_WriteByte (msg, GAME_DEATHMATCH);
+	else
+		MSG_WriteByte (msg, GAME_COOP);
+
+	MSG_WriteString (msg,PRVM_GetString(prog, PRVM_serveredictstring(prog->edicts, message)));
+
+	if (!sv.serverinfo_valid)
+	{
+		buf->data = sv.serverinfo_buf;
+		buf->maxsize = sizeof(sv.serverinfo_buf);
+		buf->allowoverflow = true;
+		buf->overflowed = false;
+		SZ_Clear(buf);
+
+		for (i = 1;i < MAX_MODELS && sv.model_precache[i][0];i++)
+			MSG_WriteString (buf, sv.model_precache[i]);
+		MSG_WriteByte (buf, 0);
+
+		for (i = 1;i < MAX_SOUNDS && sv.sound_precache[i][0];i++)
+			MSG_WriteString (buf, sv.sound_precache[i]);
+		MSG_WriteByte (buf, 0);
+
+		// an overflowed message is not kept, the client message would
+		// overflow just the same
+		sv.serverinfo_valid = !buf->overflowed;
+		if (buf->overflowed)
+			Con_Printf("SV_WriteServerinfo: serverinfo message overflowed (%i bytes)\n", buf->maxsize);
+	}
+
+	SZ_Write (msg, buf->data, buf->cursize);
+
+// send music
+	MSG_WriteByte (msg, svc_cdtrack);
+	MSG_WriteByte (msg, (int)PRVM_serveredictfloat(prog->edicts, sounds));
+	MSG_WriteByte (msg, (int)PRVM_serveredictfloat(prog->edicts, sounds));
+}
+
 /*
 ================
 SV_SendServerinfo
@@ -972,6 +1102,7 @@ void SV_SendServerinfo (client_t *client)
 		SV_StartDemoRecording(client, demofile, -1);
 		SV_WriteNetnameIntoDemo(client);
 	}
+	SV_MultiViewDemo_ClientConnect(client);
 
 	//[515]: init csprogs according to version of svprogs, check the crc, etc.
 	if (sv.csqc_progname[0])
@@ -1026,6 +1157,14 @@ void SV_SendServerinfo (client_t *client)
 		MSG_WriteString (&client->netconnection->message, "cl_serverextension_download 2\n");
 	}
 
+	// reliable message compression is optional, old clients would complain
+	// about the unknown cvar
+	if (net_compress.integer)
+	{
+		MSG_WriteByte (&client->netconnection->message, svc_stufftext);
+		MSG_WriteString (&client->netconnection->message, "cl_serverextension_netcompress 1\n");
+	}
+
 	// send at this time so it's guaranteed to get executed at the right time
 	{
 		client_t *save;
@@ -1035,29 +1174,7 @@ void SV_SendServerinfo (client_t *client)
 		host_client = save;
 	}
 
-	MSG_WriteByte (&client->netconnection->message, svc_serverinfo);
-	MSG_WriteLong (&client->netconnection->message, Protocol_NumberForEnum(sv.protocol));
-	MSG_WriteByte (&client->netconnection->message, svs.maxclients);
-
-	if (!coop.integer && deathmatch.integer)
-		MSG_WriteByte (&client->netconnection->message, GAME_DEATHMATCH);
-	else
-		MSG_WriteByte (&client->netconnection->message, GAME_COOP);
-
-	MSG_WriteString (&client->netconnection->message,PRVM_GetString(prog, PRVM_serveredictstring(prog->edicts, message)));
-
-	for (i = 1;i < MAX_MODELS && sv.model_precache[i][0];i++)
-		MSG_WriteString (&client->netconnection->message, sv.model_precache[i]);
-	MSG_WriteByte (&client->netconnection->message, 0);
-
-	for (i = 1;i < MAX_SOUNDS && sv.sound_precache[i][0];i++)
-		MSG_WriteString (&client->netconnection->message, sv.sound_precache[i]);
-	MSG_WriteByte (&client->netconnection->message, 0);
-
-// send music
-	MSG_WriteByte (&client->netconnection->message, svc_cdtrack);
-	MSG_WriteByte (&client->netconnection->message, (int)PRVM_serveredictfloat(prog->edicts, sounds));
-	MSG_WriteByte (&client->netconnection->message, (int)PRVM_serveredictfloat(prog->edicts, sounds));
+	SV_WriteServerinfo(&client->netconnection->message);
 
 // set view
 // store this in clientcamera, too
@@ -1482,46 +1599,235 @@ static qboolean SV_PrepareEntityForSending (prvm_edict_t *ent, entity_state_t *c
 	return true;
 }
 
+/*
+==============================================================================
+
+SHARED PVS CULLING
+
+Clients standing in the same area end up with the same fat PVS, so the PVS
+test of each sent entity is remembered per distinct PVS for the current
+frame and reused by every client with that PVS.  Per client trace culling
+and customizeentityforclient still run for each client.
+==============================================================================
+*/
+
+#define SV_PVSCACHE_MAXSETS 32
+
+typedef struct sv_pvsset_s
+{
+	unsigned int hash;
+	unsigned char *pvs;
+	// PVS test result for each sv.sendentities slot: 0 = not tested yet,
+	// 1 = touches the PVS, 2 = culled
+	unsigned char visible[MAX_EDICTS];
+}
+sv_pvsset_t;
+
+typedef struct sv_pvscache_s
+{
+	int pvsbytes;
+	int numsets;
+	int nextset; // replaced next once all sets are in use
+	sv_pvsset_t *sets[SV_PVSCACHE_MAXSETS];
+}
+sv_pvscache_t;
+
+static sv_pvscache_t sv_pvscache;
+
+// forgets all sets, called whenever the sendentities are rebuilt
+static void SV_PVSCache_Clear(void)
+{
+	sv_pvscache.numsets = 0;
+	sv_pvscache.nextset = 0;
+}
+
+// returns the shared culling results for this PVS, *shared is set if
+// another client already used it this frame
+static unsigned char *SV_PVSCache_Find(const unsigned char *pvs, int pvsbytes, qboolean *shared)
+{
+	int i;
+	unsigned int hash;
+	sv_pvsset_t *set;
+
+	if (sv_pvscache.pvsbytes != pvsbytes)
+	{
+		for (i = 0;i < SV_PVSCACHE_MAXSETS;i++)
+		{
+			if (sv_pvscache.sets[i])
+			{
+				Mem_Free(sv_pvscache.sets[i]->pvs);
+				Mem_Free(sv_pvscache.sets[i]);
+				sv_pvscache.sets[i] = NULL;
+			}
+		}
+		sv_pvscache.pvsbytes = pvsbytes;
+		SV_PVSCache_Clear();
+	}
+
+	hash = CRC_Block(pvs, pvsbytes);
+	for (i = 0;i < sv_pvscache.numsets;i++)
+	{
+		set = sv_pvscache.sets[i];
+		if (set->hash == hash && !memcmp(set->pvs, pvs, pvsbytes))
+		{
+			*shared = true;
+			return set->visible;
+		}
+	}
+
+	if (sv_pvscache.numsets < SV_PVSCACHE_MAXSETS)
+		i = sv_pvscache.numsets++;
+	else
+	{
+		i = sv_pvscache.nextset;
+		sv_pvscache.nextset = (sv_pvscache.nextset + 1) % SV_PVSCACHE_MAXSETS;
+	}
+	if (!sv_pvscache.sets[i])
+	{
+		sv_pvscache.sets[i] = (sv_pvsset_t *)Mem_Alloc(sv_mempool, sizeof(sv_pvsset_t));
+		sv_pvscache.sets[i]->pvs = (unsigned char *)Mem_Alloc(sv_mempool, pvsbytes);
+	}
+	set = sv_pvscache.sets[i];
+	set->hash = hash;
+	memcpy(set->pvs, pvs, pvsbytes);
+	memset(set->visible, 0, sv.numsendentities);
+	*shared = false;
+	return set->visible;
+}
+
+/*
+=============
+SV_PrepareEntitiesForSending
+
+Builds sv.sendentities for this frame.  The server VM tracks QC writes to
+every field read by SV_PrepareEntityForSending (see SV_VM_Setup), so
+entities that were not written to (and not moved by C physics code) reuse
+the state prepared in an earlier frame instead of being prepared again.
+=============
+*/
 static void SV_PrepareEntitiesForSending(void)
 {
 	prvm_prog_t *prog = SVVM_prog;
 	int e;
+	int numprepared = 0, numreused = 0, nummissed = 0;
+	qboolean incremental, send;
 	prvm_edict_t *ent;
+	edict_engineprivate_t *priv;
+	entity_state_t *cs;
+	SV_PVSCache_Clear();
+	EntityFrame5_NewSendFrame();
+
+	incremental = sv_prepareentities_incremental.integer && prog->fieldchangetracked && sv.preparedentities_valid && sv.preparedentities_onlycsqcnetworking == sv_onlycsqcnetworking.integer;
+	sv.preparedentities_valid = true;
+	sv.preparedentities_onlycsqcnetworking = sv_onlycsqcnetworking.integer;
+
 	// send all entities that touch the pvs
 	sv.numsendentities = 0;
 	sv.sendentitiesindex[0] = NULL;
 	memset(sv.sendentitiesindex, 0, prog->num_edicts * sizeof(*sv.sendentitiesindex));
 	for (e = 1, ent = PRVM_NEXT_EDICT(prog->edicts);e < prog->num_edicts;e++, ent = PRVM_NEXT_EDICT(ent))
 	{
-		if (!ent->priv.server->free && SV_PrepareEntityForSending(ent, sv.sendentities + sv.numsendentities, e))
+		priv = ent->priv.server;
+		if (priv->free)
+		{
+			priv->sendstate_valid = false;
+			continue;
+		}
+		cs = sv.sendentities + sv.numsendentities;
+		if (incremental && priv->sendstate_valid && !prog->edictschanged[e] && VectorCompare(PRVM_serveredictvector(ent, origin), priv->sendstate_origin) && VectorCompare(PRVM_serveredictvector(ent, angles), priv->sendstate_angles))
 		{
-			sv.sendentitiesindex[e] = sv.sendentities + sv.numsendentities;
+			numreused++;
+			if (sv_prepareentities_incremental.integer >= 2)
+			{
+				// verify that the reused state is what would have been prepared
+				send = SV_PrepareEntityForSending(ent, cs, e);
+				if (send != priv->sendstate_send || (send && memcmp(cs, &priv->sendstate, sizeof(*cs))))
+				{
+					nummissed++;
+					Con_Printf("SV_PrepareEntitiesForSending: entity %i (%s) changed without being marked\n", e, PRVM_GetString(prog, PRVM_serveredictstring(ent, classname)));
+					priv->sendstate_send = send;
+					if (send)
+						priv->sendstate = *cs;
+				}
+			}
+			else if ((send = priv->sendstate_send))
+				*cs = priv->sendstate;
+		}
+		else
+		{
+			numprepared++;
+			send = SV_PrepareEntityForSending(ent, cs, e);
+			priv->sendstate_send = send;
+			if (send)
+				priv->sendstate = *cs;
+			VectorCopy(PRVM_serveredictvector(ent, origin), priv->sendstate_origin);
+			VectorCopy(PRVM_serveredictvector(ent, angles), priv->sendstate_angles);
+			// clients, csqc entities (SendFlags upkeep), per client
+			// customized entities and entities that depend on the
+			// client or on the skeleton have to be prepared every frame
+			priv->sendstate_valid = e > svs.maxclients
+				&& !PRVM_serveredictfunction(ent, SendEntity)
+				&& !PRVM_serveredictfunction(ent, customizeentityforclient)
+				&& !PRVM_serveredictfloat(ent, sendcomplexanimation)
+				&& !((int)PRVM_serveredictfloat(ent, effects) & EF_LOWPRECISION);
+		}
+		if (send)
+		{
+			sv.sendentitiesindex[e] = cs;
 			sv.numsendentities++;
 		}
 	}
+	if (prog->fieldchangetracked)
+		memset(prog->edictschanged, 0, prog->num_edicts);
+
+	if (sv_prepareentities_incremental.integer >= 2 && nummissed)
+		Con_Printf("SV_PrepareEntitiesForSending: %i prepared, %i reused, %i reused states were outdated\n", numprepared, numreused, nummissed);
 }
 
 #define MAX_LINEOFSIGHTTRACES 64
 
-qboolean SV_CanSeeBox(int numtraces, vec_t enlarge, vec3_t eye, vec3_t entboxmins, vec3_t entboxmaxs, qboolean slow)
+typedef struct sv_culloccluder_s
+{
+	dp_model_t *model;
+	vec3_t absmin, absmax;
+	matrix4x4_t imatrix;
+}
+sv_culloccluder_t;
+
+// returns true if the edict can hide entities behind it (doors and other
+// opaque bsp models) and prepares it for tracing
+static qboolean SV_CullOccluder_Setup(prvm_prog_t *prog, prvm_edict_t *touch, sv_culloccluder_t *occluder)
 {
-	prvm_prog_t *prog = SVVM_prog;
 	float pitchsign;
 	float alpha;
-	float starttransformed[3], endtransformed[3];
-	int traceindex;
-	int originalnumtouchedicts;
-	int numtouchedicts = 0;
-	int touchindex;
-	matrix4x4_t matrix, imatrix;
+	matrix4x4_t matrix;
 	dp_model_t *model;
-	prvm_edict_t *touch;
-	static prvm_edict_t *touchedicts[MAX_EDICTS];
-	vec3_t boxmins, boxmaxs;
-	vec3_t clipboxmins, clipboxmaxs;
-	vec3_t endpoints[MAX_LINEOFSIGHTTRACES];
+	if (PRVM_serveredictfloat(touch, solid) != SOLID_BSP)
+		return false;
+	model = SV_GetModelFromEdict(touch);
+	if (!model || !model->brush.TraceLineOfSight)
+		return false;
+	// skip obviously transparent entities
+	alpha = PRVM_serveredictfloat(touch, alpha);
+	if (alpha && alpha < 1)
+		return false;
+	if ((int)PRVM_serveredictfloat(touch, effects) & EF_ADDITIVE)
+		return false;
+	occluder->model = model;
+	VectorCopy(touch->priv.server->areamins, occluder->absmin);
+	VectorCopy(touch->priv.server->areamaxs, occluder->absmax);
+	// get the entity matrix
+	pitchsign = SV_GetPitchSign(prog, touch);
+	Matrix4x4_CreateFromQuakeEntity(&matrix, PRVM_serveredictvector(touch, origin)[0], PRVM_serveredictvector(touch, origin)[1], PRVM_serveredictvector(touch, origin)[2], pitchsign * PRVM_serveredictvector(touch, angles)[0], PRVM_serveredictvector(touch, angles)[1], PRVM_serveredictvector(touch, angles)[2], 1);
+	Matrix4x4_Invert_Simple(&occluder->imatrix, &matrix);
+	return true;
+}
 
-	numtraces = min(numtraces, MAX_LINEOFSIGHTTRACES);
+// picks the random end points of the traces and the sweep box containing them
+static void SV_CanSeeBox_EndPoints(int numtraces, vec_t enlarge, const vec3_t eye, const vec3_t entboxmins, const vec3_t entboxmaxs, vec3_t *endpoints, vec3_t clipboxmins, vec3_t clipboxmaxs)
+{
+	int traceindex;
+	vec3_t boxmins, boxmaxs;
 
 	// expand the box a little
 	boxmins[0] = (enlarge+1) * entboxmins[0] - enlarge * entboxmaxs[0];
@@ -1547,6 +1853,61 @@ qboolean SV_CanSeeBox(int numtraces, vec_t enlarge, vec3_t eye, vec3_t entboxmin
 		clipboxmaxs[1] = max(clipboxmaxs[1], endpoints[traceindex][1]);
 		clipboxmaxs[2] = max(clipboxmaxs[2], endpoints[traceindex][2]);
 	}
+}
+
+// fires the traces against the world and the occluders (only those touching
+// the sweep box if one is given), does not touch any shared state so it can
+// be called from the culling threads
+static qboolean SV_CanSeeBox_Traces(int numtraces, const vec3_t eye, const vec3_t *endpoints, const sv_culloccluder_t *occluders, int numoccluders, const vec_t *clipboxmins, const vec_t *clipboxmaxs, qboolean slow)
+{
+	int traceindex;
+	int touchindex;
+	float starttransformed[3], endtransformed[3];
+	const sv_culloccluder_t *occluder;
+
+	// fire each ray against all of the occluders, this gives us an early-out
+	// case when something is visible (which it often is)
+	for (traceindex = 0;traceindex < numtraces;traceindex++)
+	{
+		// check world occlusion
+		if (sv.worldmodel && sv.worldmodel->brush.TraceLineOfSight)
+			if (!sv.worldmodel->brush.TraceLineOfSight(sv.worldmodel, eye, endpoints[traceindex], slow))
+				continue;
+		for (touchindex = 0, occluder = occluders;touchindex < numoccluders;touchindex++, occluder++)
+		{
+			if (clipboxmins && !BoxesOverlap(clipboxmins, clipboxmaxs, occluder->absmin, occluder->absmax))
+				continue;
+			// see if the ray hits this entity
+			Matrix4x4_Transform(&occluder->imatrix, eye, starttransformed);
+			Matrix4x4_Transform(&occluder->imatrix, endpoints[traceindex], endtransformed);
+			if (!occluder->model->brush.TraceLineOfSight(occluder->model, starttransformed, endtransformed, slow))
+				break;
+		}
+		// check if the ray was blocked
+		if (touchindex < numoccluders)
+			continue;
+		// return if the ray was not blocked
+		return true;
+	}
+
+	// no rays survived
+	return false;
+}
+
+qboolean SV_CanSeeBox(int numtraces, vec_t enlarge, vec3_t eye, vec3_t entboxmins, vec3_t entboxmaxs, qboolean slow)
+{
+	prvm_prog_t *prog = SVVM_prog;
+	int originalnumtouchedicts;
+	int numtouchedicts = 0;
+	int numoccluders = 0;
+	int touchindex;
+	static prvm_edict_t *touchedicts[MAX_EDICTS];
+	static sv_culloccluder_t occluders[MAX_EDICTS];
+	vec3_t clipboxmins, clipboxmaxs;
+	vec3_t endpoints[MAX_LINEOFSIGHTTRACES];
+
+	numtraces = min(numtraces, MAX_LINEOFSIGHTTRACES);
+	SV_CanSeeBox_EndPoints(numtraces, enlarge, eye, entboxmins, entboxmaxs, endpoints, clipboxmins, clipboxmaxs);
 
 	// get the list of entities in the sweep box
 	if (sv_cullentities_trace_entityocclusion.integer)
@@ -1559,68 +1920,346 @@ qboolean SV_CanSeeBox(int numtraces, vec_t enlarge, vec3_t eye, vec3_t entboxmin
 	}
 	// iterate the entities found in the sweep box and filter them
 	originalnumtouchedicts = numtouchedicts;
-	numtouchedicts = 0;
 	for (touchindex = 0;touchindex < originalnumtouchedicts;touchindex++)
+		if (SV_CullOccluder_Setup(prog, touchedicts[touchindex], occluders + numoccluders))
+			numoccluders++;
+
+	return SV_CanSeeBox_Traces(numtraces, eye, (const vec3_t *)endpoints, occluders, numoccluders, NULL, NULL, slow);
+}
+
+#define CULLTRACEMODE_PLAYER 1
+#define CULLTRACEMODE_EXTRA 2
+#define CULLTRACEMODE_SIMPLE 3
+#define CULLTRACEMODE_NONE 4
+static qboolean SV_EntityTouchesPVS(prvm_edict_t *ed, const unsigned char *pvs)
+{
+	int i;
+	if (ed->priv.server->pvs_numclusters < 0)
+	{
+		// entity too big for clusters list
+		return !sv.worldmodel || !sv.worldmodel->brush.BoxTouchingPVS || sv.worldmodel->brush.BoxTouchingPVS(sv.worldmodel, pvs, ed->priv.server->cullmins, ed->priv.server->cullmaxs);
+	}
+	// check cached clusters list
+	for (i = 0;i < ed->priv.server->pvs_numclusters;i++)
+		if (CHECKPVSBIT(pvs, ed->priv.server->pvs_clusterlist[i]))
+			return true;
+	return false;
+}
+
+/*
+==============================================================================
+
+PARALLEL CULLING TRACES
+
+With sv_cullentities_trace the line of sight tests are the most expensive
+part of sending entities.  Before marking the entities of a client,
+SV_WriteEntitiesToClient collects the tests that SV_MarkWriteEntityStateToClient
+would do for it (same samples, same trace_delay condition) into a batch that
+is run by sv_cullentities_trace_threads worker threads along with the main
+thread.  SV_MarkWriteEntityStateToClient then only applies the results to the
+visibletime hysteresis.  The random end points are picked on the main thread
+and entity occlusion uses a list of occluders made before the batch starts,
+so the workers only read the world and the occluder models.  Entities that
+are customized per client are still traced inline.
+==============================================================================
+*/
+
+#define SV_CULLTRACE_MAXTHREADS 16
+// number of jobs a thread takes at once
+#define SV_CULLTRACE_CHUNK 8
+
+typedef struct sv_culltracejob_s
+{
+	int number;
+	int numtraces; // per eye
+	int firstendpoint; // numtraces end points for each eye
+	int firsteye; // sweep box for each eye in clipboxes
+	qboolean slow;
+}
+sv_culltracejob_t;
+
+typedef struct sv_culltrace_s
+{
+	// results for sv.sententitiesmark of the client being written
+	// (lastmark detects the restart of the marks on a new level)
+	int lastmark;
+	int resultmark[MAX_EDICTS];
+	qboolean resultvisible[MAX_EDICTS];
+
+	int numjobs, maxjobs;
+	sv_culltracejob_t *jobs;
+	int numendpoints, maxendpoints;
+	vec3_t *endpoints;
+	int numclipboxes, maxclipboxes;
+	vec3_t *clipboxes; // mins and maxs for each eye of each job
+	int numoccluders, maxoccluders;
+	sv_culloccluder_t *occluders;
+
+	// worker threads, protected by mutex
+	int numthreads;
+	void *threads[SV_CULLTRACE_MAXTHREADS];
+	void *mutex;
+	void *wakecond;
+	void *donecond;
+	int nextjob;
+	int numdone;
+	qboolean quit;
+}
+sv_culltrace_t;
+
+static sv_culltrace_t sv_culltrace;
+
+static void SV_CullTraces_RunJob(const sv_culltracejob_t *job)
+{
+	int eyeindex;
+	const vec_t *clipbox;
+	for (eyeindex = 0;eyeindex < sv.writeentitiestoclient_numeyes;eyeindex++)
+	{
+		clipbox = sv_culltrace.clipboxes[job->firsteye + eyeindex * 2];
+		if (SV_CanSeeBox_Traces(job->numtraces, sv.writeentitiestoclient_eyes[eyeindex], (const vec3_t *)sv_culltrace.endpoints + job->firstendpoint + eyeindex * job->numtraces, sv_culltrace.occluders, sv_culltrace.numoccluders, clipbox, clipbox + 3, job->slow))
+			break;
+	}
+	sv_culltrace.resultvisible[job->number] = eyeindex < sv.writeentitiestoclient_numeyes;
+}
+
+// runs jobs until none are left, called with the mutex locked
+static void SV_CullTraces_Work(void)
+{
+	int i, first, last;
+	while (sv_culltrace.nextjob < sv_culltrace.numjobs)
 	{
-		touch = touchedicts[touchindex];
-		if (PRVM_serveredictfloat(touch, solid) != SOLID_BSP)
+		first = sv_culltrace.nextjob;
+		last = min(first + SV_CULLTRACE_CHUNK, sv_culltrace.numjobs);
+		sv_culltrace.nextjob = last;
+		Thread_UnlockMutex(sv_culltrace.mutex);
+		for (i = first;i < last;i++)
+			SV_CullTraces_RunJob(sv_culltrace.jobs + i);
+		Thread_LockMutex(sv_culltrace.mutex);
+		sv_culltrace.numdone += last - first;
+		if (sv_culltrace.numdone == sv_culltrace.numjobs)
+			Thread_CondBroadcast(sv_culltrace.donecond);
+	}
+}
+
+static int SV_CullTraces_Thread(void *unused)
+{
+	Thread_LockMutex(sv_culltrace.mutex);
+	for (;;)
+	{
+		while (!sv_culltrace.quit && sv_culltrace.nextjob >= sv_culltrace.numjobs)
+			Thread_CondWait(sv_culltrace.wakecond, sv_culltrace.mutex);
+		if (sv_culltrace.quit)
+			break;
+		SV_CullTraces_Work();
+	}
+	Thread_UnlockMutex(sv_culltrace.mutex);
+	return 0;
+}
+
+void SV_CullTraces_StopThreads(void)
+{
+	int i;
+	if (!sv_culltrace.numthreads)
+		return;
+	Thread_LockMutex(sv_culltrace.mutex);
+	sv_culltrace.quit = true;
+	Thread_CondBroadcast(sv_culltrace.wakecond);
+	Thread_UnlockMutex(sv_culltrace.mutex);
+	for (i = 0;i < sv_culltrace.numthreads;i++)
+		Thread_WaitThread(sv_culltrace.threads[i], 0);
+	Thread_DestroyCond(sv_culltrace.donecond);
+	Thread_DestroyCond(sv_culltrace.wakecond);
+	Thread_DestroyMutex(sv_culltrace.mutex);
+	sv_culltrace.numthreads = 0;
+	sv_culltrace.quit = false;
+}
+
+static void SV_CullTraces_StartThreads(int numthreads)
+{
+	sv_culltrace.mutex = Thread_CreateMutex();
+	sv_culltrace.wakecond = Thread_CreateCond();
+	sv_culltrace.donecond = Thread_CreateCond();
+	sv_culltrace.nextjob = sv_culltrace.numjobs = sv_culltrace.numdone = 0;
+	for (sv_culltrace.numthreads = 0;sv_culltrace.numthreads < numthreads;sv_culltrace.numthreads++)
+		sv_culltrace.threads[sv_culltrace.numthreads] = Thread_CreateThread(SV_CullTraces_Thread, NULL);
+}
+
+// returns the number of samples to trace for an entity (0 = not traced)
+static int SV_CullTraceSamples(prvm_prog_t *prog, const entity_state_t *s, prvm_edict_t *ed, float *trace_delay, qboolean *slow)
+{
+	int culltracemode = PRVM_serveredictfloat(ed, culltracemode);
+	int samples;
+	if (!culltracemode) {
+		culltracemode = s->number <= svs.maxclients ? CULLTRACEMODE_PLAYER :
+				s->specialvisibilityradius ? CULLTRACEMODE_EXTRA : CULLTRACEMODE_SIMPLE;
+	}
+	samples =
+		culltracemode == CULLTRACEMODE_PLAYER
+			? sv_cullentities_trace_samples_players.integer
+			:
+		culltracemode == CULLTRACEMODE_EXTRA
+			? sv_cullentities_trace_samples_extra.integer
+			: sv_cullentities_trace_samples.integer;
+	if (culltracemode == CULLTRACEMODE_NONE)
+		return 0;
+	*trace_delay = (culltracemode == CULLTRACEMODE_PLAYER ?
+			sv_cullentities_trace_delay_players.value :
+			sv_cullentities_trace_delay.value);
+	*slow = culltracemode == CULLTRACEMODE_PLAYER;
+	return samples;
+}
+
+// returns true if the entity does not touch the PVS of the client (the
+// result is shared with other clients using the same PVS, except for
+// entities that customizeentityforclient may move for each client)
+static qboolean SV_EntityCulledByPVS(entity_state_t *s, prvm_edict_t *ed)
+{
+	unsigned char *visible;
+	if (!sv_cullentities_pvs.integer
+		#ifndef CONFIG_SV
+		|| r_novis.integer
+		#endif
+		|| !sv.writeentitiestoclient_pvsbytes)
+		return false;
+	visible = sv.writeentitiestoclient_pvsvisible && !s->customizeentityforclient ? &sv.writeentitiestoclient_pvsvisible[s - sv.sendentities] : NULL;
+	if (visible && !*visible)
+		*visible = SV_EntityTouchesPVS(ed, sv.writeentitiestoclient_pvs) ? 1 : 2;
+	return visible ? *visible == 2 : !SV_EntityTouchesPVS(ed, sv.writeentitiestoclient_pvs);
+}
+
+/*
+=============
+SV_CullTraces_Run
+
+Runs the culling traces that the current client needs for this frame
+=============
+*/
+static void SV_CullTraces_Run(void)
+{
+	prvm_prog_t *prog = SVVM_prog;
+	int i, e, samples, eyeindex, numjobs, numthreads;
+	int clientnumber = sv.writeentitiestoclient_clientnumber;
+	int cliententity = sv.writeentitiestoclient_cliententitynumber;
+	float trace_delay;
+	qboolean slow;
+	entity_state_t *s;
+	prvm_edict_t *ed;
+	dp_model_t *model;
+	sv_culltracejob_t *job;
+
+	if (sv.sententitiesmark <= sv_culltrace.lastmark)
+		memset(sv_culltrace.resultmark, 0, sizeof(sv_culltrace.resultmark));
+	sv_culltrace.lastmark = sv.sententitiesmark;
+	if (!sv_cullentities_trace.integer || !sv.worldmodel || !sv.worldmodel->brush.TraceLineOfSight)
+		return;
+
+	// collect the entities that would be traced
+	numjobs = 0;
+	sv_culltrace.numendpoints = 0;
+	sv_culltrace.numclipboxes = 0;
+	for (i = 0, s = sv.sendentities;i < sv.numsendentities;i++, s++)
+	{
+		// customizeentityforclient may change the state, traced inline
+		if (s->customizeentityforclient || s->number == cliententity)
 			continue;
-		model = SV_GetModelFromEdict(touch);
-		if (!model || !model->brush.TraceLineOfSight)
+		if (s->nodrawtoclient == cliententity || (s->drawonlytoclient && s->drawonlytoclient != cliententity) || (s->effects & (EF_NODRAW | EF_NODEPTHTEST)))
 			continue;
-		// skip obviously transparent entities
-		alpha = PRVM_serveredictfloat(touch, alpha);
-		if (alpha && alpha < 1)
+		if (!s->modelindex && s->specialvisibilityradius == 0)
 			continue;
-		if ((int)PRVM_serveredictfloat(touch, effects) & EF_ADDITIVE)
+		// viewmodels, attachments and bmodels are not traced
+		if (s->viewmodelforclient || s->tagentity)
+			continue;
+		if ((model = SV_GetModelByIndex(s->modelindex)) != NULL && model->name[0] == '*')
+			continue;
+		ed = PRVM_EDICT_NUM(s->number);
+		samples = SV_CullTraceSamples(prog, s, ed, &trace_delay, &slow);
+		if (samples <= 0 || svs.clients[clientnumber].visibletime[s->number] - trace_delay * 0.5 > realtime)
+			continue;
+		if (SV_EntityCulledByPVS(s, ed))
 			continue;
-		touchedicts[numtouchedicts++] = touch;
-	}
 
-	// now that we have a filtered list of "interesting" entities, fire each
-	// ray against all of them, this gives us an early-out case when something
-	// is visible (which it often is)
+		samples = min(samples, MAX_LINEOFSIGHTTRACES);
+		if (sv_culltrace.maxjobs <= numjobs)
+		{
+			sv_culltrace.maxjobs = max(sv_culltrace.maxjobs * 2, 256);
+			sv_culltrace.jobs = (sv_culltracejob_t *)Mem_Realloc(sv_mempool, sv_culltrace.jobs, sv_culltrace.maxjobs * sizeof(*sv_culltrace.jobs));
+		}
+		if (sv_culltrace.maxendpoints < sv_culltrace.numendpoints + samples * sv.writeentitiestoclient_numeyes)
+		{
+			sv_culltrace.maxendpoints = max(sv_culltrace.maxendpoints * 2, sv_culltrace.numendpoints + samples * sv.writeentitiestoclient_numeyes);
+			sv_culltrace.endpoints = (vec3_t *)Mem_Realloc(sv_mempool, sv_culltrace.endpoints, sv_culltrace.maxendpoints * sizeof(*sv_culltrace.endpoints));
+		}
+		if (sv_culltrace.maxclipboxes < sv_culltrace.numclipboxes + 2 * sv.writeentitiestoclient_numeyes)
+		{
+			sv_culltrace.maxclipboxes = max(sv_culltrace.maxclipboxes * 2, sv_culltrace.numclipboxes + 2 * sv.writeentitiestoclient_numeyes);
+			sv_culltrace.clipboxes = (vec3_t *)Mem_Realloc(sv_mempool, sv_culltrace.clipboxes, sv_culltrace.maxclipboxes * sizeof(*sv_culltrace.clipboxes));
+		}
+		job = sv_culltrace.jobs + numjobs++;
+		job->number = s->number;
+		job->numtraces = samples;
+		job->slow = slow;
+		job->firstendpoint = sv_culltrace.numendpoints;
+		job->firsteye = sv_culltrace.numclipboxes;
+		for (eyeindex = 0;eyeindex < sv.writeentitiestoclient_numeyes;eyeindex++)
+		{
+			SV_CanSeeBox_EndPoints(samples, sv_cullentities_trace_enlarge.value, sv.writeentitiestoclient_eyes[eyeindex], ed->priv.server->cullmins, ed->priv.server->cullmaxs, sv_culltrace.endpoints + sv_culltrace.numendpoints, sv_culltrace.clipboxes[sv_culltrace.numclipboxes], sv_culltrace.clipboxes[sv_culltrace.numclipboxes + 1]);
+			sv_culltrace.numendpoints += samples;
+			sv_culltrace.numclipboxes += 2;
+		}
+		sv_culltrace.resultmark[s->number] = sv.sententitiesmark;
+	}
+	if (!numjobs)
+		return;
 
-	for (traceindex = 0;traceindex < numtraces;traceindex++)
+	// list the doors and other bsp models that can hide entities
+	sv_culltrace.numoccluders = 0;
+	if (sv_cullentities_trace_entityocclusion.integer)
 	{
-		// check world occlusion
-		if (sv.worldmodel && sv.worldmodel->brush.TraceLineOfSight)
-			if (!sv.worldmodel->brush.TraceLineOfSight(sv.worldmodel, eye, endpoints[traceindex], slow))
-				continue;
-		for (touchindex = 0;touchindex < numtouchedicts;touchindex++)
+		for (e = 1, ed = PRVM_NEXT_EDICT(prog->edicts);e < prog->num_edicts;e++, ed = PRVM_NEXT_EDICT(ed))
 		{
-			touch = touchedicts[touchindex];
-			model = SV_GetModelFromEdict(touch);
-			if(model && model->brush.TraceLineOfSight)
+			if (ed->priv.server->free)
+				continue;
+			if (sv_culltrace.maxoccluders <= sv_culltrace.numoccluders)
 			{
-				// get the entity matrix
-				pitchsign = SV_GetPitchSign(prog, touch);
-				Matrix4x4_CreateFromQuakeEntity(&matrix, PRVM_serveredictvector(touch, origin)[0], PRVM_serveredictvector(touch, origin)[1], PRVM_serveredictvector(touch, origin)[2], pitchsign * PRVM_serveredictvector(touch, angles)[0], PRVM_serveredictvector(touch, angles)[1], PRVM_serveredictvector(touch, angles)[2], 1);
-				Matrix4x4_Invert_Simple(&imatrix, &matrix);
-				// see if the ray hits this entity
-				Matrix4x4_Transform(&imatrix, eye, starttransformed);
-				Matrix4x4_Transform(&imatrix, endpoints[traceindex], endtransformed);
-				if (!model->brush.TraceLineOfSight(model, starttransformed, endtransformed, slow))
-				{
-					break;
-				}
+				sv_culltrace.maxoccluders = max(sv_culltrace.maxoccluders * 2, 64);
+				sv_culltrace.occluders = (sv_culloccluder_t *)Mem_Realloc(sv_mempool, sv_culltrace.occluders, sv_culltrace.maxoccluders * sizeof(*sv_culltrace.occluders));
 			}
+			if (SV_CullOccluder_Setup(prog, ed, sv_culltrace.occluders + sv_culltrace.numoccluders))
+				sv_culltrace.numoccluders++;
 		}
-		// check if the ray was blocked
-		if (touchindex < numtouchedicts)
-			continue;
-		// return if the ray was not blocked
-		return true;
 	}
 
-	// no rays survived
-	return false;
+	// these trace paths mark brushes or surfaces as they go and can not be
+	// used from several threads at once
+	numthreads = bound(0, sv_cullentities_trace_threads.integer, SV_CULLTRACE_MAXTHREADS);
+	if (sv_gameplayfix_q1bsptracelinereportstexture.integer || mod_q3bsp_tracelineofsight_brushes.integer || (sv_culltrace.numoccluders && !mod_collision_bih.integer) || !Thread_HasThreads())
+		numthreads = 0;
+	if (sv_culltrace.numthreads != numthreads)
+	{
+		SV_CullTraces_StopThreads();
+		if (numthreads)
+			SV_CullTraces_StartThreads(numthreads);
+	}
+
+	if (!sv_culltrace.numthreads || numjobs <= SV_CULLTRACE_CHUNK)
+	{
+		for (i = 0;i < numjobs;i++)
+			SV_CullTraces_RunJob(sv_culltrace.jobs + i);
+		return;
+	}
+
+	// hand the jobs to the threads and help them until all are done
+	Thread_LockMutex(sv_culltrace.mutex);
+	sv_culltrace.numjobs = numjobs;
+	sv_culltrace.nextjob = 0;
+	sv_culltrace.numdone = 0;
+	Thread_CondBroadcast(sv_culltrace.wakecond);
+	SV_CullTraces_Work();
+	while (sv_culltrace.numdone < sv_culltrace.numjobs)
+		Thread_CondWait(sv_culltrace.donecond, sv_culltrace.mutex);
+	Thread_UnlockMutex(sv_culltrace.mutex);
 }
 
-#define CULLTRACEMODE_PLAYER 1
-#define CULLTRACEMODE_EXTRA 2
-#define CULLTRACEMODE_SIMPLE 3
-#define CULLTRACEMODE_NONE 4
 static void SV_MarkWriteEntityStateToClient(entity_state_t *s)
 {
 	prvm_prog_t *prog = SVVM_prog;
@@ -1681,65 +2320,34 @@ static void SV_MarkWriteEntityStateToClient(entity_state_t *s)
 			ed = PRVM_EDICT_NUM(s->number);
 
 			// if not touching a visible leaf
-			if (sv_cullentities_pvs.integer
-					#ifndef CONFIG_SV
-					&& !r_novis.integer
-					#endif
-					&& sv.writeentitiestoclient_pvsbytes)
+			if (SV_EntityCulledByPVS(s, ed))
 			{
-				if (ed->priv.server->pvs_numclusters < 0)
-				{
-					// entity too big for clusters list
-					if (sv.worldmodel && sv.worldmodel->brush.BoxTouchingPVS && !sv.worldmodel->brush.BoxTouchingPVS(sv.worldmodel, sv.writeentitiestoclient_pvs, ed->priv.server->cullmins, ed->priv.server->cullmaxs))
-					{
-						sv.writeentitiestoclient_stats_culled_pvs++;
-						return;
-					}
-				}
-				else
-				{
-					int i;
-					// check cached clusters list
-					for (i = 0;i < ed->priv.server->pvs_numclusters;i++)
-						if (CHECKPVSBIT(sv.writeentitiestoclient_pvs, ed->priv.server->pvs_clusterlist[i]))
-							break;
-					if (i == ed->priv.server->pvs_numclusters)
-					{
-						sv.writeentitiestoclient_stats_culled_pvs++;
-						return;
-					}
-				}
+				sv.writeentitiestoclient_stats_culled_pvs++;
+				return;
 			}
 
 			// or not seen by random tracelines
 			if (sv_cullentities_trace.integer && !isbmodel && sv.worldmodel && sv.worldmodel->brush.TraceLineOfSight)
 			{
-				int culltracemode = PRVM_serveredictfloat(ed, culltracemode);
-				int samples;
-				float enlarge = sv_cullentities_trace_enlarge.value;
-				if (!culltracemode) {
-					culltracemode = s->number <= svs.maxclients ? CULLTRACEMODE_PLAYER :
-							s->specialvisibilityradius ? CULLTRACEMODE_EXTRA : CULLTRACEMODE_SIMPLE;
-				}
-				samples =
-					culltracemode == CULLTRACEMODE_PLAYER
-						? sv_cullentities_trace_samples_players.integer
-						:
-					culltracemode == CULLTRACEMODE_EXTRA
-						? sv_cullentities_trace_samples_extra.integer
-						: sv_cullentities_trace_samples.integer;
-
-				if(samples > 0 && culltracemode != CULLTRACEMODE_NONE)
+				float trace_delay;
+				qboolean slow, visible;
+				int samples = SV_CullTraceSamples(prog, s, ed, &trace_delay, &slow);
+
+				if(samples > 0)
 				{
 					int eyeindex;
-					float trace_delay = (culltracemode == CULLTRACEMODE_PLAYER ?
-							sv_cullentities_trace_delay_players.value :
-							sv_cullentities_trace_delay.value);
 					if (svs.clients[sv.writeentitiestoclient_clientnumber].visibletime[s->number] - trace_delay * 0.5 <= realtime) {
-						for (eyeindex = 0;eyeindex < sv.writeentitiestoclient_numeyes;eyeindex++)
-							if(SV_CanSeeBox(samples, enlarge, sv.writeentitiestoclient_eyes[eyeindex], ed->priv.server->cullmins, ed->priv.server->cullmaxs, culltracemode == CULLTRACEMODE_PLAYER))
-								break;
-						if(eyeindex < sv.writeentitiestoclient_numeyes)
+						// use the result of the batch if the entity was in it
+						if (sv_culltrace.resultmark[s->number] == sv.sententitiesmark)
+							visible = sv_culltrace.resultvisible[s->number];
+						else
+						{
+							for (eyeindex = 0;eyeindex < sv.writeentitiestoclient_numeyes;eyeindex++)
+								if(SV_CanSeeBox(samples, sv_cullentities_trace_enlarge.value, sv.writeentitiestoclient_eyes[eyeindex], ed->priv.server->cullmins, ed->priv.server->cullmaxs, slow))
+									break;
+							visible = eyeindex < sv.writeentitiestoclient_numeyes;
+						}
+						if(visible)
 							svs.clients[sv.writeentitiestoclient_clientnumber].visibletime[s->number] =
 								realtime + trace_delay * 1.5;
 						else if (realtime > svs.clients[sv.writeentitiestoclient_clientnumber].visibletime[s->number])
@@ -1846,6 +2454,7 @@ static void SV_WriteEntitiesToClient(client_t *client, prvm_edict_t *clent, size
 	entity_state_t *s;
 	prvm_edict_t *camera;
 	qboolean success;
+	qboolean sharedpvs = false;
 	vec3_t eye;
 
 	// if there isn't enough space to accomplish anything, skip it
@@ -1910,8 +2519,16 @@ static void SV_WriteEntitiesToClient(client_t *client, prvm_edict_t *clent, size
 		for(i = 1; i < sv.writeentitiestoclient_numeyes; ++i)
 			sv.worldmodel->brush.FatPVS(sv.worldmodel, sv.writeentitiestoclient_eyes[i], 8, sv.writeentitiestoclient_pvs, sv.writeentitiestoclient_pvsbytes, true);
 
+	// look up the PVS culling results of other clients with the same PVS
+	sv.writeentitiestoclient_pvsvisible = NULL;
+	if (sv_cullentities_pvs.integer && sv_cullentities_pvs_share.integer && sv.writeentitiestoclient_pvsbytes)
+		sv.writeentitiestoclient_pvsvisible = SV_PVSCache_Find(sv.writeentitiestoclient_pvs, sv.writeentitiestoclient_pvsbytes, &sharedpvs);
+
 	sv.sententitiesmark++;
 
+	// run the culling traces of this client on the worker threads
+	SV_CullTraces_Run();
+
 	for (i = 0;i < sv.numsendentities;i++)
 		SV_MarkWriteEntityStateToClient(sv.sendentities + i);
 
@@ -1941,7 +2558,7 @@ static void SV_WriteEntitiesToClient(client_t *client, prvm_edict_t *clent, size
 	}
 
 	if (sv_cullentities_stats.integer)
-		Con_Printf("client \"%s\" entities: %d total, %d visible, %d culled by: %d pvs %d trace\n", client->name, sv.writeentitiestoclient_stats_totalentities, sv.writeentitiestoclient_stats_visibleentities, sv.writeentitiestoclient_stats_culled_pvs + sv.writeentitiestoclient_stats_culled_trace, sv.writeentitiestoclient_stats_culled_pvs, sv.writeentitiestoclient_stats_culled_trace);
+		Con_Printf("client \"%s\" entities: %d total, %d visible, %d culled by: %d pvs %d trace%s\n", client->name, sv.writeentitiestoclient_stats_totalentities, sv.writeentitiestoclient_stats_visibleentities, sv.writeentitiestoclient_stats_culled_pvs + sv.writeentitiestoclient_stats_culled_trace, sv.writeentitiestoclient_stats_culled_pvs, sv.writeentitiestoclient_stats_culled_trace, sharedpvs ? " (shared pvs)" : "");
 
 	if(client->entitydatabase5)
 		need_empty = EntityFrameCSQC_WriteFrame(msg, maxsize, numcsqcsendstates, sv.writeentitiestoclient_csqcsendstates, client->entitydatabase5->latestframenum + 1);
@@ -1961,7 +2578,10 @@ static void SV_WriteEntitiesToClient(client_t *client, prvm_edict_t *clent, size
 	client->lastmovesequence = client->movesequence;
 
 	if (client->entitydatabase5)
+	{
+		VectorCopy(sv.writeentitiestoclient_eyes[0], client->entitydatabase5->vieworigin);
 		success = EntityFrame5_WriteFrame(msg, maxsize, client->entitydatabase5, numsendstates, sv.writeentitiestoclient_sendstates, client - svs.clients + 1, client->movesequence, need_empty);
+	}
 	else if (client->entitydatabase4)
 	{
 		success = EntityFrame4_WriteFrame(msg, maxsize, client->entitydatabase4, numsendstates, sv.writeentitiestoclient_sendstates);
@@ -1998,7 +2618,13 @@ static void SV_CleanupEnts (void)
 
 	ent = PRVM_NEXT_EDICT(prog->edicts);
 	for (e=1 ; e<prog->num_edicts ; e++, ent = PRVM_NEXT_EDICT(ent))
-		PRVM_serveredictfloat(ent, effects) = (int)PRVM_serveredictfloat(ent, effects) & ~EF_MUZZLEFLASH;
+	{
+		if ((int)PRVM_serveredictfloat(ent, effects) & EF_MUZZLEFLASH)
+		{
+			PRVM_serveredictfloat(ent, effects) = (int)PRVM_serveredictfloat(ent, effects) & ~EF_MUZZLEFLASH;
+			PRVM_ED_MarkChanged(prog, ent);
+		}
+	}
 }
 
 /*
@@ -2334,6 +2960,57 @@ static void SV_WriteUnreliableMessages(client_t *client, sizebuf_t *msg, int max
 		client->unreliablemsg_splitpoint[j] = client->unreliablemsg_splitpoint[numsegments + j] - split;
 }
 
+/*
+=======================
+SV_CongestionRate
+
+Returns the rate to send to the client at, which is clientrate unless its
+link showed signs of congestion: lost entity frames or a ping well above the
+lowest one seen.  The estimate is cut to 3/4 on congestion and raised by 1/16
+of clientrate after each clean interval, so clients on weak links get
+smaller and fewer packets instead of losing them.
+=======================
+*/
+static int SV_CongestionRate(client_t *client, int clientrate)
+{
+	int total, minrate;
+	float loss;
+	qboolean congested;
+
+	if (!sv_congestioncontrol.integer || !client->begun)
+	{
+		client->congestion_rate = clientrate;
+		client->congestion_nextupdate = realtime + sv_congestioncontrol_interval.value;
+		client->congestion_ackedframes = client->congestion_lostframes = 0;
+		return clientrate;
+	}
+
+	if (client->ping > 0 && (client->congestion_minping <= 0 || client->congestion_minping > client->ping))
+		client->congestion_minping = client->ping;
+
+	if (realtime >= client->congestion_nextupdate)
+	{
+		client->congestion_nextupdate = realtime + max(0.05, sv_congestioncontrol_interval.value);
+		// protocols without frame acks only have the delay signal
+		total = client->congestion_ackedframes + client->congestion_lostframes;
+		loss = total ? client->congestion_lostframes / (float)total : 0;
+		congested = loss > sv_congestioncontrol_loss.value || (client->congestion_minping > 0 && client->ping > client->congestion_minping + sv_congestioncontrol_delay.value);
+		if (congested)
+			client->congestion_rate *= 0.75;
+		else if (!client->congestion_lostframes)
+			client->congestion_rate += clientrate / 16.0;
+		client->congestion_ackedframes = client->congestion_lostframes = 0;
+		// let the lowest ping drift up to the current one so a route change
+		// is not taken as permanent congestion
+		if (client->ping > client->congestion_minping)
+			client->congestion_minping += (client->ping - client->congestion_minping) * 0.01f;
+	}
+
+	minrate = min(clientrate, max(NET_MINRATE, sv_congestioncontrol_minrate.integer));
+	client->congestion_rate = bound(minrate, client->congestion_rate, clientrate);
+	return (int)client->congestion_rate;
+}
+
 /*
 =======================
 SV_SendClientDatagram
@@ -2362,6 +3039,10 @@ static void SV_SendClientDatagram (client_t *client)
 	// (how long to wait before sending another, based on this packet's size)
 	clientrate = bound(NET_MINRATE, client->rate, maxrate);
 
+	// send less to clients whose link is congested, this also shrinks the
+	// entity budget of each packet below
+	clientrate = SV_CongestionRate(client, clientrate);
+
 	switch (sv.protocol)
 	{
 	case PROTOCOL_QUAKE:
@@ -2461,6 +3142,9 @@ static void SV_SendClientDatagram (client_t *client)
 		if (client->unreliablemsg.cursize)
 			SV_WriteUnreliableMessages (client, &msg, maxsize/2, maxsize2);
 
+		// the multi-view demo records everything but the entities per client
+		SV_MultiViewDemo_WriteDatagram(client, &msg, stats);
+
 		// now write as many entities as we can fit, and also sends stats
 		SV_WriteEntitiesToClient (client, client->edict, &msg, maxsize);
 	}
@@ -2498,7 +3182,10 @@ static void SV_SendClientDatagram (client_t *client)
 
 	// reliable only if none is in progress
 	if(client->sendsignon != 2 && !client->netconnection->sendMessageLength)
+	{
 		SV_WriteDemoMessage(client, &(client->netconnection->message), false);
+		SV_MultiViewDemo_WriteReliable(client, &(client->netconnection->message));
+	}
 	// unreliable
 	SV_WriteDemoMessage(client, &msg, false);
 
@@ -2659,6 +3346,7 @@ void SV_SendClientMessages(void)
 			prepared = true;
 			// only prepare entities once per frame
 			SV_PrepareEntitiesForSending();
+			SV_MultiViewDemo_WriteEntities();
 		}
 		SV_SendClientDatagram(host_client);
 	}
@@ -2716,6 +3404,55 @@ static void Download_CheckExtensions(void)
 	}
 }
 
+/*
+ * Reliable message compression negotiation:
+ *
+ * Client to server, in the connect request (so the serverinfo with the
+ * precache lists is covered too):
+ *   \\netcompress\\<list of zero or more supported codecs in order of preference>
+ * e.g.
+ *   \\netcompress\\deflate
+ *
+ * Server to client (only if net_compress is set):
+ *   cl_serverextension_netcompress 1
+ *
+ * Client to server, for servers that ignored the connect request key:
+ *   netcompress <list of zero or more supported codecs in order of preference>
+ *
+ * From then on the server may replace any reliable message with a
+ * svc_compressed message holding it, using the first codec of the list it
+ * supports.
+ */
+
+/*
+================
+SV_SelectNetCompression
+
+Picks the codec for compressing reliable messages to a client from the
+space separated list it sent
+================
+*/
+void SV_SelectNetCompression(netconn_t *conn, const char *codecs)
+{
+	int compression = NETCOMPRESS_NONE;
+	char codec[64];
+
+	// compressing local connections only wastes time
+	if (net_compress.integer && sv.protocol != PROTOCOL_QUAKEWORLD && LHNETADDRESS_GetAddressType(&conn->peeraddress) != LHNETADDRESSTYPE_LOOP)
+	{
+		while (compression == NETCOMPRESS_NONE && COM_ParseToken_Simple(&codecs, false, false, true, codec, sizeof(codec)))
+			compression = NetConn_CompressionForName(codec);
+	}
+	conn->compression = compression;
+	Con_DPrintf("Client %s uses %s compression for reliable messages\n", conn->address, NetConn_CompressionName(compression));
+}
+
+static void SV_NetCompress_f(void)
+{
+	if (host_client->netconnection)
+		SV_SelectNetCompression(host_client->netconnection, Cmd_Args());
+}
+
 static void SV_Download_f(void)
 {
 	const char *whichpack, *whichpack2, *extension;
@@ -2950,6 +3687,9 @@ int SV_ModelIndex(const char *s, int precachemode)
 				if (precachemode == 1)
 					Con_Printf("SV_ModelIndex(\"%s\"): not precached (fix your code), precaching anyway\n", filename);
 				strlcpy(sv.model_precache[i], filename, sizeof(sv.model_precache[i]));
+				// entities referring to this index were not sent until now
+				sv.preparedentities_valid = false;
+				sv.serverinfo_valid = false;
 				if (sv.state == ss_loading)
 				{
 					// running from SV_SpawnServer which is launched from the client console command interpreter
@@ -3017,6 +3757,7 @@ int SV_SoundIndex(const char *s, int precachemode)
 				if (precachemode == 1)
 					Con_Printf("SV_SoundIndex(\"%s\"): not precached (fix your code), precaching anyway\n", filename);
 				strlcpy(sv.sound_precache[i], filename, sizeof(sv.sound_precache[i]));
+				sv.serverinfo_valid = false;
 				if (sv.state != ss_loading)
 				{
 					MSG_WriteByte(&sv.reliable_datagram, svc_precache);
@@ -3353,6 +4094,7 @@ void SV_SpawnServer (const char *server)
 	#endif
 	if(sv.active)
 	{
+		SV_MultiViewDemo_Stop();
 		World_End(&sv.world);
 		if(PRVM_serverfunction(SV_Shutdown))
 		{
@@ -3366,6 +4108,11 @@ void SV_SpawnServer (const char *server)
 	// free q3 shaders so that any newly downloaded shaders will be active
 	Mod_FreeQ3Shaders();
 
+	// read the progs and the entity patch while the map is being loaded
+	FS_PrefetchFile(sv_progs.string);
+	if (sv_entpatch.integer)
+		FS_PrefetchFile(va(vabuf, sizeof(vabuf), "maps/%s.ent", server));
+
 	worldmodel = Mod_ForName(modelname, false, developer.integer > 0, NULL);
 	if (!worldmodel || worldmodel->failed || !worldmodel->TraceBox)
 	{
@@ -3568,6 +4315,8 @@ void SV_SpawnServer (const char *server)
 
 // all setup is completed, any further precache statements are errors
 //	sv.state = ss_active; // LordHavoc: workaround for svc_precache bug
+
+	SV_MultiViewDemo_Start();
 	prog->allowworldwrites = false;
 
 // run two frames to allow everything to settle
@@ -3631,6 +4380,56 @@ void SV_SpawnServer (const char *server)
 /////////////////////////////////////////////////////
 // SV VM stuff
 
+/*
+=============
+SV_VM_TrackNetworkFields
+
+Flags every field read by SV_PrepareEntityForSending, QC stores to them mark
+the entity for SV_PrepareEntitiesForSending
+=============
+*/
+static void SV_VM_TrackNetworkFields(prvm_prog_t *prog)
+{
+#define SV_TRACKFIELD(fieldname, size) PRVM_ED_TrackFieldChanges(prog, prog->fieldoffsets.fieldname, size)
+	SV_TRACKFIELD(origin, 3);
+	SV_TRACKFIELD(angles, 3);
+	SV_TRACKFIELD(mins, 3);
+	SV_TRACKFIELD(maxs, 3);
+	SV_TRACKFIELD(color, 3);
+	SV_TRACKFIELD(colormod, 3);
+	SV_TRACKFIELD(glowmod, 3);
+	SV_TRACKFIELD(modelindex, 1);
+	SV_TRACKFIELD(model, 1);
+	SV_TRACKFIELD(effects, 1);
+	SV_TRACKFIELD(glow_size, 1);
+	SV_TRACKFIELD(glow_trail, 1);
+	SV_TRACKFIELD(glow_color, 1);
+	SV_TRACKFIELD(light_lev, 1);
+	SV_TRACKFIELD(style, 1);
+	SV_TRACKFIELD(pflags, 1);
+	SV_TRACKFIELD(viewmodelforclient, 1);
+	SV_TRACKFIELD(exteriormodeltoclient, 1);
+	SV_TRACKFIELD(nodrawtoclient, 1);
+	SV_TRACKFIELD(drawonlytoclient, 1);
+	SV_TRACKFIELD(existsonlyfor, 1);
+	SV_TRACKFIELD(customizeentityforclient, 1);
+	SV_TRACKFIELD(colormap, 1);
+	SV_TRACKFIELD(skin, 1);
+	SV_TRACKFIELD(frame, 1);
+	SV_TRACKFIELD(tag_entity, 1);
+	SV_TRACKFIELD(tag_index, 1);
+	SV_TRACKFIELD(traileffectnum, 1);
+	SV_TRACKFIELD(alpha, 1);
+	SV_TRACKFIELD(renderamt, 1);
+	SV_TRACKFIELD(scale, 1);
+	SV_TRACKFIELD(fullbright, 1);
+	SV_TRACKFIELD(modelflags, 1);
+	SV_TRACKFIELD(movetype, 1);
+	SV_TRACKFIELD(sendcomplexanimation, 1);
+	SV_TRACKFIELD(SendEntity, 1);
+#undef SV_TRACKFIELD
+}
+
 static void SVVM_begin_increase_edicts(prvm_prog_t *prog)
 {
 	// links don't survive the transition, so unlink everything
@@ -3961,6 +4760,8 @@ static void SV_VM_Setup(void)
 	// OP_STATE is always supported on server because we add fields/globals for it
 	prog->flag |= PRVM_OP_STATE;
 
+	SV_VM_TrackNetworkFields(prog);
+
 	VM_CustomStats_Clear();//[515]: csqc
 
 	SV_Prepare_CSQC();
@@ -923,13 +923,7 @@ clc_stringcmd_invalid:
 						// download rather than the start because it reduces
 						// potential for Denial Of Service attacks against the
 						// server.
-						int crc;
-						unsigned char *temp;
-						FS_Seek(host_client->download_file, 0, SEEK_SET);
-						temp = (unsigned char *) Mem_Alloc(tempmempool, size);
-						FS_Read(host_client->download_file, temp, size);
-						crc = CRC_Block(temp, size);
-						Mem_Free(temp);
+						int crc = FS_CRCOpenedFile(host_client->download_file, NULL);
 						// calculated crc, send the file info to the client
 						// (so that it can verify the data)
 						Host_ClientCommands("\ncl_downloadfinished %i %i %s\n", size, crc, host_client->download_name);
@@ -963,9 +957,13 @@ clc_stringcmd_invalid:
 			{
 				int i;
 				for (i = host_client->latestframenum + 1;i < num;i++)
+				{
 					if (!SV_FrameLost(i))
 						break;
+					host_client->congestion_lostframes++;
+				}
 				SV_FrameAck(num);
+				host_client->congestion_ackedframes++;
 				host_client->latestframenum = num;
 			}
 			break;
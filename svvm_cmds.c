@@ -292,6 +292,7 @@ static void SetMinMaxSize (prvm_prog_t *prog, prvm_edict_t *e, float *min, float
 	VectorCopy (min, PRVM_serveredictvector(e, mins));
 	VectorCopy (max, PRVM_serveredictvector(e, maxs));
 	VectorSubtract (max, min, PRVM_serveredictvector(e, size));
+	PRVM_ED_MarkChanged(prog, e);
 
 	SV_LinkEdict(e);
 }
@@ -360,6 +361,7 @@ static void VM_SV_setmodel(prvm_prog_t *prog)
 	i = SV_ModelIndex(PRVM_G_STRING(OFS_PARM1), 1);
 	PRVM_serveredictstring(e, model) = PRVM_SetEngineString(prog, sv.model_precache[i]);
 	PRVM_serveredictfloat(e, modelindex) = i;
+	PRVM_ED_MarkChanged(prog, e);
 
 	mod = SV_GetModelByIndex(i);
 
@@ -1817,6 +1819,7 @@ static void VM_SV_copyentity(prvm_prog_t *prog)
 		return;
 	}
 	memcpy(out->fields.fp, in->fields.fp, prog->entityfields * sizeof(prvm_vec_t));
+	PRVM_ED_MarkChanged(prog, out);
 	SV_LinkEdict(out);
 }
 
@@ -2434,6 +2437,7 @@ static void VM_SV_setattachment(prvm_prog_t *prog)
 
 	PRVM_serveredictedict(e, tag_entity) = PRVM_EDICT_TO_PROG(tagentity);
 	PRVM_serveredictfloat(e, tag_index) = tagindex;
+	PRVM_ED_MarkChanged(prog, e);
 }
 
 /////////////////////////////////////////
@@ -2809,6 +2813,7 @@ static void VM_SV_setmodelindex(prvm_prog_t *prog)
 
 	PRVM_serveredictstring(e, model) = PRVM_SetEngineString(prog, sv.model_precache[i]);
 	PRVM_serveredictfloat(e, modelindex) = i;
+	PRVM_ED_MarkChanged(prog, e);
 
 	mod = SV_GetModelByIndex(i);
 
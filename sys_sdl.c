@@ -59,6 +59,9 @@ void Sys_Error (const char *error, ...)
 
 	Con_Printf ("Quake Error: %s\n", string);
 
+	// files that were closed already are still waiting to be written
+	FS_WriteQueue_Flush ();
+
 #ifdef WIN32
 	MessageBox(NULL, string, "Quake Error", MB_OK | MB_SETFOREGROUND | MB_ICONSTOP);
 #endif
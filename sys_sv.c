@@ -41,6 +41,9 @@ void Sys_Error (const char *error, ...)
 
 	Con_Printf ("Quake Error: %s\n", string);
 
+	// files that were closed already are still waiting to be written
+	FS_WriteQueue_Flush ();
+
 	Sys_Shutdown ();
 	exit (1);
 }
@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define ZONE_H
 
 extern qboolean mem_bigendian;
+extern unsigned int sentinel_seed;
 
 // div0: heap overflow detection paranoia
 #define MEMPARANOIA 0